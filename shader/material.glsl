@@ -9,7 +9,8 @@ struct material
     float transmittance;
     float ior;
     float normal_factor;
-    float pad;
+    // Set for two-channel normal maps, whose Z must be reconstructed.
+    int normal_two_channel;
     int albedo_tex_id;
     int metallic_roughness_tex_id;
     int normal_tex_id;
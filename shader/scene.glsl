@@ -166,9 +166,11 @@ sampled_material sample_material(material mat, inout vertex_data v)
             v.bitangent,
             v.smooth_normal
         );
-        vec3 ts_normal = normalize(
-            texture(textures[nonuniformEXT(mat.normal_tex_id)], v.uv).xyz * 2.0f - 1.0f
-        );
+        vec3 ts_normal =
+            texture(textures[nonuniformEXT(mat.normal_tex_id)], v.uv).xyz * 2.0f - 1.0f;
+        if(mat.normal_two_channel != 0)
+            ts_normal.z = sqrt(max(1.0f - dot(ts_normal.xy, ts_normal.xy), 0.0f));
+        ts_normal = normalize(ts_normal);
         v.mapped_normal = normalize(tbn * (ts_normal * vec3(mat.normal_factor, mat.normal_factor, 1.0f)));
         // Sometimes annoying stuff happens and the normal is broken. This isn't
         // usually fatal in rasterization, but is one source of NaN values in
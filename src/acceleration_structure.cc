@@ -10,10 +10,11 @@ bottom_level_acceleration_structure::bottom_level_acceleration_structure(
     const std::vector<entry>& entries,
     bool backface_culled,
     bool dynamic,
-    bool compact
+    bool compact,
+    bool build
 ):  updates_since_rebuild(0), geometry_count(entries.size()),
     backface_culled(backface_culled), dynamic(dynamic), compact(!dynamic && compact),
-    buffers(dev)
+    scratch(nullptr), buffers(dev)
 {
     transform_buffer = gpu_buffer(
         dev,
@@ -24,14 +25,214 @@ bottom_level_acceleration_structure::bottom_level_acceleration_structure(
         vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR
     );
 
-    for(size_t frame_index = 0; frame_index < MAX_FRAMES_IN_FLIGHT; ++frame_index)
+    for(size_t frame_index = 0; frame_index < dev.get_context()->get_frames_in_flight(); ++frame_index)
         update_transforms(frame_index, entries);
 
+    if(build)
+        build_batch(dev, {{this, &entries}});
+}
+
+void bottom_level_acceleration_structure::build_batch(
+    device_mask dev,
+    const std::vector<batch_entry>& batch
+){
+    if(batch.size() == 0) return;
+
     for(device& d: dev)
     {
+        vk::DeviceSize alignment =
+            d.as_props.minAccelerationStructureScratchOffsetAlignment;
+
+        // All builds share one temporary scratch buffer. If it would grow
+        // past the budget, builds are split into waves that reuse it.
+        // Structures that are rebuilt later get their scratch memory from a
+        // scratch_arena instead, so only the size is stored here.
+        std::vector<build_info> infos(batch.size());
+        std::vector<vk::DeviceSize> shared_scratch_offsets(batch.size(), 0);
+        std::vector<size_t> wave_starts = {0};
+        vk::DeviceSize wave_scratch_size = 0;
+        vk::DeviceSize shared_scratch_size = 0;
+        std::vector<bottom_level_acceleration_structure*> compacted;
+        for(size_t i = 0; i < batch.size(); ++i)
+        {
+            bottom_level_acceleration_structure& as = *batch[i].as;
+            build_info& info = infos[i];
+            as.updates_since_rebuild = 0;
+            as.init_build_info(d.id, *batch[i].entries, false, info);
+
+            vk::AccelerationStructureBuildSizesInfoKHR size_info =
+                d.logical.getAccelerationStructureBuildSizesKHR(
+                    vk::AccelerationStructureBuildTypeKHR::eDevice,
+                    info.info, info.primitive_count
+                );
+            as.create_blas(d.id, size_info.accelerationStructureSize);
+
+            if(as.compact) compacted.push_back(&as);
+            else
+            {
+                as.buffers[d.id].scratch_size = std::max(
+                    size_info.buildScratchSize, size_info.updateScratchSize
+                );
+            }
+
+            vk::DeviceSize size =
+                (size_info.buildScratchSize + alignment - 1) / alignment * alignment;
+            if(
+                wave_scratch_size != 0 &&
+                wave_scratch_size + size > BATCH_SCRATCH_BUDGET
+            ){
+                wave_starts.push_back(i);
+                wave_scratch_size = 0;
+            }
+            shared_scratch_offsets[i] = wave_scratch_size;
+            wave_scratch_size += size;
+            shared_scratch_size = std::max(shared_scratch_size, wave_scratch_size);
+        }
+        wave_starts.push_back(batch.size());
+
+        vkm<vk::Buffer> shared_scratch;
+        vk::DeviceAddress shared_scratch_address = 0;
+        if(shared_scratch_size != 0)
+        {
+            vk::BufferCreateInfo scratch_info(
+                {}, shared_scratch_size,
+                vk::BufferUsageFlagBits::eStorageBuffer|
+                vk::BufferUsageFlagBits::eShaderDeviceAddress,
+                vk::SharingMode::eExclusive
+            );
+            shared_scratch = create_buffer_aligned(
+                d, scratch_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+                alignment
+            );
+            shared_scratch_address = shared_scratch.get_address();
+        }
+
         vk::CommandBuffer cb = begin_command_buffer(d);
-        rebuild(d.id, 0, cb, entries, false);
+        for(const batch_entry& be: batch)
+            be.as->transform_buffer.upload(d.id, 0, cb);
+
+        vk::MemoryBarrier upload_barrier(
+            vk::AccessFlagBits::eTransferWrite,
+            vk::AccessFlagBits::eAccelerationStructureReadKHR
+        );
+        cb.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            {}, upload_barrier, {}, {}
+        );
+
+        vk::MemoryBarrier build_barrier(
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+            vk::AccessFlagBits::eAccelerationStructureReadKHR|
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR
+        );
+        for(size_t wave = 0; wave+1 < wave_starts.size(); ++wave)
+        {
+            std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> build_infos;
+            std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> range_ptrs;
+            for(size_t i = wave_starts[wave]; i < wave_starts[wave+1]; ++i)
+            {
+                bottom_level_acceleration_structure& as = *batch[i].as;
+                buffer_data& bd = as.buffers[d.id];
+                build_info& info = infos[i];
+                info.info.setGeometries(info.geometries);
+                info.info.dstAccelerationStructure = bd.blas;
+                info.info.scratchData.deviceAddress =
+                    shared_scratch_address + shared_scratch_offsets[i];
+                build_infos.push_back(info.info);
+                range_ptrs.push_back(info.ranges.data());
+            }
+
+            // The shared scratch buffer is reused by the next wave.
+            if(wave != 0)
+            {
+                cb.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    {}, build_barrier, {}, {}
+                );
+            }
+            cb.buildAccelerationStructuresKHR(build_infos, range_ptrs);
+        }
+
+        vkm<vk::QueryPool> query_pool;
+        if(compacted.size() != 0)
+        {
+            cb.pipelineBarrier(
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                {}, build_barrier, {}, {}
+            );
+
+            query_pool = vkm(d, d.logical.createQueryPool({
+                {},
+                vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+                (uint32_t)compacted.size(),
+                {}
+            }));
+            cb.resetQueryPool(query_pool, 0, (uint32_t)compacted.size());
+
+            std::vector<vk::AccelerationStructureKHR> handles;
+            for(bottom_level_acceleration_structure* as: compacted)
+                handles.push_back(as->buffers[d.id].blas);
+            cb.writeAccelerationStructuresPropertiesKHR(
+                handles,
+                vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+                query_pool,
+                0
+            );
+        }
         end_command_buffer(d, cb);
+        // end_command_buffer() waits for the device, so the scratch memory
+        // can be released right away.
+        if(shared_scratch_size != 0)
+            shared_scratch.destroy();
+
+        if(compacted.size() != 0)
+        {
+            // NVIDIA bug as of 460.27.04: Only the lower 32 bits of the
+            // parameter get written to, despite the spec saying that it's
+            // supposed to be a VkDeviceSize (uint64_t). We need to make sure
+            // that the size is zero-initialized to avoid the higher 32 bits
+            // breaking everything.
+            std::vector<vk::DeviceSize> compact_sizes(compacted.size(), 0);
+            (void)d.logical.getQueryPoolResults(
+                query_pool, 0, (uint32_t)compacted.size(),
+                compact_sizes.size() * sizeof(vk::DeviceSize),
+                compact_sizes.data(),
+                sizeof(vk::DeviceSize),
+                vk::QueryResultFlagBits::eWait
+            );
+
+            std::vector<vkm<vk::AccelerationStructureKHR>> fat_blases;
+            std::vector<vkm<vk::Buffer>> fat_blas_buffers;
+            cb = begin_command_buffer(d);
+            for(size_t i = 0; i < compacted.size(); ++i)
+            {
+                buffer_data& bd = compacted[i]->buffers[d.id];
+                fat_blases.emplace_back(std::move(bd.blas));
+                fat_blas_buffers.emplace_back(std::move(bd.blas_buffer));
+                compacted[i]->create_blas(d.id, compact_sizes[i]);
+
+                cb.copyAccelerationStructureKHR({
+                    fat_blases.back(),
+                    bd.blas,
+                    vk::CopyAccelerationStructureModeKHR::eCompact
+                });
+            }
+            end_command_buffer(d, cb);
+
+            for(vkm<vk::AccelerationStructureKHR>& fat_blas: fat_blases)
+                fat_blas.destroy();
+            for(vkm<vk::Buffer>& fat_blas_buffer: fat_blas_buffers)
+                fat_blas_buffer.destroy();
+        }
+
+        for(const batch_entry& be: batch)
+        {
+            buffer_data& bd = be.as->buffers[d.id];
+            bd.blas_address = d.logical.getAccelerationStructureAddressKHR({bd.blas});
+        }
     }
 }
 
@@ -60,14 +261,41 @@ void bottom_level_acceleration_structure::rebuild(
     const std::vector<entry>& entries,
     bool update
 ) {
+    if(compact)
+        throw std::runtime_error("Compacted acceleration structures can't be rebuilt");
+
     if(!update) updates_since_rebuild = 0;
-    device& dev = buffers.get_device(id);
     buffer_data& bd = buffers[id];
 
-    std::vector<vk::AccelerationStructureGeometryKHR> geometries(entries.size());
-    std::vector<vk::TransformMatrixKHR> transforms(entries.size());
-    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges(entries.size());
-    std::vector<uint32_t> primitive_count(entries.size());
+    build_info info;
+    init_build_info(id, entries, update, info);
+
+    if(!scratch)
+        throw std::runtime_error("No scratch memory set for acceleration structure rebuild");
+
+    info.info.setGeometries(info.geometries);
+    info.info.srcAccelerationStructure = update ? *bd.blas : VK_NULL_HANDLE;
+    info.info.dstAccelerationStructure = bd.blas;
+    info.info.scratchData.deviceAddress =
+        scratch->get_address(id) + bd.scratch_offset;
+
+    const vk::AccelerationStructureBuildRangeInfoKHR* range_ptr = info.ranges.data();
+
+    transform_buffer.upload(id, frame_index, cb);
+    cb.buildAccelerationStructuresKHR({info.info}, range_ptr);
+}
+
+void bottom_level_acceleration_structure::init_build_info(
+    device_id id,
+    const std::vector<entry>& entries,
+    bool update,
+    build_info& info
+){
+    device& dev = buffers.get_device(id);
+
+    info.geometries.resize(entries.size());
+    info.ranges.resize(entries.size());
+    info.primitive_count.resize(entries.size());
 
     for(size_t i = 0; i < entries.size(); ++i)
     {
@@ -84,14 +312,14 @@ void bottom_level_acceleration_structure::rebuild(
                 vk::Format::eR32G32B32Sfloat,
                 dev.logical.getBufferAddress({m->get_vertex_buffer(id)}),
                 sizeof(mesh::vertex),
-                m->get_vertices().size()-1,
+                m->get_vertex_count()-1,
                 vk::IndexType::eUint32,
                 dev.logical.getBufferAddress({m->get_index_buffer(id)}),
                 transform_address
             );
-            uint32_t triangle_count = m->get_indices().size()/3;
-            ranges[i] = vk::AccelerationStructureBuildRangeInfoKHR{triangle_count, 0, 0, 0};
-            primitive_count[i] = triangle_count;
+            uint32_t triangle_count = m->get_triangle_count();
+            info.ranges[i] = vk::AccelerationStructureBuildRangeInfoKHR{triangle_count, 0, 0, 0};
+            info.primitive_count[i] = triangle_count;
         }
         else
         {
@@ -100,20 +328,20 @@ void bottom_level_acceleration_structure::rebuild(
                 entries[i].aabb_buffer->get_address(id),
                 sizeof(vk::AabbPositionsKHR)
             );
-            ranges[i] = vk::AccelerationStructureBuildRangeInfoKHR{
+            info.ranges[i] = vk::AccelerationStructureBuildRangeInfoKHR{
                 (uint32_t)entries[i].aabb_count, 0, 0, 0
             };
-            primitive_count[i] = entries[i].aabb_count;
+            info.primitive_count[i] = entries[i].aabb_count;
         }
 
         geom.setFlags(entries[i].opaque ?
                 vk::GeometryFlagBitsKHR::eOpaque :
                 vk::GeometryFlagBitsKHR::eNoDuplicateAnyHitInvocation
         );
-        geometries[i] = geom;
+        info.geometries[i] = geom;
     }
 
-    vk::AccelerationStructureBuildGeometryInfoKHR blas_info(
+    info.info = vk::AccelerationStructureBuildGeometryInfoKHR(
         vk::AccelerationStructureTypeKHR::eBottomLevel,
         dynamic ?
             vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild|
@@ -125,136 +353,49 @@ void bottom_level_acceleration_structure::rebuild(
             vk::BuildAccelerationStructureModeKHR::eBuild,
         VK_NULL_HANDLE,
         VK_NULL_HANDLE,
-        geometries.size(),
-        geometries.data()
+        info.geometries.size(),
+        info.geometries.data()
     );
+}
 
-    if(!*bd.blas)
-    {
-        // Need to calculate BLAS size.
-        vk::AccelerationStructureBuildSizesInfoKHR size_info = dev.logical.getAccelerationStructureBuildSizesKHR(
-            vk::AccelerationStructureBuildTypeKHR::eDevice, blas_info, primitive_count
-        );
-        vk::BufferCreateInfo scratch_info(
-            {}, size_info.buildScratchSize,
-            vk::BufferUsageFlagBits::eStorageBuffer|
-            vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::SharingMode::eExclusive
-        );
-        bd.scratch_buffer = create_buffer_aligned(
-            dev, scratch_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-            dev.as_props.minAccelerationStructureScratchOffsetAlignment
-        );
-        bd.scratch_address = bd.scratch_buffer.get_address();
-
-        vk::BufferCreateInfo blas_buffer_info(
-            {}, size_info.accelerationStructureSize,
-            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR|
-            vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::SharingMode::eExclusive
-        );
-        bd.blas_buffer = create_buffer(dev, blas_buffer_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
-
-        vk::AccelerationStructureCreateInfoKHR create_info(
-            {},
-            bd.blas_buffer,
-            {},
-            size_info.accelerationStructureSize,
-            vk::AccelerationStructureTypeKHR::eBottomLevel,
-            {}
-        );
-        bd.blas = vkm(dev, dev.logical.createAccelerationStructureKHR(create_info));
-    }
-    blas_info.srcAccelerationStructure = update ? *bd.blas : VK_NULL_HANDLE;
-    blas_info.dstAccelerationStructure = bd.blas;
-    blas_info.scratchData.deviceAddress = bd.scratch_address;
-
-    const vk::AccelerationStructureBuildRangeInfoKHR* range_ptr = ranges.data();
-
-    vkm<vk::QueryPool> query_pool;
-    vk::CommandBuffer initial_cb;
-    if(compact)
-    {
-        initial_cb = begin_command_buffer(dev);
-        transform_buffer.upload(id, frame_index, initial_cb);
-        query_pool = vkm(dev, dev.logical.createQueryPool({
-            {},
-            vk::QueryType::eAccelerationStructureCompactedSizeKHR,
-            1,
-            {}
-        }));
-        initial_cb.resetQueryPool(query_pool, 0, 1);
-        initial_cb.buildAccelerationStructuresKHR({blas_info}, range_ptr);
-
-        vk::MemoryBarrier barrier(
-            vk::AccessFlagBits::eAccelerationStructureWriteKHR,
-            vk::AccessFlagBits::eAccelerationStructureReadKHR
-        );
-        initial_cb.pipelineBarrier(
-            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
-            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
-            {}, barrier, {}, {}
-        );
-
-        initial_cb.writeAccelerationStructuresPropertiesKHR(
-            *bd.blas,
-            vk::QueryType::eAccelerationStructureCompactedSizeKHR,
-            query_pool,
-            0
-        );
-        end_command_buffer(dev, initial_cb);
-
-        // NVIDIA bug as of 460.27.04: Only the lower 32 bits of the parameter
-        // get written to, despite the spec saying that it's supposed to be a
-        // VkDeviceSize (uint64_t). We need to make sure that the size is
-        // zero-initialized to avoid the higher 32 bits breaking everything.
-        vk::DeviceSize compact_size = 0;
-        (void)dev.logical.getQueryPoolResults(
-            query_pool, 0, 1,
-            sizeof(vk::DeviceSize),
-            &compact_size,
-            sizeof(vk::DeviceSize),
-            vk::QueryResultFlagBits::eWait
-        );
-
-        vkm<vk::AccelerationStructureKHR> fat_blas = std::move(bd.blas);
-        vkm<vk::Buffer> fat_blas_buffer(std::move(bd.blas_buffer));
+void bottom_level_acceleration_structure::create_blas(device_id id, vk::DeviceSize size)
+{
+    device& dev = buffers.get_device(id);
+    buffer_data& bd = buffers[id];
 
-        vk::BufferCreateInfo blas_buffer_info(
-            {}, compact_size,
-            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR|
-            vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::SharingMode::eExclusive
-        );
+    vk::BufferCreateInfo blas_buffer_info(
+        {}, size,
+        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR|
+        vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        vk::SharingMode::eExclusive
+    );
+    bd.blas_buffer = create_buffer(dev, blas_buffer_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
 
-        bd.blas_buffer = create_buffer(dev, blas_buffer_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
-        vk::AccelerationStructureCreateInfoKHR create_info(
-            {},
-            bd.blas_buffer,
-            {},
-            compact_size,
-            vk::AccelerationStructureTypeKHR::eBottomLevel,
-            {}
-        );
+    vk::AccelerationStructureCreateInfoKHR create_info(
+        {},
+        bd.blas_buffer,
+        {},
+        size,
+        vk::AccelerationStructureTypeKHR::eBottomLevel,
+        {}
+    );
+    bd.blas = vkm(dev, dev.logical.createAccelerationStructureKHR(create_info));
+}
 
-        bd.blas = vkm(dev, dev.logical.createAccelerationStructureKHR(create_info));
-        blas_info.dstAccelerationStructure = bd.blas;
+void bottom_level_acceleration_structure::set_scratch(scratch_arena& arena)
+{
+    // Compacted structures are never rebuilt, so they need no scratch
+    // memory after build_batch().
+    scratch = compact ? nullptr : &arena;
+    if(!scratch) return;
 
-        cb.copyAccelerationStructureKHR({
-            fat_blas,
-            bd.blas,
-            vk::CopyAccelerationStructureModeKHR::eCompact
-        });
+    for(auto[dev, bd]: buffers)
+        bd.scratch_offset = arena.reserve(dev.id, bd.scratch_size);
+}
 
-        fat_blas.drop();
-        fat_blas_buffer.drop();
-    }
-    else
-    {
-        transform_buffer.upload(id, frame_index, cb);
-        cb.buildAccelerationStructuresKHR({blas_info}, range_ptr);
-    }
-    bd.blas_address = dev.logical.getAccelerationStructureAddressKHR({bd.blas});
+void bottom_level_acceleration_structure::count_update()
+{
+    updates_since_rebuild++;
 }
 
 size_t bottom_level_acceleration_structure::get_updates_since_rebuild() const
@@ -282,11 +423,17 @@ bool bottom_level_acceleration_structure::is_backface_culled() const
     return backface_culled;
 }
 
+bool bottom_level_acceleration_structure::is_dynamic() const
+{
+    return dynamic;
+}
+
 top_level_acceleration_structure::top_level_acceleration_structure(
     device_mask dev,
     size_t capacity
 ):  updates_since_rebuild(0), instance_count(0),
-    instance_capacity(capacity), require_rebuild(true), buffers(dev)
+    instance_capacity(capacity), require_rebuild(true), scratch(nullptr),
+    buffers(dev)
 {
     instance_buffer = gpu_buffer(
         dev,
@@ -339,20 +486,9 @@ top_level_acceleration_structure::top_level_acceleration_structure(
             {}
         );
         bd.tlas = vkm(dev, dev.logical.createAccelerationStructureKHR(create_info));
-        tlas_info.dstAccelerationStructure = bd.tlas;
-
-        vk::BufferCreateInfo scratch_info(
-            {}, size_info.buildScratchSize,
-            vk::BufferUsageFlagBits::eStorageBuffer|
-            vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::SharingMode::eExclusive
-        );
-
-        bd.scratch_buffer = create_buffer_aligned(
-            dev, scratch_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-            dev.as_props.minAccelerationStructureScratchOffsetAlignment
+        bd.scratch_size = std::max(
+            size_info.buildScratchSize, size_info.updateScratchSize
         );
-        tlas_info.scratchData = bd.scratch_buffer.get_address();
         bd.tlas_address = dev.logical.getAccelerationStructureAddressKHR({bd.tlas});
     }
 }
@@ -362,12 +498,22 @@ gpu_buffer& top_level_acceleration_structure::get_instances_buffer()
     return instance_buffer;
 }
 
+void top_level_acceleration_structure::set_scratch(scratch_arena& arena)
+{
+    scratch = &arena;
+    for(auto[dev, bd]: buffers)
+        bd.scratch_offset = arena.reserve(dev.id, bd.scratch_size);
+}
+
 void top_level_acceleration_structure::rebuild(
     device_id id,
     vk::CommandBuffer cb,
     size_t instance_count,
     bool update
 ){
+    if(!scratch)
+        throw std::runtime_error("No scratch memory set for acceleration structure rebuild");
+    if(!update) updates_since_rebuild = 0;
     buffer_data& bd = buffers[id];
 
     // Barrier to make sure all BLAS's have updated already.
@@ -400,7 +546,7 @@ void top_level_acceleration_structure::rebuild(
         1,
         &tlas_geometry,
         nullptr,
-        bd.scratch_buffer.get_address()
+        scratch->get_address(id) + bd.scratch_offset
     );
 
     vk::AccelerationStructureBuildRangeInfoKHR build_offset_info(
@@ -410,6 +556,11 @@ void top_level_acceleration_structure::rebuild(
     cb.buildAccelerationStructuresKHR({tlas_info}, {&build_offset_info});
 }
 
+void top_level_acceleration_structure::count_update()
+{
+    updates_since_rebuild++;
+}
+
 size_t top_level_acceleration_structure::get_updates_since_rebuild() const
 {
     return updates_since_rebuild;
@@ -425,4 +576,61 @@ vk::DeviceAddress top_level_acceleration_structure::get_tlas_address(device_id i
     return buffers[id].tlas_address;
 }
 
+scratch_arena::scratch_arena(device_mask dev)
+: buffers(dev)
+{
+}
+
+void scratch_arena::clear()
+{
+    for(auto[dev, bd]: buffers)
+        bd.size = 0;
+}
+
+vk::DeviceSize scratch_arena::reserve(device_id id, vk::DeviceSize size)
+{
+    buffer_data& bd = buffers[id];
+    vk::DeviceSize alignment = buffers.get_device(id).as_props.minAccelerationStructureScratchOffsetAlignment;
+    vk::DeviceSize offset = (bd.size + alignment - 1) / alignment * alignment;
+    bd.size = offset + size;
+    return offset;
+}
+
+bool scratch_arena::commit()
+{
+    bool reallocated = false;
+    for(auto[dev, bd]: buffers)
+    {
+        if(bd.size <= bd.capacity)
+            continue;
+
+        vk::BufferCreateInfo scratch_info(
+            {}, bd.size,
+            vk::BufferUsageFlagBits::eStorageBuffer|
+            vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::SharingMode::eExclusive
+        );
+        // Earlier frames may still be using the old buffer, so its
+        // destruction is deferred like usual.
+        bd.buffer = create_buffer_aligned(
+            dev, scratch_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+            dev.as_props.minAccelerationStructureScratchOffsetAlignment
+        );
+        bd.address = bd.buffer.get_address();
+        bd.capacity = bd.size;
+        reallocated = true;
+    }
+    return reallocated;
+}
+
+vk::DeviceAddress scratch_arena::get_address(device_id id) const
+{
+    return buffers[id].address;
+}
+
+vk::DeviceSize scratch_arena::get_size(device_id id) const
+{
+    return buffers[id].capacity;
+}
+
 }
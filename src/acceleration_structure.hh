@@ -9,6 +9,38 @@ namespace tr
 {
 
 class mesh;
+
+// Scratch memory for acceleration structure builds, shared by all structures
+// of a device. Builds recorded into the same command buffer may run
+// concurrently, so every structure that is rebuilt during rendering reserves
+// its own range. Static structures don't need one.
+class scratch_arena
+{
+public:
+    scratch_arena(device_mask dev);
+
+    // Forgets all reservations.
+    void clear();
+    // Returns the offset of the reserved range.
+    vk::DeviceSize reserve(device_id id, vk::DeviceSize size);
+    // Grows the buffers to fit all reservations. Returns true if any were
+    // reallocated, which invalidates previously recorded builds.
+    bool commit();
+
+    vk::DeviceAddress get_address(device_id id) const;
+    vk::DeviceSize get_size(device_id id) const;
+
+private:
+    struct buffer_data
+    {
+        vkm<vk::Buffer> buffer;
+        vk::DeviceAddress address = 0;
+        vk::DeviceSize capacity = 0;
+        vk::DeviceSize size = 0;
+    };
+    per_device<buffer_data> buffers;
+};
+
 class bottom_level_acceleration_structure
 {
 public:
@@ -24,12 +56,28 @@ public:
         bool opaque = true;
     };
 
+    // If build is false, the structure must be built with build_batch()
+    // before use.
     bottom_level_acceleration_structure(
         device_mask dev,
         const std::vector<entry>& entries,
         bool backface_culled,
         bool dynamic,
-        bool compact
+        bool compact,
+        bool build = true
+    );
+
+    struct batch_entry
+    {
+        bottom_level_acceleration_structure* as;
+        const std::vector<entry>* entries;
+    };
+    // Builds all given structures with one submission per device, sharing
+    // one temporary scratch buffer. Compaction is then done in a second
+    // batched pass, with a single query pool for all compacted sizes.
+    static void build_batch(
+        device_mask dev,
+        const std::vector<batch_entry>& batch
     );
 
     void update_transforms(
@@ -37,6 +85,10 @@ public:
         const std::vector<entry>& entries
     );
 
+    // Reserves scratch memory for rebuild(). The arena must be committed
+    // before recording rebuilds.
+    void set_scratch(scratch_arena& arena);
+
     void rebuild(
         device_id id,
         size_t frame_index,
@@ -44,19 +96,45 @@ public:
         const std::vector<entry>& entries,
         bool update = true
     );
+    // Recorded refits run every frame without calling rebuild(), so the
+    // owner counts them with this.
+    void count_update();
     size_t get_updates_since_rebuild() const;
     vk::AccelerationStructureKHR get_blas_handle(device_id id) const;
     vk::DeviceAddress get_blas_address(device_id id) const;
 
     size_t get_geometry_count() const;
     bool is_backface_culled() const;
+    bool is_dynamic() const;
 
 private:
+    // Upper limit for the shared scratch buffer of build_batch(). Builds
+    // that don't fit are split into waves that reuse the same memory.
+    static constexpr vk::DeviceSize BATCH_SCRATCH_BUDGET = 256 * 1024 * 1024;
+
+    struct build_info
+    {
+        std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+        std::vector<uint32_t> primitive_count;
+        // The geometry pointer must be refreshed with setGeometries() if
+        // this struct has been copied.
+        vk::AccelerationStructureBuildGeometryInfoKHR info;
+    };
+    void init_build_info(
+        device_id id,
+        const std::vector<entry>& entries,
+        bool update,
+        build_info& info
+    );
+    void create_blas(device_id id, vk::DeviceSize size);
+
     size_t updates_since_rebuild;
     size_t geometry_count;
     bool backface_culled;
     bool dynamic;
     bool compact;
+    scratch_arena* scratch;
 
     gpu_buffer transform_buffer;
 
@@ -65,8 +143,8 @@ private:
         vkm<vk::AccelerationStructureKHR> blas;
         vkm<vk::Buffer> blas_buffer;
         vk::DeviceAddress blas_address;
-        vkm<vk::Buffer> scratch_buffer;
-        vk::DeviceAddress scratch_address;
+        vk::DeviceSize scratch_size = 0;
+        vk::DeviceSize scratch_offset = 0;
     };
     per_device<buffer_data> buffers;
 };
@@ -80,12 +158,17 @@ public:
     );
 
     gpu_buffer& get_instances_buffer();
+    // Reserves scratch memory for rebuild(). The arena must be committed
+    // before recording rebuilds.
+    void set_scratch(scratch_arena& arena);
     void rebuild(
         device_id id,
         vk::CommandBuffer cb,
         size_t instance_count,
         bool update
     );
+    // Same as for bottom-level structures.
+    void count_update();
     size_t get_updates_since_rebuild() const;
     const vk::AccelerationStructureKHR* get_tlas_handle(device_id id) const;
     vk::DeviceAddress get_tlas_address(device_id id) const;
@@ -95,6 +178,7 @@ private:
     size_t instance_count;
     size_t instance_capacity;
     bool require_rebuild;
+    scratch_arena* scratch;
 
     gpu_buffer instance_buffer;
 
@@ -102,8 +186,9 @@ private:
     {
         vkm<vk::AccelerationStructureKHR> tlas;
         vkm<vk::Buffer> tlas_buffer;
-        vkm<vk::Buffer> scratch_buffer;
         vk::DeviceAddress tlas_address;
+        vk::DeviceSize scratch_size = 0;
+        vk::DeviceSize scratch_offset = 0;
     };
     per_device<buffer_data> buffers;
 };
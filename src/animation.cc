@@ -4,8 +4,7 @@ namespace tr
 {
 
 animation::animation()
-:   loop_time(0), position_interpolation(LINEAR),
-    scaling_interpolation(LINEAR), orientation_interpolation(LINEAR)
+:   loop_time(0)
 {
 }
 
@@ -13,8 +12,7 @@ void animation::set_position(
     interpolation position_interpolation,
     std::vector<sample<vec3>>&& position
 ){
-    this->position_interpolation = position_interpolation;
-    this->position = std::move(position);
+    this->position.set(position_interpolation, std::move(position));
     determine_loop_time();
 }
 
@@ -22,8 +20,7 @@ void animation::set_scaling(
     interpolation scaling_interpolation,
     std::vector<sample<vec3>>&& scaling
 ){
-    this->scaling_interpolation = scaling_interpolation;
-    this->scaling = std::move(scaling);
+    this->scaling.set(scaling_interpolation, std::move(scaling));
     determine_loop_time();
 }
 
@@ -31,21 +28,26 @@ void animation::set_orientation(
     interpolation orientation_interpolation,
     std::vector<sample<quat>>&& orientation
 ){
-    this->orientation_interpolation = orientation_interpolation;
-    this->orientation = std::move(orientation);
+    this->orientation.set(orientation_interpolation, std::move(orientation));
     determine_loop_time();
 }
 
 void animation::apply(transformable& node, time_ticks time) const
 {
-    if(position.size())
-        node.set_position(interpolate(time, position, position_interpolation));
-    if(scaling.size())
-        node.set_scaling(interpolate(time, scaling, scaling_interpolation));
-    if(orientation.size())
+    cursor c;
+    apply(node, time, c);
+}
+
+void animation::apply(transformable& node, time_ticks time, cursor& c) const
+{
+    if(position.timestamps.size())
+        node.set_position(position.interpolate(time, c.position));
+    if(scaling.timestamps.size())
+        node.set_scaling(scaling.interpolate(time, c.scaling));
+    if(orientation.timestamps.size())
     {
-        quat o = interpolate(time, orientation, orientation_interpolation);
-        if(orientation_interpolation == CUBICSPLINE)
+        quat o = orientation.interpolate(time, c.orientation);
+        if(orientation.interp == CUBICSPLINE)
             o = normalize(o);
         node.set_orientation(o);
     }
@@ -59,12 +61,12 @@ time_ticks animation::get_loop_time() const
 void animation::determine_loop_time()
 {
     loop_time = 0;
-    if(position.size())
-        loop_time = std::max(position.back().timestamp, loop_time);
-    if(scaling.size())
-        loop_time = std::max(scaling.back().timestamp, loop_time);
-    if(orientation.size())
-        loop_time = std::max(orientation.back().timestamp, loop_time);
+    if(position.timestamps.size())
+        loop_time = std::max(position.timestamps.back(), loop_time);
+    if(scaling.timestamps.size())
+        loop_time = std::max(scaling.timestamps.back(), loop_time);
+    if(orientation.timestamps.size())
+        loop_time = std::max(orientation.timestamps.back(), loop_time);
 }
 
 animated::animated(const animation_pool* pool)
@@ -90,6 +92,7 @@ time_ticks animated::set_animation(
     const std::string& name,
     bool use_fallback
 ){
+    cursor = animation::cursor();
     if(pool)
     {
         auto it = pool->find(name);
@@ -110,7 +113,7 @@ time_ticks animated::set_animation(
 
 void animated::apply_animation(transformable& self, time_ticks time)
 {
-    if(cur_anim) cur_anim->apply(self, time);
+    if(cur_anim) cur_anim->apply(self, time, cursor);
 }
 
 }
@@ -45,26 +45,44 @@ public:
         std::vector<sample<quat>>&& orientation
     );
 
+    // Remembers where the previous lookup landed in each channel. With
+    // monotonic playback, the next sample is then found in constant time.
+    struct cursor
+    {
+        uint32_t position = 0;
+        uint32_t scaling = 0;
+        uint32_t orientation = 0;
+    };
+
     void apply(transformable& node, time_ticks time) const;
+    void apply(transformable& node, time_ticks time, cursor& c) const;
     time_ticks get_loop_time() const;
 
 private:
     void determine_loop_time();
 
+    // Samples are stored as separate arrays, so that searching only touches
+    // the timestamps.
     template<typename T>
-    T interpolate(
-        time_ticks time,
-        const std::vector<sample<T>>& data,
-        interpolation interp
-    ) const;
+    struct channel
+    {
+        interpolation interp = LINEAR;
+        std::vector<time_ticks> timestamps;
+        std::vector<T> data;
+        // These are only filled if the interpolation is CUBICSPLINE.
+        std::vector<T> in_tangents;
+        std::vector<T> out_tangents;
+
+        void set(interpolation interp, std::vector<sample<T>>&& samples);
+        // Returns the index of the first sample after the given time.
+        size_t find(time_ticks time, uint32_t& cursor) const;
+        T interpolate(time_ticks time, uint32_t& cursor) const;
+    };
 
     time_ticks loop_time;
-    interpolation position_interpolation;
-    std::vector<sample<vec3>> position;
-    interpolation scaling_interpolation;
-    std::vector<sample<vec3>> scaling;
-    interpolation orientation_interpolation;
-    std::vector<sample<quat>> orientation;
+    channel<vec3> position;
+    channel<vec3> scaling;
+    channel<quat> orientation;
 };
 
 // std::map used for alphabetical order.
@@ -133,6 +151,7 @@ protected:
 private:
     const animation_pool* pool;
     const animation* cur_anim;
+    animation::cursor cursor;
 };
 
 }
@@ -36,38 +36,91 @@ struct numeric_mixer<glm::qua<T, Q>>
 };
 
 template<typename T>
-T animation::interpolate(
-    time_ticks time,
-    const std::vector<sample<T>>& data,
-    interpolation interp
-) const
-{
-    auto it = std::upper_bound(
-        data.begin(), data.end(), time,
-        [](time_ticks time, const sample<T>& s){ return time < s.timestamp; }
-    );
-    if(it == data.end()) return data.back().data;
-    if(it == data.begin()) return data.front().data;
-
-    auto prev = it-1;
-    float frame_ticks = it->timestamp-prev->timestamp;
-    float ratio = (time-prev->timestamp)/frame_ticks;
+void animation::channel<T>::set(
+    interpolation interp,
+    std::vector<sample<T>>&& samples
+){
+    this->interp = interp;
+    timestamps.resize(samples.size());
+    data.resize(samples.size());
+    in_tangents.clear();
+    out_tangents.clear();
+    if(interp == CUBICSPLINE)
+    {
+        in_tangents.resize(samples.size());
+        out_tangents.resize(samples.size());
+    }
+    for(size_t i = 0; i < samples.size(); ++i)
+    {
+        timestamps[i] = samples[i].timestamp;
+        data[i] = samples[i].data;
+        if(interp == CUBICSPLINE)
+        {
+            in_tangents[i] = samples[i].in_tangent;
+            out_tangents[i] = samples[i].out_tangent;
+        }
+    }
+    samples.clear();
+}
+
+template<typename T>
+size_t animation::channel<T>::find(time_ticks time, uint32_t& cursor) const
+{
+    // Playback is nearly always forward, so the next sample is first looked
+    // for right after the previous one. Larger jumps fall back to a binary
+    // search.
+    constexpr size_t MAX_CURSOR_STEPS = 4;
+    size_t count = timestamps.size();
+    size_t i = std::min((size_t)cursor, count);
+    if(i == 0 || timestamps[i-1] <= time)
+    {
+        for(size_t steps = 0; i < count && timestamps[i] <= time; ++steps, ++i)
+        {
+            if(steps == MAX_CURSOR_STEPS)
+            {
+                i = std::upper_bound(
+                    timestamps.begin() + i, timestamps.end(), time
+                ) - timestamps.begin();
+                break;
+            }
+        }
+    }
+    else
+    {
+        i = std::upper_bound(
+            timestamps.begin(), timestamps.begin() + i, time
+        ) - timestamps.begin();
+    }
+    cursor = i;
+    return i;
+}
+
+template<typename T>
+T animation::channel<T>::interpolate(time_ticks time, uint32_t& cursor) const
+{
+    size_t i = find(time, cursor);
+    if(i == timestamps.size()) return data.back();
+    if(i == 0) return data.front();
+
+    size_t prev = i-1;
+    float frame_ticks = timestamps[i]-timestamps[prev];
+    float ratio = (time-timestamps[prev])/frame_ticks;
     switch(interp)
     {
     default:
     case LINEAR:
-        return numeric_mixer<T>()(prev->data, it->data, ratio);
+        return numeric_mixer<T>()(data[prev], data[i], ratio);
     case STEP:
-        return prev->data;
+        return data[prev];
     case CUBICSPLINE:
         {
             // Scale factor has to use seconds unfortunately.
             float scale = frame_ticks * 0.000001f;
             return cubic_spline(
-                prev->data,
-                prev->out_tangent*scale,
-                it->data,
-                it->in_tangent*scale,
+                data[prev],
+                out_tangents[prev]*scale,
+                data[i],
+                in_tangents[i]*scale,
                 ratio
             );
         }
@@ -1,6 +1,7 @@
 #include "assimp.hh"
 #include "log.hh"
 #include "model.hh"
+#include "upload_batch.hh"
 #include "stb_image.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -339,6 +340,9 @@ scene_assets load_assimp(device_mask dev, scene& s, const std::string& path)
     fs::path base_path = fs::path(path).parent_path();
 
     scene_assets md;
+    // All GPU uploads of the scene get submitted together, and are finished
+    // when returning.
+    upload_batch batch(dev);
 
     Assimp::Importer importer;
     const aiScene* ai_scene = importer.ReadFile(
@@ -365,14 +369,6 @@ scene_assets load_assimp(device_mask dev, scene& s, const std::string& path)
         model m;
         mesh* out_mesh = new mesh(dev);
 
-        out_mesh->get_vertices() = read_vertices(ai_mesh);
-        out_mesh->get_indices() = read_indices(ai_mesh);
-
-        if(!ai_mesh->HasNormals())
-            out_mesh->calculate_normals();
-        if(!ai_mesh->HasTangentsAndBitangents())
-            out_mesh->calculate_tangents();
-
         md.meshes.emplace_back(out_mesh);
 
         material mat = create_material(
@@ -392,6 +388,23 @@ scene_assets load_assimp(device_mask dev, scene& s, const std::string& path)
         s.attach(id, std::move(m));
     }
 
+    // Vertex data is read in parallel, as generating normals and tangents can
+    // take a while. md.meshes has the meshes in the same order as ai_scene.
+    dev.get_context()->get_thread_pool().parallel_for(
+        md.meshes.size(),
+        [&](size_t i){
+            aiMesh* ai_mesh = ai_scene->mMeshes[i];
+            mesh* out_mesh = md.meshes[i].get();
+            out_mesh->get_vertices() = read_vertices(ai_mesh);
+            out_mesh->get_indices() = read_indices(ai_mesh);
+
+            if(!ai_mesh->HasNormals())
+                out_mesh->calculate_normals();
+            if(!ai_mesh->HasTangentsAndBitangents())
+                out_mesh->calculate_tangents();
+        }
+    );
+
     for(auto& m: md.meshes)
         m->refresh_buffers();
 
@@ -120,7 +120,7 @@ void bmfr_stage::init_resources()
     weighted_sum[1] = rt_textures[9]->get_array_render_target(dev->id);
 
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         uvec2 wg = (current_features.get_size()+(BLOCK_SIZE - 1))/BLOCK_SIZE + 1u; // + 1 for margins
 
@@ -239,7 +239,7 @@ void bmfr_stage::init_resources()
 void bmfr_stage::record_command_buffers()
 {
     clear_commands();
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
 
@@ -4,6 +4,10 @@
 #include "log.hh"
 #include "radix_sort/radix_sort_vk.h"
 #include <iostream>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
 
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
@@ -59,6 +63,48 @@ bool has_extensions(
     return true;
 }
 
+// The driver UUID changes with driver updates, which makes old caches
+// useless, so it's part of the name.
+std::string get_pipeline_cache_path(
+    const std::string& dir,
+    const vk::PhysicalDeviceProperties& props,
+    const vk::PhysicalDeviceIDProperties& id_props
+){
+    static const char digits[] = "0123456789abcdef";
+    std::string uuid;
+    for(uint8_t byte: id_props.driverUUID)
+    {
+        uuid += digits[byte >> 4];
+        uuid += digits[byte & 0xF];
+    }
+    char ids[32];
+    snprintf(ids, sizeof(ids), "%04x_%04x_", props.vendorID, props.deviceID);
+    return (std::filesystem::path(dir) / (
+        std::string("pipeline_cache_") + ids + uuid + ".bin"
+    )).string();
+}
+
+// Drivers are supposed to reject foreign caches by themselves, but not all
+// of them do it gracefully.
+bool is_pipeline_cache_compatible(
+    const std::vector<uint8_t>& data,
+    const vk::PhysicalDeviceProperties& props
+){
+    VkPipelineCacheHeaderVersionOne header;
+    if(data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) &&
+        header.headerSize <= data.size() &&
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == props.vendorID &&
+        header.deviceID == props.deviceID &&
+        memcmp(
+            header.pipelineCacheUUID, props.pipelineCacheUUID.data(),
+            VK_UUID_SIZE
+        ) == 0;
+}
+
 }
 
 namespace tr
@@ -67,8 +113,18 @@ namespace tr
 context::context(const options& opt)
 :   image_array_layers(0), opt(opt), frame_counter(0),
     displayed_frame_counter(0), swapchain_index(0), frame_index(0),
-    is_displaying(true), timing(this), tracker(this)
-{}
+    is_displaying(true), timing(this), tracker(this),
+    workers(opt.worker_threads)
+{
+    workers.set_trace_hook([this](
+        const char* name,
+        int worker_index,
+        std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end
+    ){
+        timing.host_task(name, worker_index, begin, end);
+    });
+}
 
 context::~context() {}
 
@@ -149,7 +205,7 @@ bool context::is_ray_tracing_supported() const
 
 dependency context::begin_frame()
 {
-    frame_index = frame_counter % MAX_FRAMES_IN_FLIGHT;
+    frame_index = frame_counter % get_frames_in_flight();
     frame_counter++;
 
     timing.host_wait();
@@ -185,7 +241,7 @@ dependency context::begin_frame()
 
     call_frame_end_actions(frame_index);
 
-    if(frame_counter > MAX_FRAMES_IN_FLIGHT)
+    if(frame_counter > get_frames_in_flight())
         timing.device_finish_frame();
     timing.begin_frame();
 
@@ -194,6 +250,11 @@ dependency context::begin_frame()
 
 void context::end_frame(const dependencies& deps)
 {
+    std::vector<std::function<void()>> submit_actions;
+    submit_actions.swap(frame_submit_actions);
+    for(std::function<void()>& func: submit_actions)
+        func();
+
     dependencies local_deps = fill_end_frame_dependencies(deps);
 
     device& d = get_display_device();
@@ -219,6 +280,14 @@ void context::get_indices(uint32_t& swapchain_index, uint32_t& frame_index) cons
     frame_index = this->frame_index;
 }
 
+uint32_t context::get_frames_in_flight() const
+{
+    uint32_t count = std::clamp(opt.frames_in_flight, 1u, (unsigned)MAX_FRAMES_IN_FLIGHT);
+    if(images.size() != 0)
+        count = std::min(count, (uint32_t)images.size());
+    return count;
+}
+
 uint32_t context::get_frame_counter() const
 {
     return frame_counter;
@@ -250,11 +319,26 @@ progress_tracker& context::get_progress_tracker()
     return tracker;
 }
 
+thread_pool& context::get_thread_pool()
+{
+    return workers;
+}
+
 void context::queue_frame_finish_callback(std::function<void()>&& func)
 {
     frame_end_actions[frame_index].emplace_back(std::move(func));
 }
 
+void context::queue_frame_submit_callback(std::function<void()>&& func)
+{
+    frame_submit_actions.emplace_back(std::move(func));
+}
+
+void context::cancel_frame_submit_callbacks()
+{
+    frame_submit_actions.clear();
+}
+
 vk::Instance context::create_instance(
     const vk::InstanceCreateInfo& info,
     PFN_vkGetInstanceProcAddr
@@ -368,6 +452,14 @@ void context::init_devices()
     std::vector<vk::PhysicalDevice> physical_devices =
         instance.enumeratePhysicalDevices();
 
+    if(opt.pipeline_cache_dir.size() != 0)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(opt.pipeline_cache_dir, ec);
+        if(ec)
+            TR_WARN("Unable to create pipeline cache directory ", opt.pipeline_cache_dir);
+    }
+
     std::vector<const char*> required_device_extensions = {
         VK_KHR_MAINTENANCE1_EXTENSION_NAME,
         VK_KHR_MULTIVIEW_EXTENSION_NAME,
@@ -560,7 +652,8 @@ void context::init_devices()
                 vk::PhysicalDeviceRayTracingPipelinePropertiesKHR,
                 vk::PhysicalDeviceAccelerationStructurePropertiesKHR,
                 vk::PhysicalDeviceExternalMemoryHostPropertiesEXT,
-                vk::PhysicalDeviceMultiviewProperties
+                vk::PhysicalDeviceMultiviewProperties,
+                vk::PhysicalDeviceIDProperties
             >();
 
             dev_data.id = devices.size();
@@ -637,7 +730,27 @@ void context::init_devices()
             dev_data.transfer_pool = dev_data.logical.createCommandPool(
                 {{}, dev_data.transfer_family_index}
             );
+
+            std::vector<uint8_t> pp_cache_data;
+            if(opt.pipeline_cache_dir.size() != 0)
+            {
+                dev_data.pp_cache_path = get_pipeline_cache_path(
+                    opt.pipeline_cache_dir, props,
+                    props2.get<vk::PhysicalDeviceIDProperties>()
+                );
+                if(
+                    try_load_binary_file(dev_data.pp_cache_path, pp_cache_data) &&
+                    !is_pipeline_cache_compatible(pp_cache_data, props)
+                ){
+                    TR_WARN(
+                        "Ignoring incompatible pipeline cache ",
+                        dev_data.pp_cache_path
+                    );
+                    pp_cache_data.clear();
+                }
+            }
             dev_data.pp_cache = dev_data.logical.createPipelineCache({
+                {}, pp_cache_data.size(), pp_cache_data.data()
             });
 
             VmaAllocatorCreateInfo allocator_info = {};
@@ -660,6 +773,13 @@ void context::deinit_devices()
     sync();
     for(device& dev_data: devices)
     {
+        if(dev_data.pp_cache_path.size() != 0)
+        {
+            std::vector<uint8_t> data =
+                dev_data.logical.getPipelineCacheData(dev_data.pp_cache);
+            if(!write_binary_file(dev_data.pp_cache_path, data.data(), data.size()))
+                TR_WARN("Failed to save pipeline cache ", dev_data.pp_cache_path);
+        }
         dev_data.logical.destroyPipelineCache(dev_data.pp_cache);
         dev_data.logical.destroyCommandPool(dev_data.graphics_pool);
         dev_data.logical.destroyCommandPool(dev_data.compute_pool);
@@ -7,6 +7,7 @@
 #include "render_target.hh"
 #include "tracing.hh"
 #include "progress_tracker.hh"
+#include "thread_pool.hh"
 #include "device.hh"
 #include <set>
 #include <map>
@@ -19,11 +20,12 @@ namespace tr
 
 struct placeholders;
 
-// This should typically be _lower_ than the number of images in the display
-// targets! In any case, there really cannot be more frames than the number
-// of swap chain images going on at the same time, since their image views
-// would clash.
-static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+// Upper limit for context::options::frames_in_flight, per-frame resources are
+// sized by this. The actual count should typically be _lower_ than the number
+// of images in the display targets! In any case, there really cannot be more
+// frames than the number of swap chain images going on at the same time,
+// since their image views would clash.
+static constexpr int MAX_FRAMES_IN_FLIGHT = 4;
 
 class context
 {
@@ -40,6 +42,15 @@ public:
         unsigned max_timestamps = 0;
         bool enable_vulkan_validation = false;
         unsigned fake_device_multiplier = 0;
+        // If not empty, pipeline caches are loaded from this directory at
+        // startup and saved back at exit.
+        std::string pipeline_cache_dir = "";
+        // Zero means one worker per hardware thread.
+        unsigned worker_threads = 0;
+        // Number of frames the CPU may prepare before waiting for the GPU.
+        // Higher values improve throughput at the cost of latency. Clamped
+        // to [1, MAX_FRAMES_IN_FLIGHT] and the swap chain image count.
+        unsigned frames_in_flight = 2;
     };
 
     context(const options& opt);
@@ -75,6 +86,8 @@ public:
     dependency begin_frame();
     void end_frame(const dependencies& deps);
     void get_indices(uint32_t& swapchain_index, uint32_t& frame_index) const;
+    // frame_index is always below this.
+    uint32_t get_frames_in_flight() const;
     uint32_t get_frame_counter() const;
     // Ignore this unless you know what you are doing. Rendering algorithms
     // should only use the above function.
@@ -86,10 +99,21 @@ public:
 
     tracing_record& get_timing();
     progress_tracker& get_progress_tracker();
+    // Shared worker threads for CPU-side work, such as asset loading and
+    // per-frame updates. Named tasks show up in host timing traces.
+    thread_pool& get_thread_pool();
 
     // You can add functions to be called when the current frame is guaranteed
     // to be finished on the GPU side.
     void queue_frame_finish_callback(std::function<void()>&& func);
+    // Functions queued here are called once at the start of end_frame(),
+    // right before the current frame is submitted. By then, all stages have
+    // finished their CPU-side work for the frame.
+    void queue_frame_submit_callback(std::function<void()>&& func);
+    // Drops the queued submit callbacks without calling them. This must be
+    // called when a frame is aborted before end_frame(), as the callbacks
+    // would otherwise run at the end of some later frame.
+    void cancel_frame_submit_callbacks();
 
     vk::Instance get_vulkan_instance() const;
 
@@ -166,9 +190,11 @@ private:
 
     tracing_record timing;
     progress_tracker tracker;
+    thread_pool workers;
 
     // Callbacks for the end of each frame.
     std::vector<std::function<void()>> frame_end_actions[MAX_FRAMES_IN_FLIGHT];
+    std::vector<std::function<void()>> frame_submit_actions;
 };
 
 }
@@ -9,6 +9,7 @@ namespace tr
 {
 
 class context;
+class upload_batch;
 using device_id = unsigned;
 struct device
 {
@@ -44,7 +45,12 @@ struct device
     vk::CommandPool present_pool;
     vk::CommandPool transfer_pool;
     vk::PipelineCache pp_cache;
+    // Where pp_cache is saved at exit, empty if it isn't.
+    std::string pp_cache_path;
     VmaAllocator allocator;
+    // If set, resource creation records uploads into this batch instead of
+    // waiting for each one separately.
+    upload_batch* active_uploads = nullptr;
 };
 
 class device_mask
@@ -10,11 +10,16 @@ using namespace tr;
 namespace direct
 {
     rt_shader_sources load_sources(
+        device& dev,
         direct_stage::options opt,
         const gbuffer_target& gbuf
     ){
-        shader_source pl_rint("shader/path_tracer_point_light.rint");
-        shader_source shadow_chit("shader/path_tracer_shadow.rchit");
+        shader_source pl_rint = shader_source::deferred(
+            "shader/path_tracer_point_light.rint"
+        );
+        shader_source shadow_chit = shader_source::deferred(
+            "shader/path_tracer_shadow.rchit"
+        );
         std::map<std::string, std::string> defines;
         defines["MAX_BOUNCES"] = std::to_string(opt.max_ray_depth);
         defines["SAMPLES_PER_PASS"] = std::to_string(opt.samples_per_pass);
@@ -35,22 +40,22 @@ namespace direct
 
         rt_camera_stage::get_common_defines(defines, opt);
 
-        return {
-            {"shader/direct.rgen", defines},
+        rt_shader_sources src = {
+            shader_source::deferred("shader/direct.rgen", defines),
             {
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                    {"shader/path_tracer.rchit", defines},
-                    {"shader/path_tracer.rahit", defines}
+                    shader_source::deferred("shader/path_tracer.rchit", defines),
+                    shader_source::deferred("shader/path_tracer.rahit", defines)
                 },
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
                     shadow_chit,
-                    {"shader/path_tracer_shadow.rahit", defines}
+                    shader_source::deferred("shader/path_tracer_shadow.rahit", defines)
                 },
                 {
                     vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup,
-                    {"shader/path_tracer_point_light.rchit", defines},
+                    shader_source::deferred("shader/path_tracer_point_light.rchit", defines),
                     {},
                     pl_rint
                 },
@@ -62,10 +67,12 @@ namespace direct
                 }
             },
             {
-                {"shader/path_tracer.rmiss", defines},
-                {"shader/path_tracer_shadow.rmiss", defines}
+                shader_source::deferred("shader/path_tracer.rmiss", defines),
+                shader_source::deferred("shader/path_tracer_shadow.rmiss", defines)
             }
         };
+        compile_shaders(src, dev.ctx->get_thread_pool());
+        return src;
     }
 
     struct push_constant_buffer
@@ -100,7 +107,7 @@ direct_stage::direct_stage(
         opt.samples_per_pixel / opt.samples_per_pass
     ),
     gfx(dev, rt_stage::get_common_options(
-        direct::load_sources(opt, output_target), opt
+        direct::load_sources(dev, opt, output_target), opt
     )),
     opt(opt)
 {
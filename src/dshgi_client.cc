@@ -79,7 +79,7 @@ protected:
             }
 
             size_t set_index = 0;
-            for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+            for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
             {
                 // Record command buffer
                 vk::CommandBuffer cb = begin_compute();
@@ -345,12 +345,17 @@ bool dshgi_client::refresh()
         // Hardcoded: if we're behind the remote animation timestamp, jump to it.
         if(local_timestamp < remote_timestamp)
         {
-            update(*cur_scene, remote_timestamp - local_timestamp);
+            update(
+                *cur_scene, remote_timestamp - local_timestamp, false,
+                &ctx->get_thread_pool()
+            );
         }
         // If we're a full second ahead the remote timestamp, time to rewind.
         else if(local_timestamp > remote_timestamp + 1000000)
         {
-            set_animation_time(*cur_scene, local_timestamp);
+            set_animation_time(
+                *cur_scene, local_timestamp, &ctx->get_thread_pool()
+            );
         }
         new_remote_timestamp = false;
     }
@@ -57,7 +57,7 @@ private:
             vmaMapMemory(dev->allocator, d.staging_buffer.get_allocation(), &d.mem);
         });
 
-        for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
         {
             // Record command buffer
             vk::CommandBuffer cb = begin_compute();
@@ -3,6 +3,7 @@
 #include "placeholders.hh"
 #include "misc.hh"
 #include "sampler.hh"
+#include "upload_batch.hh"
 
 namespace tr
 {
@@ -11,7 +12,13 @@ environment_map::environment_map(
     device_mask dev, const std::string& path, projection proj, vec3 factor
 ): texture(dev, path), factor(factor), proj(proj)
 {
-    generate_alias_table();
+    // The image must be uploaded before the alias table can be built from it.
+    // Within a batch, the environment map must not be moved before the batch
+    // finishes; scene components never are.
+    device& first = *dev.begin();
+    if(first.active_uploads)
+        first.active_uploads->defer([this](){ generate_alias_table(); });
+    else generate_alias_table();
 }
 
 void environment_map::set_factor(vec3 factor)
@@ -80,7 +80,7 @@ void envmap_stage::update(uint32_t)
         control.environment_proj = -1;
     }
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         // Record command buffer
         vk::CommandBuffer cb = begin_graphics();
@@ -52,7 +52,7 @@ bool example_denoiser_stage::need_pingpong_swap() const
 
 void example_denoiser_stage::init_resources()
 {
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         comp.update_descriptor_set({
             {"in_color", {{}, input_features.color.view, vk::ImageLayout::eGeneral}},
@@ -69,7 +69,7 @@ void example_denoiser_stage::init_resources()
 
 void example_denoiser_stage::record_command_buffers()
 {
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
 
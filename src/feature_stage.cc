@@ -8,7 +8,7 @@ using namespace tr;
 
 namespace feature
 {
-    rt_shader_sources load_sources(feature_stage::options opt)
+    rt_shader_sources load_sources(device& dev, feature_stage::options opt)
     {
         std::string feature;
         switch(opt.feat)
@@ -49,17 +49,19 @@ namespace feature
         rt_camera_stage::get_common_defines(defines, opt);
         defines["FEATURE"] = feature;
 
-        return {
-            {"shader/rt_feature.rgen", defines},
+        rt_shader_sources src = {
+            shader_source::deferred("shader/rt_feature.rgen", defines),
             {
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                    {"shader/rt_feature.rchit", defines},
-                    {"shader/rt_feature.rahit"}
+                    shader_source::deferred("shader/rt_feature.rchit", defines),
+                    shader_source::deferred("shader/rt_feature.rahit")
                 }
             },
-            {{"shader/rt_feature.rmiss"}}
+            {shader_source::deferred("shader/rt_feature.rmiss")}
         };
+        compile_shaders(src, dev.ctx->get_thread_pool());
+        return src;
     }
 
     struct push_constant_buffer
@@ -82,7 +84,9 @@ feature_stage::feature_stage(
     const gbuffer_target& output_target,
     const options& opt
 ):  rt_camera_stage(dev, ss, output_target, opt),
-    gfx(dev, rt_stage::get_common_options(::feature::load_sources(opt), opt)),
+    gfx(dev, rt_stage::get_common_options(
+        ::feature::load_sources(dev, opt), opt
+    )),
     opt(opt)
 {
 }
@@ -23,7 +23,7 @@ frame_delay_stage::frame_delay_stage(
     textures->add(spec);
     output_features = textures->get_array_target(dev.id);
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev.ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
         delay_timer.begin(cb, dev.id, i);
@@ -149,8 +149,10 @@ void frame_server::init_images()
         vk::SharingMode::eExclusive
     };
 
+    // Queried before clearing, as it is limited by the image count.
+    uint32_t image_count = get_frames_in_flight();
     images.clear();
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < image_count; ++i)
     {
         images.emplace_back(
             sync_create_gpu_image(
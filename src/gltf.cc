@@ -8,13 +8,19 @@
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #include "tiny_gltf.h"
 #include "stb_image.h"
+#include "json.hpp"
 #include <glm/gtc/type_ptr.hpp>
 #include "misc.hh"
+#include "upload_batch.hh"
+#include "texture_compression.hh"
+#include "scene_cache.hh"
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
 #include <algorithm>
 #include <numeric>
 #include <unordered_set>
+#include <optional>
 
 namespace
 {
@@ -30,39 +36,155 @@ T& add_unique_named(scene& s, std::string& name, T&& entry, entity* index = null
     return *s.get<T>(id);
 }
 
-void flip_lines(unsigned pitch, unsigned char* line_a, unsigned char* line_b)
+bool check_opaque(const std::vector<uint8_t>& rgba8)
 {
-    for(unsigned i = 0; i < pitch; ++i)
+    // Check that every fourth (alpha) value is 255.
+    for(size_t i = 3; i < rgba8.size(); i += 4)
+        if(rgba8[i] != 255)
+            return false;
+    return true;
+}
+
+// Stashes the encoded bytes of data URI images so that they can be decoded in
+// parallel once the file has been parsed. Buffer view images are read from
+// the buffers that TinyGLTF already keeps, and URI images are loaded from
+// their path later, so TinyGLTF decoding them here would be wasted work.
+bool defer_image_decode(
+    tinygltf::Image* image,
+    const int,
+    std::string*,
+    std::string*,
+    int,
+    int,
+    const unsigned char* bytes,
+    int size,
+    void*
+){
+    if(image->uri.empty() && image->bufferView < 0)
+        image->image.assign(bytes, bytes + size);
+    return true;
+}
+
+// Images can only be compressed if all materials use them the same way, as
+// the compressed format depends on the usage. Unknown usages are filtered as
+// plain data.
+std::vector<std::optional<texture_usage>> get_image_usages(
+    const tinygltf::Model& model
+){
+    std::vector<std::optional<texture_usage>> usages(model.images.size());
+    std::vector<bool> conflicting(model.images.size(), false);
+    auto add_usage = [&](int texture_index, texture_usage usage){
+        if(texture_index < 0) return;
+        int image_index = model.textures[texture_index].source;
+        if(image_index < 0) return;
+        auto& u = usages[image_index];
+        if(u && *u != usage) conflicting[image_index] = true;
+        u = usage;
+    };
+    for(const tinygltf::Material& mat: model.materials)
     {
-        unsigned char tmp = line_a[i];
-        line_a[i] = line_b[i];
-        line_b[i] = tmp;
+        add_usage(mat.pbrMetallicRoughness.baseColorTexture.index, texture_usage::COLOR);
+        add_usage(mat.emissiveTexture.index, texture_usage::COLOR);
+        add_usage(
+            mat.pbrMetallicRoughness.metallicRoughnessTexture.index,
+            texture_usage::METALLIC_ROUGHNESS
+        );
+        add_usage(mat.normalTexture.index, texture_usage::NORMAL);
     }
+    for(size_t i = 0; i < usages.size(); ++i)
+        if(conflicting[i]) usages[i].reset();
+    return usages;
 }
 
-void flip_vector_image(std::vector<unsigned char>& image, unsigned height)
-{
-    unsigned pitch = image.size() / height;
-    for(unsigned i = 0; i < height/2; ++i)
-        flip_lines(
-            pitch,
-            image.data()+i*pitch,
-            image.data()+(height-1-i)*pitch
-        );
+// Matches TinyGLTF's own loader, which expands all images to four channels.
+texture::decoded_image decode_embedded_image(
+    const tinygltf::Model& model,
+    const tinygltf::Image& image
+){
+    const unsigned char* bytes = image.image.data();
+    int size = image.image.size();
+    if(image.bufferView >= 0)
+    {
+        const tinygltf::BufferView& view = model.bufferViews[image.bufferView];
+        bytes = model.buffers[view.buffer].data.data() + view.byteOffset;
+        size = view.byteLength;
+    }
+
+    // The thread-local flag keeps concurrent decodes from interfering with
+    // each other.
+    stbi_set_flip_vertically_on_load_thread(false);
+
+    int w = 0, h = 0, n = 0;
+    size_t channel_size = 2;
+    void* data = nullptr;
+    if(stbi_is_16_bit_from_memory(bytes, size))
+        data = stbi_load_16_from_memory(bytes, size, &w, &h, &n, 4);
+    if(!data)
+    {
+        channel_size = 1;
+        data = stbi_load_from_memory(bytes, size, &w, &h, &n, 4);
+    }
+    if(!data)
+        throw std::runtime_error("Failed to decode embedded image " + image.name);
+
+    texture::decoded_image res;
+    res.size = uvec2(w, h);
+    res.pixels.assign(
+        (uint8_t*)data, (uint8_t*)data + size_t(w) * h * 4 * channel_size
+    );
+    stbi_image_free(data);
+
+    if(channel_size > 1)
+        res.fmt = vk::Format::eR16G16B16A16Unorm;
+    else
+    {
+        res.fmt = vk::Format::eR8G8B8A8Unorm;
+        res.opaque = check_opaque(res.pixels);
+    }
+    return res;
 }
 
-bool check_opaque(tinygltf::Image& img)
-{
-    if(img.component != 4) return true;
-    if(img.bits == 8)
+void load_textures(
+    device_mask dev,
+    tinygltf::Model& gltf_model,
+    scene_assets& md,
+    bool compress_textures,
+    const std::string& texture_cache_dir,
+    scene_cache_writer* writer
+){
+    // Images are decoded in parallel, but the textures are created in the
+    // original order so that indices into md.textures stay valid.
+    std::vector<texture::decoded_image> decoded(gltf_model.images.size());
+    std::vector<std::optional<texture_usage>> usages =
+        get_image_usages(gltf_model);
+    thread_pool& pool = dev.get_context()->get_thread_pool();
+    pool.parallel_for(
+        decoded.size(),
+        [&](size_t i){
+            tinygltf::Image& image = gltf_model.images[i];
+            if(image.uri.empty())
+            {// Embedded image
+                decoded[i] = decode_embedded_image(gltf_model, image);
+                image.image.clear();
+                image.image.shrink_to_fit();
+            }
+            else
+            {// URI
+                decoded[i] = texture::decode_file(image.uri);
+            }
+
+            prepare_texture(
+                decoded[i], usages[i].value_or(texture_usage::DATA),
+                compress_textures && usages[i], texture_cache_dir, pool
+            );
+        }
+    );
+
+    for(texture::decoded_image& img: decoded)
     {
-        // Check that every fourth (alpha) value is 255.
-        for(size_t i = 3; i < img.image.size(); i += 4)
-            if(img.image[i] != 255)
-                return false;
-        return true;
+        if(writer) writer->add_texture(img);
+        md.textures.emplace_back(new texture(dev, std::move(img)));
     }
-    return false;
 }
 
 template<typename T>
@@ -196,6 +318,107 @@ texture* get_texture(tinygltf::Model& model, scene_assets& md, int index)
     return md.textures[model.textures[index].source].get();
 }
 
+// Accessors that are read outside of mesh primitives. Their data is stored in
+// the scene cache in this order, so that the binary chunk isn't needed on a
+// cache hit.
+std::vector<int> get_cached_accessors(const tinygltf::Model& model)
+{
+    std::vector<int> accessors;
+    for(const tinygltf::Animation& anim: model.animations)
+    {
+        for(const tinygltf::AnimationSampler& sampler: anim.samplers)
+        {
+            accessors.push_back(sampler.input);
+            accessors.push_back(sampler.output);
+        }
+    }
+    for(const tinygltf::Skin& tg_skin: model.skins)
+        if(tg_skin.inverseBindMatrices >= 0)
+            accessors.push_back(tg_skin.inverseBindMatrices);
+    return accessors;
+}
+
+// Number of bytes that read_accessor() reads, starting from the first element.
+size_t get_accessor_size(const tinygltf::Model& model, int index)
+{
+    const tinygltf::Accessor& accessor = model.accessors[index];
+    if(accessor.count == 0)
+        return 0;
+    const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+    size_t element_size =
+        tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+        tinygltf::GetNumComponentsInType(accessor.type);
+    return (accessor.count - 1) * accessor.ByteStride(view) + element_size;
+}
+
+const uint8_t* get_accessor_data(const tinygltf::Model& model, int index)
+{
+    const tinygltf::Accessor& accessor = model.accessors[index];
+    const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+    const tinygltf::Buffer& buf = model.buffers[view.buffer];
+    return buf.data.data() + view.byteOffset + accessor.byteOffset;
+}
+
+// Points the accessor to a new buffer that only holds its own data.
+void replace_accessor_data(
+    tinygltf::Model& model, int index, const uint8_t* data, size_t size
+){
+    tinygltf::Accessor& accessor = model.accessors[index];
+    tinygltf::BufferView view = model.bufferViews[accessor.bufferView];
+    view.buffer = model.buffers.size();
+    view.byteOffset = 0;
+    view.byteLength = size;
+    model.buffers.emplace_back().data.assign(data, data + size);
+    accessor.bufferView = model.bufferViews.size();
+    accessor.byteOffset = 0;
+    model.bufferViews.push_back(view);
+}
+
+// Parses only the JSON chunk of a .glb file, so that neither the binary chunk
+// nor any images are read. Buffers are replaced with one-byte placeholders
+// and images are left out, so only the scene structure can be used.
+void load_gltf_json(
+    const std::string& path,
+    tinygltf::Model& model,
+    size_t& image_count
+){
+    std::ifstream f(path, std::ios::binary);
+    // Magic, version, length, JSON chunk length and JSON chunk type.
+    uint32_t header[5];
+    if(
+        !f.read((char*)header, sizeof(header)) ||
+        header[0] != 0x46546C67 || header[4] != 0x4E4F534A
+    ) throw std::runtime_error("Failed to read glTF header from " + path);
+
+    std::string json_str(header[3], '\0');
+    if(!f.read(json_str.data(), json_str.size()))
+        throw std::runtime_error("Failed to read glTF JSON from " + path);
+
+    nlohmann::json json = nlohmann::json::parse(json_str, nullptr, false);
+    if(json.is_discarded())
+        throw std::runtime_error("Failed to parse glTF JSON from " + path);
+
+    image_count = json.contains("images") ? json["images"].size() : 0;
+    json.erase("images");
+    if(json.contains("buffers"))
+    {
+        for(nlohmann::json& buf: json["buffers"])
+        {
+            buf = {
+                {"byteLength", 1},
+                {"uri", "data:application/octet-stream;base64,AA=="}
+            };
+        }
+    }
+    json_str = json.dump();
+
+    std::string err, warn;
+    tinygltf::TinyGLTF loader;
+    if(!loader.LoadASCIIFromString(
+        &model, &err, &warn, json_str.c_str(), json_str.size(), ""
+    )) throw std::runtime_error(err);
+}
+
 material create_material(
     tinygltf::Material& mat,
     tinygltf::Model& model,
@@ -279,6 +502,76 @@ material create_material(
     return m;
 }
 
+// Reads the vertex data of a primitive and generates missing normals, and
+// tangents if requested. Only reads from the model, so primitives can be
+// loaded in parallel.
+void load_primitive(
+    tinygltf::Model& model,
+    tinygltf::Primitive& p,
+    bool generate_tangents,
+    mesh& m
+){
+    std::vector<vec3> vert_pos;
+    std::vector<vec3> vert_norm;
+    std::vector<vec2> vert_uv;
+    std::vector<vec4> vert_tangent;
+    std::vector<uvec4> vert_joint;
+    std::vector<vec4> vert_weight;
+
+    for(const auto& pair: p.attributes)
+    {
+        if(pair.first == "POSITION")
+            vert_pos = read_accessor<vec3>(model, pair.second);
+        else if(pair.first == "NORMAL")
+            vert_norm = read_accessor<vec3>(model, pair.second);
+        else if(pair.first == "TEXCOORD_0")
+            vert_uv = read_accessor<vec2>(model, pair.second);
+        else if(pair.first == "TANGENT")
+            vert_tangent = read_accessor<vec4>(model, pair.second);
+        else if(pair.first == "JOINTS_0")
+            vert_joint = read_accessor<uvec4>(model, pair.second);
+        else if(pair.first == "WEIGHTS_0")
+            vert_weight = read_accessor<vec4>(model, pair.second);
+    }
+
+    bool generate_normals = vert_norm.size() == 0;
+
+    std::vector<mesh::vertex>& mesh_vert = m.get_vertices();
+    std::vector<mesh::skin_data>& mesh_skin = m.get_skin();
+    std::vector<uint32_t>& mesh_ind = m.get_indices();
+
+    mesh_vert.resize(vert_pos.size());
+    vert_norm.resize(vert_pos.size(), vec3(0));
+    vert_uv.resize(vert_pos.size(), vec2(0));
+    vert_tangent.resize(vert_pos.size(), vec4(0));
+    for(size_t i = 0; i < vert_pos.size(); ++i)
+        mesh_vert[i] = {vert_pos[i], vert_norm[i], vert_uv[i], vert_tangent[i]};
+
+    mesh_skin.resize(vert_joint.size());
+    vert_weight.resize(vert_joint.size());
+    for(size_t i = 0; i < vert_joint.size(); ++i)
+    {
+        // Some broken models have sums that go over 1 for some reason.
+        // Anyway, that's incorrect so we fix it here.
+        float weight_sum =
+            vert_weight[i].x + vert_weight[i].y + vert_weight[i].z +
+            vert_weight[i].w;
+        mesh_skin[i] = {vert_joint[i], vert_weight[i]/weight_sum};
+    }
+
+    mesh_ind = read_accessor<uint32_t>(model, p.indices);
+    if(mesh_ind.size() == 0)
+    { // Missing indices, so we make them. Stupid model.
+        mesh_ind.resize(vert_pos.size());
+        std::iota(mesh_ind.begin(), mesh_ind.end(), 0);
+    }
+
+    if(generate_normals)
+        m.calculate_normals();
+    if(generate_tangents)
+        m.calculate_tangents();
+}
+
 struct skin
 {
     int root;
@@ -512,69 +805,97 @@ scene_assets load_gltf(
     scene& s,
     const std::string& path,
     bool force_single_sided,
-    bool force_double_sided
+    bool force_double_sided,
+    bool compress_textures,
+    const std::string& texture_cache_dir,
+    const std::string& scene_cache_dir
 ){
     TR_LOG("Started loading glTF scene from ", path);
     scene_assets md;
+    // All GPU uploads of the scene get submitted together, and are finished
+    // when returning.
+    upload_batch batch(dev);
+
+    // The scene cache replaces decoding and processing of textures and vertex
+    // data when the file hasn't changed since it was cached. It is checked
+    // before touching the file, so that a hit only needs to read the JSON.
+    std::string scene_cache_path;
+    if(!scene_cache_dir.empty())
+    {
+        scene_cache_path = get_scene_cache_path(
+            scene_cache_dir, path, compress_textures
+        );
+    }
+    scene_cache_reader cache;
+    bool cached = !scene_cache_path.empty() && cache.open(scene_cache_path);
 
-    std::string err, warn;
     tinygltf::Model gltf_model;
-    tinygltf::TinyGLTF loader;
-
-    // TinyGLTF uses stb_image too, and expects this value.
-    stbi_set_flip_vertically_on_load(true);
+    if(cached)
+    {
+        size_t image_count = 0;
+        load_gltf_json(path, gltf_model, image_count);
+
+        size_t primitive_count = 0;
+        for(tinygltf::Mesh& tg_mesh: gltf_model.meshes)
+            primitive_count += tg_mesh.primitives.size();
+        std::vector<int> accessors = get_cached_accessors(gltf_model);
+        bool matches =
+            cache.get_texture_count() == image_count &&
+            cache.get_mesh_count() == primitive_count &&
+            cache.get_data_count() == accessors.size();
+        for(size_t i = 0; matches && i < accessors.size(); ++i)
+        {
+            size_t size = 0;
+            const uint8_t* data = cache.get_data(i, size);
+            if(size != get_accessor_size(gltf_model, accessors[i]))
+                matches = false;
+            else replace_accessor_data(gltf_model, accessors[i], data, size);
+        }
 
-    if(!loader.LoadBinaryFromFile(&gltf_model, &err, &warn, path))
-        throw std::runtime_error(err);
+        if(!matches)
+        {
+            TR_WARN("Ignoring mismatched scene cache ", scene_cache_path);
+            cache.close();
+            cached = false;
+            gltf_model = tinygltf::Model();
+        }
+    }
 
-    for(tinygltf::Image& image: gltf_model.images)
+    std::unique_ptr<scene_cache_writer> writer;
+    if(cached)
     {
-        if(image.bufferView != -1)
-        {// Embedded image
-            vk::Format format;
+        for(size_t i = 0; i < cache.get_texture_count(); ++i)
+            md.textures.emplace_back(cache.create_texture(dev, i));
+    }
+    else
+    {
+        std::string err, warn;
+        tinygltf::TinyGLTF loader;
+        loader.SetImageLoader(defer_image_decode, nullptr);
+        if(!loader.LoadBinaryFromFile(&gltf_model, &err, &warn, path))
+            throw std::runtime_error(err);
 
-            switch(image.component)
+        if(!scene_cache_path.empty())
+        {
+            writer.reset(new scene_cache_writer(scene_cache_path));
+            // Images referenced by URI are decoded into the cache too, so
+            // their changes must invalidate it.
+            for(const tinygltf::Image& image: gltf_model.images)
+                if(!image.uri.empty())
+                    writer->add_dependency(image.uri);
+            for(int accessor: get_cached_accessors(gltf_model))
             {
-            case 1:
-                format = image.bits > 8 ? vk::Format::eR16Unorm : vk::Format::eR8Unorm;
-                break;
-            case 2:
-                format = image.bits > 8 ?
-                    vk::Format::eR16G16Unorm : vk::Format::eR8G8Unorm;
-                break;
-            default:
-            case 3:
-                format = image.bits > 8 ?
-                    vk::Format::eR16G16B16Unorm : vk::Format::eR8G8B8Unorm;
-                break;
-            case 4:
-                format = image.bits > 8 ?
-                    vk::Format::eR16G16B16A16Unorm :
-                    vk::Format::eR8G8B8A8Unorm;
-                break;
+                writer->add_data(
+                    get_accessor_data(gltf_model, accessor),
+                    get_accessor_size(gltf_model, accessor)
+                );
             }
-
-            flip_vector_image(image.image, image.height);
-
-            md.textures.emplace_back(new texture(
-                dev,
-                uvec2(image.width, image.height),
-                1,
-                format,
-                image.image.size(),
-                image.image.data(),
-                vk::ImageTiling::eOptimal,
-                vk::ImageUsageFlagBits::eSampled,
-                vk::ImageLayout::eShaderReadOnlyOptimal
-            ));
-
-            if(check_opaque(image))
-                md.textures.back()->set_opaque(true);
-        }
-        else
-        {// URI
-            md.textures.emplace_back(new texture(dev, image.uri));
         }
+
+        load_textures(
+            dev, gltf_model, md, compress_textures, texture_cache_dir,
+            writer.get()
+        );
     }
 
     // Add animations
@@ -651,6 +972,14 @@ scene_assets load_gltf(
         meta.skins.push_back(s);
     }
 
+    struct pending_primitive
+    {
+        tinygltf::Primitive* p;
+        bool generate_tangents;
+        mesh* m;
+    };
+    std::vector<pending_primitive> primitives;
+    thread_pool& pool = dev.get_context()->get_thread_pool();
     for(tinygltf::Mesh& tg_mesh: gltf_model.meshes)
     {
         model m;
@@ -669,31 +998,9 @@ scene_assets load_gltf(
                     primitive_material.double_sided = true;
             }
 
-            std::vector<vec3> vert_pos;
-            std::vector<vec3> vert_norm;
-            std::vector<vec2> vert_uv;
-            std::vector<vec4> vert_tangent;
-            std::vector<uvec4> vert_joint;
-            std::vector<vec4> vert_weight;
-
-            for(const auto& pair: p.attributes)
-            {
-                if(pair.first == "POSITION")
-                    vert_pos = read_accessor<vec3>(gltf_model, pair.second);
-                else if(pair.first == "NORMAL")
-                    vert_norm = read_accessor<vec3>(gltf_model, pair.second);
-                else if(pair.first == "TEXCOORD_0")
-                    vert_uv = read_accessor<vec2>(gltf_model, pair.second);
-                else if(pair.first == "TANGENT")
-                    vert_tangent = read_accessor<vec4>(gltf_model, pair.second);
-                else if(pair.first == "JOINTS_0")
-                    vert_joint = read_accessor<uvec4>(gltf_model, pair.second);
-                else if(pair.first == "WEIGHTS_0")
-                    vert_weight = read_accessor<vec4>(gltf_model, pair.second);
-            }
-
-            bool generate_tangents = false;
-            if(vert_tangent.size() == 0 && primitive_material.normal_tex.first)
+            bool generate_tangents =
+                !p.attributes.count("TANGENT") && primitive_material.normal_tex.first;
+            if(generate_tangents && !cached)
             {
                 TR_WARN(
                     path, ": ", tg_mesh.name,
@@ -701,47 +1008,10 @@ scene_assets load_gltf(
                     "export the asset with [Geometry > Tangents] ticked in "
                     "Blender."
                 );
-                generate_tangents = true;
             }
 
-            bool generate_normals = vert_norm.size() == 0;
-
             mesh* prim_mesh = new mesh(dev);
-            std::vector<mesh::vertex>& mesh_vert = prim_mesh->get_vertices();
-            std::vector<mesh::skin_data>& mesh_skin = prim_mesh->get_skin();
-            std::vector<uint32_t>& mesh_ind = prim_mesh->get_indices();
-
-            mesh_vert.resize(vert_pos.size());
-            vert_norm.resize(vert_pos.size(), vec3(0));
-            vert_uv.resize(vert_pos.size(), vec2(0));
-            vert_tangent.resize(vert_pos.size(), vec4(0));
-            for(size_t i = 0; i < vert_pos.size(); ++i)
-                mesh_vert[i] = {vert_pos[i], vert_norm[i], vert_uv[i], vert_tangent[i]};
-
-            mesh_skin.resize(vert_joint.size());
-            vert_weight.resize(vert_joint.size());
-            for(size_t i = 0; i < vert_joint.size(); ++i)
-            {
-                // Some broken models have sums that go over 1 for some reason.
-                // Anyway, that's incorrect so we fix it here.
-                float weight_sum =
-                    vert_weight[i].x + vert_weight[i].y + vert_weight[i].z +
-                    vert_weight[i].w;
-                mesh_skin[i] = {vert_joint[i], vert_weight[i]/weight_sum};
-            }
-
-            mesh_ind = read_accessor<uint32_t>(gltf_model, p.indices);
-            if(mesh_ind.size() == 0)
-            { // Missing indices, so we make them. Stupid model.
-                mesh_ind.resize(vert_pos.size());
-                std::iota(mesh_ind.begin(), mesh_ind.end(), 0);
-            }
-
-            if(generate_normals)
-                prim_mesh->calculate_normals();
-            if(generate_tangents)
-                prim_mesh->calculate_tangents();
-
+            primitives.push_back({&p, generate_tangents, prim_mesh});
             md.meshes.emplace_back(prim_mesh);
             m.add_vertex_group(primitive_material, prim_mesh);
         }
@@ -749,6 +1019,23 @@ scene_assets load_gltf(
         meta.models.emplace_back(std::move(m));
     }
 
+    // Vertex data is only filled in here, so that all primitives can be
+    // processed in parallel. md.meshes still only has the primitive meshes,
+    // in the same order. Cached meshes are uploaded from the cache file
+    // directly below.
+    if(!cached)
+    {
+        pool.parallel_for(primitives.size(), [&](size_t i){
+            pending_primitive& pp = primitives[i];
+            load_primitive(gltf_model, *pp.p, pp.generate_tangents, *pp.m);
+        });
+    }
+    if(writer)
+    {
+        for(pending_primitive& pp: primitives)
+            writer->add_mesh(*pp.m);
+    }
+
     // Add objects & cameras
     for(tinygltf::Scene& scene: gltf_model.scenes)
     {
@@ -766,9 +1053,15 @@ scene_assets load_gltf(
         }
     }
 
+    if(writer && writer->finish())
+        TR_LOG("Wrote scene cache ", scene_cache_path);
+
     // Upload buffer data here so that we have had time to fill in joint data
-    for(auto& m: md.meshes)
-        m->refresh_buffers();
+    for(size_t i = 0; i < md.meshes.size(); ++i)
+    {
+        if(cached) cache.load_mesh(i, *md.meshes[i]);
+        else md.meshes[i]->refresh_buffers();
+    }
 
     // Post-processing
     s.foreach([&](entity id, added_by_this_file&, transformable& t, animated* a, model& animation_model){
@@ -11,7 +11,14 @@ scene_assets load_gltf(
     scene& s,
     const std::string& path,
     bool force_single_sided = false,
-    bool force_double_sided = false
+    bool force_double_sided = false,
+    // Block-compresses 8-bit textures, see prepare_texture().
+    bool compress_textures = false,
+    const std::string& texture_cache_dir = "",
+    // Stores processed textures and meshes for faster loading next time, see
+    // scene_cache.hh. Meshes loaded from the cache have no host data unless
+    // they are skinned.
+    const std::string& scene_cache_dir = ""
 );
 
 }
@@ -1,5 +1,6 @@
 #include "gpu_buffer.hh"
 #include "misc.hh"
+#include <algorithm>
 
 namespace tr
 {
@@ -37,8 +38,11 @@ bool gpu_buffer::resize(size_t size)
     for(auto[dev, buf]: buffers)
     {
         buf.buffer = create_buffer(dev, gpu_buffer_info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
-        for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        for(size_t i = 0; i < dev.ctx->get_frames_in_flight(); ++i)
+        {
             buf.staging[i] = create_staging_buffer(dev, this->capacity, nullptr);
+            buf.dirty[i].clear();
+        }
     }
     return true;
 }
@@ -113,6 +117,68 @@ void gpu_buffer::upload(device_id id, uint32_t frame_index, vk::CommandBuffer cb
     }
 }
 
+void gpu_buffer::mark_dirty(device_id id, uint32_t frame_index, size_t offset, size_t bytes)
+{
+    if(offset >= size) return;
+    bytes = std::min(bytes, size - offset);
+    if(bytes == 0) return;
+
+    // Ranges are usually marked in order, so neighbours are merged right
+    // away to keep the list short.
+    std::vector<vk::BufferCopy>& dirty = buffers[id].dirty[frame_index];
+    if(dirty.size() != 0)
+    {
+        vk::BufferCopy& last = dirty.back();
+        if(last.srcOffset <= offset && offset <= last.srcOffset + last.size)
+        {
+            last.size = std::max(last.size, offset + bytes - last.srcOffset);
+            return;
+        }
+    }
+    dirty.push_back({offset, offset, bytes});
+}
+
+bool gpu_buffer::is_dirty(device_id id, uint32_t frame_index) const
+{
+    return buffers[id].dirty[frame_index].size() != 0;
+}
+
+size_t gpu_buffer::upload_dirty(device_id id, uint32_t frame_index, vk::CommandBuffer cb)
+{
+    buffer_data& buf = buffers[id];
+    std::vector<vk::BufferCopy>& dirty = buf.dirty[frame_index];
+    if(dirty.size() == 0) return 0;
+
+    std::sort(
+        dirty.begin(), dirty.end(),
+        [](const vk::BufferCopy& a, const vk::BufferCopy& b){
+            return a.srcOffset < b.srcOffset;
+        }
+    );
+
+    size_t merged = 0;
+    for(size_t i = 1; i < dirty.size(); ++i)
+    {
+        vk::BufferCopy& prev = dirty[merged];
+        if(dirty[i].srcOffset <= prev.srcOffset + prev.size)
+        {
+            prev.size = std::max(
+                prev.size, dirty[i].srcOffset + dirty[i].size - prev.srcOffset
+            );
+        }
+        else dirty[++merged] = dirty[i];
+    }
+    dirty.resize(merged+1);
+
+    size_t bytes = 0;
+    for(const vk::BufferCopy& region: dirty)
+        bytes += region.size;
+
+    cb.copyBuffer(*buf.staging[frame_index], *buf.buffer, dirty);
+    dirty.clear();
+    return bytes;
+}
+
 size_t gpu_buffer::calc_buffer_entry_alignment(device_id id, size_t entry_size) const
 {
     uint32_t min_uniform_offset = buffers.get_device(id).props.limits.minUniformBufferOffsetAlignment;
@@ -38,6 +38,15 @@ public:
     void map_one(device_id id, uint32_t frame_index, F&& f);
     void upload(device_id id, uint32_t frame_index, vk::CommandBuffer cb);
 
+    // Dirty ranges let uploads skip the parts of the staging buffer that
+    // weren't written this frame. The GPU buffer keeps its contents between
+    // frames, so everything must be marked dirty once after resize().
+    void mark_dirty(device_id id, uint32_t frame_index, size_t offset, size_t bytes);
+    bool is_dirty(device_id id, uint32_t frame_index) const;
+    // Copies only the dirty ranges of the frame and forgets them. Returns
+    // the number of bytes copied.
+    size_t upload_dirty(device_id id, uint32_t frame_index, vk::CommandBuffer cb);
+
     size_t calc_buffer_entry_alignment(device_id id, size_t entry_size) const;
 
 private:
@@ -54,6 +63,7 @@ private:
     {
         vkm<vk::Buffer> buffer;
         vkm<vk::Buffer> staging[MAX_FRAMES_IN_FLIGHT];
+        std::vector<vk::BufferCopy> dirty[MAX_FRAMES_IN_FLIGHT];
     };
     per_device<buffer_data> buffers;
 };
@@ -98,7 +98,7 @@ headless::~headless()
 {
     if(!opt.viewer)
     {
-        for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        for(size_t i = 0; i < per_image.size(); ++i)
             headless::save_image(i);
         reap_workers(false);
     }
@@ -204,8 +204,10 @@ void headless::init_images()
         vk::SharingMode::eExclusive
     };
 
+    // Queried before clearing, as it is limited by the image count.
+    uint32_t image_count = get_frames_in_flight();
     images.clear();
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < image_count; ++i)
     {
         images.emplace_back(
             sync_create_gpu_image(
@@ -25,6 +25,8 @@ int main(int, char** argv) try
         tr::log_output_streams[(uint32_t)tr::log_type::TIMING] = &timing_output_file.value();
     }
 
+    tr::shader_source::set_disk_cache(opt.shader_cache);
+
     std::unique_ptr<tr::context> ctx(tr::create_context(opt));
 
     tr::scene_data sd = tr::load_scenes(*ctx, opt);
@@ -215,6 +215,23 @@ bool aabb_frustum_intersection(const aabb& box, const frustum& f)
     return true;
 }
 
+aabb transform_aabb(const aabb& box, const mat4& transform)
+{
+    aabb res = {vec3(INFINITY), vec3(-INFINITY)};
+    for(int c = 0; c < 8; ++c)
+    {
+        vec3 corner = vec3(
+            c&1 ? box.max.x : box.min.x,
+            c&2 ? box.max.y : box.min.y,
+            c&4 ? box.max.z : box.min.z
+        );
+        vec3 p = transform * vec4(corner, 1);
+        res.min = min(res.min, p);
+        res.max = max(res.max, p);
+    }
+    return res;
+}
+
 unsigned ravel_tex_coord(uvec3 p, uvec3 size)
 {
     return p.z * size.x * size.y + p.y * size.x + p.x;
@@ -259,6 +276,18 @@ uint16_t float_to_half(float value)
     return bits;
 }
 
+float half_to_float(uint16_t value)
+{
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t bits = uint32_t(value & 0x7fff) << 13;
+    // Scaling by 2^112 fixes the exponent bias, and also handles subnormals.
+    float f = bit_cast<float>(bits) * bit_cast<float>(0x77800000);
+    // Infinity and NaN
+    if(bits >= 0x0f800000)
+        f = bit_cast<float>(bits | 0x7f800000);
+    return bit_cast<float>(bit_cast<uint32_t>(f) | sign);
+}
+
 uint32_t next_power_of_two(uint32_t n)
 {
     n--;
@@ -326,4 +355,18 @@ size_t hash_combine(size_t a, size_t b)
     return a ^ (b + 0x9e3779b9 + (a << 6) + (a >> 2));
 }
 
+uint32_t morton_encode(uvec3 p)
+{
+    // Spreads the bits out so that there are two zeroes between each.
+    auto spread = [](uint32_t v){
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    };
+    return spread(p.x) | (spread(p.y) << 1) | (spread(p.z) << 2);
+}
+
 }
@@ -123,6 +123,9 @@ bool obb_frustum_intersection(
 
 bool aabb_frustum_intersection(const aabb& box, const frustum& f);
 
+// Bounding box of the transformed box.
+aabb transform_aabb(const aabb& box, const mat4& transform);
+
 unsigned ravel_tex_coord(uvec3 p, uvec3 size);
 
 struct ray
@@ -138,6 +141,7 @@ ray operator*(const mat4& mat, const ray& r);
 bool flipped_winding_order(const mat3& transform);
 
 uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
 
 uint32_t next_power_of_two(uint32_t n);
 
@@ -158,6 +162,9 @@ std::vector<vec2> get_camera_jitter_sequence(
 
 size_t hash_combine(size_t a, size_t b);
 
+// Interleaves the lowest 10 bits of each coordinate, x being the lowest.
+uint32_t morton_encode(uvec3 p);
+
 }
 
 #include "math.tcc"
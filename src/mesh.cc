@@ -1,26 +1,129 @@
 #include "mesh.hh"
 #include "misc.hh"
+#include <atomic>
+#include <algorithm>
+
+namespace
+{
+using namespace tr;
+
+// Large meshes are split into chunks of this many elements for the thread
+// pool.
+constexpr size_t PARALLEL_CHUNK_SIZE = 1<<14;
+
+// Calls f(begin, end) over chunks of [0, count), in parallel if there is a
+// context to get a thread pool from.
+template<typename F>
+void parallel_ranges(context* ctx, size_t count, F&& f)
+{
+    size_t chunk_count = (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if(!ctx || chunk_count <= 1)
+    {
+        if(count != 0) f(0, count);
+        return;
+    }
+    ctx->get_thread_pool().parallel_for(chunk_count, [&](size_t i){
+        f(i * PARALLEL_CHUNK_SIZE, std::min((i+1) * PARALLEL_CHUNK_SIZE, count));
+    });
+}
+
+// Triangles touching each vertex, in ascending order. Per-vertex sums over
+// these add up in the same order as a serial loop over the triangles would,
+// so the results don't depend on the thread count.
+struct vertex_triangle_map
+{
+    // The triangles of vertex i are triangles[offsets[i]...offsets[i+1]-1].
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+};
+
+// Only the first 'corners' vertices of each triangle are included.
+vertex_triangle_map build_vertex_triangle_map(
+    const std::vector<uint32_t>& indices,
+    size_t vertex_count,
+    unsigned corners,
+    context* ctx
+){
+    size_t triangle_count = indices.size()/3;
+    std::unique_ptr<std::atomic<uint32_t>[]> counters(
+        new std::atomic<uint32_t>[vertex_count]
+    );
+    parallel_ranges(ctx, vertex_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+            counters[i].store(0, std::memory_order_relaxed);
+    });
+    parallel_ranges(ctx, triangle_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        for(unsigned c = 0; c < corners; ++c)
+            counters[indices[i*3+c]].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    vertex_triangle_map map;
+    map.offsets.resize(vertex_count+1);
+    map.offsets[0] = 0;
+    for(size_t i = 0; i < vertex_count; ++i)
+        map.offsets[i+1] = map.offsets[i] +
+            counters[i].load(std::memory_order_relaxed);
+
+    // The counters are reused as write cursors.
+    parallel_ranges(ctx, vertex_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+            counters[i].store(map.offsets[i], std::memory_order_relaxed);
+    });
+    map.triangles.resize(map.offsets.back());
+    parallel_ranges(ctx, triangle_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        for(unsigned c = 0; c < corners; ++c)
+        {
+            uint32_t slot = counters[indices[i*3+c]].fetch_add(
+                1, std::memory_order_relaxed
+            );
+            map.triangles[slot] = i;
+        }
+    });
+
+    // Filling in parallel scrambles the order within each vertex.
+    parallel_ranges(ctx, vertex_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+            std::sort(
+                map.triangles.begin() + map.offsets[i],
+                map.triangles.begin() + map.offsets[i+1]
+            );
+    });
+    return map;
+}
+
+}
 
 namespace tr
 {
 
-uint64_t mesh::id_counter = 1;
+std::atomic<uint64_t> mesh::id_counter = 1;
 
-mesh::mesh(device_mask dev): id(0), animation_source(nullptr), buffers(dev) {}
+mesh::mesh(device_mask dev)
+:   id(0), vertex_count(0), index_count(0), bounds{vec3(0), vec3(0)},
+    host_data_released(false),
+    animation_source(nullptr), buffers(dev)
+{
+}
 
 mesh::mesh(
     device_mask dev,
     std::vector<vertex>&& vertices,
     std::vector<uint32_t>&& indices,
     std::vector<skin_data>&& skin
-):  vertices(std::move(vertices)), indices(std::move(indices)),
+):  vertex_count(0), index_count(0), bounds{vec3(0), vec3(0)},
+    host_data_released(false),
+    vertices(std::move(vertices)), indices(std::move(indices)),
     skin(std::move(skin)), animation_source(nullptr), buffers(dev)
 {
     init_buffers();
 }
 
 mesh::mesh(mesh* animation_source)
-:   animation_source(animation_source),
+:   vertex_count(0), index_count(0), bounds{vec3(0), vec3(0)},
+    host_data_released(false),
+    animation_source(animation_source),
     buffers(animation_source->buffers.get_mask())
 {
     init_buffers();
@@ -31,6 +134,11 @@ uint64_t mesh::get_id() const
     return id;
 }
 
+uint64_t mesh::get_id_counter()
+{
+    return id_counter;
+}
+
 std::vector<mesh::vertex>& mesh::get_vertices()
 {
     if(animation_source) return animation_source->vertices;
@@ -67,6 +175,26 @@ const std::vector<mesh::skin_data>& mesh::get_skin() const
     return skin;
 }
 
+size_t mesh::get_vertex_count() const
+{
+    return vertex_count;
+}
+
+size_t mesh::get_index_count() const
+{
+    return index_count;
+}
+
+size_t mesh::get_triangle_count() const
+{
+    return index_count / 3;
+}
+
+const aabb& mesh::get_bounds() const
+{
+    return bounds;
+}
+
 vk::Buffer mesh::get_vertex_buffer(device_id id) const
 {
     return buffers[id].vertex_buffer;
@@ -98,96 +226,184 @@ mesh* mesh::get_animation_source() const
 
 void mesh::refresh_buffers()
 {
+    if(host_data_released)
+        throw std::runtime_error(
+            "Cannot refresh buffers of a mesh whose host data was released"
+        );
     // TODO: Make this smarter, no need to reinit if buffer size is the same
     // as before.
     init_buffers();
 }
 
-void mesh::calculate_normals()
+void mesh::release_host_data()
 {
-    // Clear existing data
-    for(vertex& v: vertices)
-    {
-        v.normal = vec3(0);
-    }
+    if(animation_source || is_skinned() || id == 0)
+        return;
 
-    // Go through triangles
-    for(size_t i = 0; i < indices.size()/3; ++i)
-    {
-        vertex& v0 = vertices[indices[i*3]];
-        vertex& v1 = vertices[indices[i*3+1]];
-        vertex& v2 = vertices[indices[i*3+2]];
-
-        vec3 d0 = v1.pos - v0.pos;
-        vec3 d1 = v2.pos - v0.pos;
-        pvec3 hard_normal = cross(d0, d1);
-        float len = length(hard_normal);
-        if(len > 1e-6) hard_normal /= len;
-        v0.normal += hard_normal;
-        v1.normal += hard_normal;
-        v2.normal += hard_normal;
-    }
+    // Swapping with empty vectors actually returns the memory, unlike clear().
+    std::vector<vertex>().swap(vertices);
+    std::vector<uint32_t>().swap(indices);
+    host_data_released = true;
+}
 
-    // Normalize results
-    for(vertex& v: vertices)
-    {
-        float len = length(v.normal);
-        if(len > 1e-6) v.normal /= len;
-    }
+bool mesh::has_host_data() const
+{
+    if(animation_source) return animation_source->has_host_data();
+    return !host_data_released;
+}
+
+void mesh::calculate_normals()
+{
+    context* ctx = buffers.get_mask().get_context();
+    size_t triangle_count = indices.size()/3;
+
+    std::vector<pvec3> hard_normals(triangle_count);
+    parallel_ranges(ctx, triangle_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        {
+            const vertex& v0 = vertices[indices[i*3]];
+            const vertex& v1 = vertices[indices[i*3+1]];
+            const vertex& v2 = vertices[indices[i*3+2]];
+
+            vec3 d0 = v1.pos - v0.pos;
+            vec3 d1 = v2.pos - v0.pos;
+            pvec3 hard_normal = cross(d0, d1);
+            float len = length(hard_normal);
+            if(len > 1e-6) hard_normal /= len;
+            hard_normals[i] = hard_normal;
+        }
+    });
+
+    // Sum up the triangles around each vertex and normalize results
+    vertex_triangle_map map = build_vertex_triangle_map(
+        indices, vertices.size(), 3, ctx
+    );
+    parallel_ranges(ctx, vertices.size(), [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        {
+            pvec3 normal = pvec3(0);
+            for(uint32_t j = map.offsets[i]; j < map.offsets[i+1]; ++j)
+                normal += hard_normals[map.triangles[j]];
+            float len = length(normal);
+            if(len > 1e-6) normal /= len;
+            vertices[i].normal = normal;
+        }
+    });
 }
 
 void mesh::calculate_tangents()
 {
-    // Clear existing data
-    for(vertex& v: vertices)
-    {
-        v.tangent = vec4(0);
-    }
+    context* ctx = buffers.get_mask().get_context();
+    size_t triangle_count = indices.size()/3;
 
-    // Go through triangles
-    for(size_t i = 0; i < indices.size()/3; ++i)
-    {
-        vertex& v0 = vertices[indices[i*3]];
-        vertex& v1 = vertices[indices[i*3+1]];
-        vertex& v2 = vertices[indices[i*3+2]];
-
-        vec3 d0 = v1.pos - v0.pos;
-        vec3 d1 = v2.pos - v0.pos;
-        vec3 hard_normal = cross(d0, d1);
-        float len = length(hard_normal);
-        if(len > 1e-6) hard_normal /= len;
-
-        vec2 uv0 = v1.uv - v0.uv;
-        vec2 uv1 = v2.uv - v0.uv;
-        vec3 hard_tangent = normalize(uv1.y * d0 - uv0.y * d1);
-        vec3 hard_bitangent = normalize(uv1.x * d1 - uv0.x * d0);
-        v0.tangent += pvec4(
-            hard_tangent,
-            dot(cross(hard_normal, hard_tangent), hard_bitangent) < 0 ? -1 : 1
-        );
-    }
+    std::vector<pvec4> hard_tangents(triangle_count);
+    parallel_ranges(ctx, triangle_count, [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        {
+            const vertex& v0 = vertices[indices[i*3]];
+            const vertex& v1 = vertices[indices[i*3+1]];
+            const vertex& v2 = vertices[indices[i*3+2]];
+
+            vec3 d0 = v1.pos - v0.pos;
+            vec3 d1 = v2.pos - v0.pos;
+            vec3 hard_normal = cross(d0, d1);
+            float len = length(hard_normal);
+            if(len > 1e-6) hard_normal /= len;
+
+            vec2 uv0 = v1.uv - v0.uv;
+            vec2 uv1 = v2.uv - v0.uv;
+            vec3 hard_tangent = normalize(uv1.y * d0 - uv0.y * d1);
+            vec3 hard_bitangent = normalize(uv1.x * d1 - uv0.x * d0);
+            hard_tangents[i] = pvec4(
+                hard_tangent,
+                dot(cross(hard_normal, hard_tangent), hard_bitangent) < 0 ? -1 : 1
+            );
+        }
+    });
+
+    // Only the first vertex of each triangle receives its tangent. Sum those
+    // up and normalize results.
+    vertex_triangle_map map = build_vertex_triangle_map(
+        indices, vertices.size(), 1, ctx
+    );
+    parallel_ranges(ctx, vertices.size(), [&](size_t begin, size_t end){
+        for(size_t i = begin; i < end; ++i)
+        {
+            vertex& v = vertices[i];
+            pvec4 tangent = pvec4(0);
+            for(uint32_t j = map.offsets[i]; j < map.offsets[i+1]; ++j)
+                tangent += hard_tangents[map.triangles[j]];
+            v.tangent = pvec4(
+                normalize(pvec3(tangent) - v.normal * dot(v.normal, pvec3(tangent))),
+                tangent.w < 0 ? -1 : 1
+            );
+        }
+    });
+}
 
-    // Normalize results
-    for(vertex& v: vertices)
+void mesh::load_buffers(
+    const vertex* vertices,
+    size_t vertex_count,
+    const uint32_t* indices,
+    size_t index_count,
+    const skin_data* skin,
+    size_t skin_count
+){
+    if(skin_count != 0)
     {
-        v.tangent = pvec4(
-            normalize(pvec3(v.tangent) - v.normal * dot(v.normal, pvec3(v.tangent))),
-            v.tangent.w < 0 ? -1 : 1
-        );
+        this->vertices.assign(vertices, vertices + vertex_count);
+        this->indices.assign(indices, indices + index_count);
+        this->skin.assign(skin, skin + skin_count);
+        host_data_released = false;
+        init_buffers();
+        return;
     }
+
+    std::vector<vertex>().swap(this->vertices);
+    std::vector<uint32_t>().swap(this->indices);
+    std::vector<skin_data>().swap(this->skin);
+    host_data_released = true;
+    init_buffers(vertices, vertex_count, indices, index_count, nullptr, 0);
 }
 
 void mesh::init_buffers()
 {
-    id = id_counter++;
-
     const std::vector<vertex>& vertices = animation_source ? animation_source->vertices : this->vertices;
     const std::vector<uint32_t>& indices = animation_source ? animation_source->indices : this->indices;
     const std::vector<skin_data>& skin = animation_source ? animation_source->skin : this->skin;
+    init_buffers(
+        vertices.data(), vertices.size(), indices.data(), indices.size(),
+        skin.data(), skin.size()
+    );
+}
+
+void mesh::init_buffers(
+    const vertex* vertices,
+    size_t vertex_count,
+    const uint32_t* indices,
+    size_t index_count,
+    const skin_data* skin,
+    size_t skin_count
+){
+    id = id_counter++;
+
+    this->vertex_count = vertex_count;
+    this->index_count = index_count;
+
+    if(vertex_count != 0)
+    {
+        bounds = {vec3(INFINITY), vec3(-INFINITY)};
+        for(size_t i = 0; i < vertex_count; ++i)
+        {
+            bounds.min = min(bounds.min, vec3(vertices[i].pos));
+            bounds.max = max(bounds.max, vec3(vertices[i].pos));
+        }
+    }
+    else bounds = {vec3(0), vec3(0)};
 
-    size_t vertex_bytes = vertices.size() * sizeof(vertices[0]);
-    size_t index_bytes = indices.size() * sizeof(indices[0]);
-    size_t skin_bytes = skin.size() * sizeof(skin[0]);
+    size_t vertex_bytes = vertex_count * sizeof(vertex);
+    size_t index_bytes = index_count * sizeof(uint32_t);
+    size_t skin_bytes = skin_count * sizeof(skin_data);
 
     for(auto[dev, buf]: buffers)
     {
@@ -196,7 +412,10 @@ void mesh::init_buffers()
         if(dev.ctx->is_ray_tracing_supported())
             buf_flags = buf_flags | vk::BufferUsageFlagBits::eShaderDeviceAddress|
                 vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
-        vk::CommandBuffer cb = begin_command_buffer(dev);
+        // An active upload batch takes care of the copies by itself.
+        vk::CommandBuffer cb;
+        if(!dev.active_uploads)
+            cb = begin_command_buffer(dev);
 
         buf.vertex_buffer = create_buffer(
             dev,
@@ -206,7 +425,7 @@ void mesh::init_buffers()
                 vk::SharingMode::eExclusive
             },
             VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-            vertices.data(),
+            vertices,
             cb
         );
 
@@ -220,7 +439,7 @@ void mesh::init_buffers()
                     vk::SharingMode::eExclusive
                 },
                 VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-                indices.data(),
+                indices,
                 cb
             );
             if(skin_bytes > 0)
@@ -233,13 +452,14 @@ void mesh::init_buffers()
                         vk::SharingMode::eExclusive
                     },
                     VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-                    skin.data(),
+                    skin,
                     cb
                 );
             }
         }
 
-        end_command_buffer(dev, cb);
+        if(cb)
+            end_command_buffer(dev, cb);
     }
 }
 
@@ -7,6 +7,7 @@
 #include "gpu_buffer.hh"
 #include "acceleration_structure.hh"
 #include <optional>
+#include <atomic>
 
 namespace tr
 {
@@ -56,6 +57,8 @@ public:
     // ensuring that acceleration structures with the same ID are at least
     // update-compatible.
     uint64_t get_id() const;
+    // Incremented whenever any mesh gets a new ID.
+    static uint64_t get_id_counter();
 
     std::vector<vertex>& get_vertices();
     const std::vector<vertex>& get_vertices() const;
@@ -64,6 +67,14 @@ public:
     std::vector<skin_data>& get_skin();
     const std::vector<skin_data>& get_skin() const;
 
+    // These reflect the GPU buffers, so they stay valid after
+    // release_host_data().
+    size_t get_vertex_count() const;
+    size_t get_index_count() const;
+    size_t get_triangle_count() const;
+    // Bounds of the original vertices, animations may exceed these.
+    const aabb& get_bounds() const;
+
     vk::Buffer get_vertex_buffer(device_id id) const;
     vk::Buffer get_index_buffer(device_id id) const;
     vk::Buffer get_skin_buffer(device_id id) const;
@@ -76,8 +87,29 @@ public:
     // recorded into them instead of temporary ones.
     void refresh_buffers();
 
+    // Uploads the given arrays directly without keeping CPU-side copies, as
+    // if release_host_data() was called afterwards. Skinned meshes still copy
+    // theirs, as their animation copies are created from the CPU data.
+    void load_buffers(
+        const vertex* vertices,
+        size_t vertex_count,
+        const uint32_t* indices,
+        size_t index_count,
+        const skin_data* skin = nullptr,
+        size_t skin_count = 0
+    );
+
+    // Frees the CPU-side copies of the vertex data once it has been uploaded.
+    // The vectors are empty afterwards and refresh_buffers() can no longer be
+    // used. Skinned meshes are left alone, as their animation copies are
+    // created from the CPU data.
+    void release_host_data();
+    bool has_host_data() const;
+
     // Calculates new normals for existing vertices. Assumes that vertices and
     // indices are already filled out, but that normals and tangents are garbage.
+    // Large meshes are processed on the context's thread pool, so these can
+    // also be called from tasks running on it.
     void calculate_normals();
     //
     // Calculates new tangents for existing vertices. Assumes that vertices and
@@ -89,10 +121,22 @@ public:
 
 private:
     void init_buffers();
+    void init_buffers(
+        const vertex* vertices,
+        size_t vertex_count,
+        const uint32_t* indices,
+        size_t index_count,
+        const skin_data* skin,
+        size_t skin_count
+    );
 
-    static uint64_t id_counter;
+    static std::atomic<uint64_t> id_counter;
 
     uint64_t id;
+    size_t vertex_count;
+    size_t index_count;
+    aabb bounds;
+    bool host_data_released;
     std::vector<vertex> vertices;
     std::vector<uint32_t> indices;
     std::vector<skin_data> skin;
@@ -0,0 +1,252 @@
+#include "mipmap.hh"
+#include "misc.hh"
+
+namespace
+{
+using namespace tr;
+
+// Rows per task, small levels are handled by a single task.
+constexpr unsigned ROW_BATCH = 16;
+
+enum class channel_type
+{
+    UNORM8,
+    UNORM16,
+    FLOAT16,
+    FLOAT32
+};
+
+bool get_channel_layout(vk::Format fmt, channel_type& type, unsigned& count)
+{
+    switch(fmt)
+    {
+    case vk::Format::eR8Unorm: type = channel_type::UNORM8; count = 1; break;
+    case vk::Format::eR8G8Unorm: type = channel_type::UNORM8; count = 2; break;
+    case vk::Format::eR8G8B8A8Unorm: type = channel_type::UNORM8; count = 4; break;
+    case vk::Format::eR16G16B16A16Unorm: type = channel_type::UNORM16; count = 4; break;
+    case vk::Format::eR16Sfloat: type = channel_type::FLOAT16; count = 1; break;
+    case vk::Format::eR16G16Sfloat: type = channel_type::FLOAT16; count = 2; break;
+    case vk::Format::eR16G16B16A16Sfloat: type = channel_type::FLOAT16; count = 4; break;
+    case vk::Format::eR32Sfloat: type = channel_type::FLOAT32; count = 1; break;
+    case vk::Format::eR32G32Sfloat: type = channel_type::FLOAT32; count = 2; break;
+    case vk::Format::eR32G32B32A32Sfloat: type = channel_type::FLOAT32; count = 4; break;
+    default: return false;
+    }
+    return true;
+}
+
+float srgb_to_linear(float v)
+{
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float v)
+{
+    return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// Everything is filtered as floats in a space where averaging is meaningful:
+// linear color, or [-1, 1] normal vectors.
+struct level_filter
+{
+    channel_type type;
+    unsigned channel_count;
+    bool srgb;
+    bool normal;
+
+    void decode_row(const uint8_t* src, float* dst, unsigned width) const
+    {
+        unsigned n = width * channel_count;
+        switch(type)
+        {
+        case channel_type::UNORM8:
+            for(unsigned i = 0; i < n; ++i)
+                dst[i] = src[i] * (1.0f / 255.0f);
+            break;
+        case channel_type::UNORM16:
+            for(unsigned i = 0; i < n; ++i)
+                dst[i] = ((const uint16_t*)src)[i] * (1.0f / 65535.0f);
+            break;
+        case channel_type::FLOAT16:
+            for(unsigned i = 0; i < n; ++i)
+                dst[i] = half_to_float(((const uint16_t*)src)[i]);
+            break;
+        case channel_type::FLOAT32:
+            memcpy(dst, src, n * sizeof(float));
+            break;
+        }
+
+        if(srgb)
+        {
+            unsigned color_channels = channel_count == 4 ? 3 : channel_count;
+            for(unsigned x = 0; x < width; ++x)
+            for(unsigned c = 0; c < color_channels; ++c)
+                dst[x * channel_count + c] = srgb_to_linear(dst[x * channel_count + c]);
+        }
+
+        if(normal)
+        {
+            for(unsigned i = 0; i < n; ++i)
+                dst[i] = dst[i] * 2.0f - 1.0f;
+        }
+    }
+
+    void encode_row(float* src, uint8_t* dst, unsigned width) const
+    {
+        unsigned n = width * channel_count;
+        if(normal)
+        {
+            for(unsigned i = 0; i < n; ++i)
+                src[i] = src[i] * 0.5f + 0.5f;
+        }
+
+        if(srgb)
+        {
+            unsigned color_channels = channel_count == 4 ? 3 : channel_count;
+            for(unsigned x = 0; x < width; ++x)
+            for(unsigned c = 0; c < color_channels; ++c)
+                src[x * channel_count + c] = linear_to_srgb(src[x * channel_count + c]);
+        }
+
+        switch(type)
+        {
+        case channel_type::UNORM8:
+            for(unsigned i = 0; i < n; ++i)
+                dst[i] = std::clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+            break;
+        case channel_type::UNORM16:
+            for(unsigned i = 0; i < n; ++i)
+                ((uint16_t*)dst)[i] = std::clamp(src[i], 0.0f, 1.0f) * 65535.0f + 0.5f;
+            break;
+        case channel_type::FLOAT16:
+            for(unsigned i = 0; i < n; ++i)
+                ((uint16_t*)dst)[i] = float_to_half(src[i]);
+            break;
+        case channel_type::FLOAT32:
+            memcpy(dst, src, n * sizeof(float));
+            break;
+        }
+    }
+
+    // Averages 2x2 texels, odd edges are clamped.
+    void downsample_row(
+        const float* src,
+        uvec2 src_size,
+        float* dst,
+        unsigned dst_width,
+        unsigned y
+    ) const {
+        unsigned y0 = min(y*2, src_size.y-1);
+        unsigned y1 = min(y*2+1, src_size.y-1);
+        const float* row0 = src + size_t(y0) * src_size.x * channel_count;
+        const float* row1 = src + size_t(y1) * src_size.x * channel_count;
+        for(unsigned x = 0; x < dst_width; ++x)
+        {
+            unsigned x0 = min(x*2, src_size.x-1) * channel_count;
+            unsigned x1 = min(x*2+1, src_size.x-1) * channel_count;
+            float* out = dst + x * channel_count;
+            for(unsigned c = 0; c < channel_count; ++c)
+                out[c] = 0.25f * (row0[x0+c] + row0[x1+c] + row1[x0+c] + row1[x1+c]);
+
+            if(normal && channel_count >= 2)
+            {
+                // Two-channel normal maps have an implicit Z.
+                float z = channel_count >= 3 ? out[2] :
+                    std::sqrt(std::max(1.0f - out[0]*out[0] - out[1]*out[1], 0.0f));
+                float len = std::sqrt(out[0]*out[0] + out[1]*out[1] + z*z);
+                if(len > 1e-6f)
+                {
+                    out[0] /= len;
+                    out[1] /= len;
+                    if(channel_count >= 3) out[2] = z / len;
+                }
+            }
+        }
+    }
+};
+
+}
+
+namespace tr
+{
+
+bool generate_mip_chain(
+    texture::decoded_image& img,
+    texture_usage usage,
+    thread_pool& pool
+){
+    level_filter filter;
+    if(
+        img.mip_levels > 1 || img.size.x == 0 || img.size.y == 0 ||
+        !get_channel_layout(img.fmt, filter.type, filter.channel_count)
+    ) return false;
+
+    bool is_float = filter.type == channel_type::FLOAT16 ||
+        filter.type == channel_type::FLOAT32;
+    filter.srgb = usage == texture_usage::COLOR && !is_float;
+    filter.normal = usage == texture_usage::NORMAL && !is_float;
+
+    uint32_t mip_levels = calculate_mipmap_count(img.size);
+    std::vector<size_t> offsets = get_mip_level_offsets(
+        img.fmt, vk::Extent3D(img.size.x, img.size.y, 1), mip_levels
+    );
+    uint32_t texel_size, block_width, block_height;
+    get_format_block_info(img.fmt, texel_size, block_width, block_height);
+    if(img.pixels.size() < size_t(img.size.x) * img.size.y * texel_size)
+        return false;
+
+    std::vector<uint8_t> chain(offsets.back());
+    memcpy(chain.data(), img.pixels.data(), std::min(img.pixels.size(), offsets[1]));
+    auto for_rows = [&](unsigned rows, auto&& f){
+        pool.parallel_for((rows + ROW_BATCH - 1) / ROW_BATCH, [&](size_t batch){
+            unsigned end = min(unsigned(batch + 1) * ROW_BATCH, rows);
+            for(unsigned y = batch * ROW_BATCH; y < end; ++y)
+                f(y);
+        });
+    };
+
+    uvec2 size = img.size;
+    std::vector<float> level(size_t(size.x) * size.y * filter.channel_count);
+    for_rows(size.y, [&](unsigned y){
+        size_t row = size_t(y) * size.x;
+        filter.decode_row(
+            img.pixels.data() + row * texel_size,
+            level.data() + row * filter.channel_count,
+            size.x
+        );
+    });
+
+    std::vector<float> next_level;
+    for(uint32_t i = 1; i < mip_levels; ++i)
+    {
+        uvec2 next_size = max(size/2u, uvec2(1));
+        next_level.resize(size_t(next_size.x) * next_size.y * filter.channel_count);
+        uint8_t* dst = chain.data() + offsets[i];
+        for_rows(next_size.y, [&](unsigned y){
+            size_t row = size_t(y) * next_size.x;
+            float* out = next_level.data() + row * filter.channel_count;
+            filter.downsample_row(level.data(), size, out, next_size.x, y);
+
+            // Encoding modifies the row in place, so the next level is filtered
+            // from a copy.
+            float tmp[4 * 64];
+            for(unsigned x = 0; x < next_size.x; x += 64)
+            {
+                unsigned count = min(64u, next_size.x - x);
+                memcpy(
+                    tmp, out + x * filter.channel_count,
+                    count * filter.channel_count * sizeof(float)
+                );
+                filter.encode_row(tmp, dst + (row + x) * texel_size, count);
+            }
+        });
+        std::swap(level, next_level);
+        size = next_size;
+    }
+
+    img.mip_levels = mip_levels;
+    img.pixels = std::move(chain);
+    return true;
+}
+
+}
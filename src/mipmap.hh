@@ -0,0 +1,22 @@
+#ifndef TAURAY_MIPMAP_HH
+#define TAURAY_MIPMAP_HH
+#include "texture.hh"
+#include "thread_pool.hh"
+
+namespace tr
+{
+
+// Builds the whole mip chain of an uncompressed image on the CPU, filtering
+// according to the usage: color is averaged in linear space and normals are
+// renormalized. The result is laid out as in get_mip_level_offsets(). Returns
+// false and leaves the image untouched if the format isn't supported or the
+// image already has mipmaps. Rows are processed in parallel on the given pool.
+bool generate_mip_chain(
+    texture::decoded_image& img,
+    texture_usage usage,
+    thread_pool& pool
+);
+
+}
+
+#endif
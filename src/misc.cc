@@ -1,11 +1,14 @@
 #include "misc.hh"
 #include "context.hh"
+#include "upload_batch.hh"
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <filesystem>
 #include <algorithm>
 #include <chrono>
+#include <random>
+#include <numeric>
 #include <iostream>
 namespace fs = std::filesystem;
 #ifdef _WIN32
@@ -153,7 +156,9 @@ vkm<vk::Buffer> create_buffer(
         &alloc, nullptr
     );
 
-    if(data)
+    if(data && !shared_cb && dev.active_uploads)
+        dev.active_uploads->upload_buffer(dev, res, info.size, data);
+    else if(data)
     {
         vkm<vk::Buffer> staging = create_staging_buffer(dev, info.size, data);
         vk::CommandBuffer cb = shared_cb ? shared_cb : begin_command_buffer(dev);
@@ -188,7 +193,9 @@ vkm<vk::Buffer> create_buffer_aligned(
         &alloc, nullptr
     );
 
-    if(data)
+    if(data && dev.active_uploads)
+        dev.active_uploads->upload_buffer(dev, res, info.size, data);
+    else if(data)
     {
         vkm<vk::Buffer> staging = create_staging_buffer(dev, info.size, data);
         vk::CommandBuffer cb = begin_command_buffer(dev);
@@ -344,6 +351,145 @@ vk::ImageAspectFlags deduce_aspect_mask(vk::Format fmt)
     else return vk::ImageAspectFlagBits::eColor;
 }
 
+bool is_two_channel_format(vk::Format fmt)
+{
+    switch(fmt)
+    {
+    case vk::Format::eR8G8Unorm:
+    case vk::Format::eR8G8Snorm:
+    case vk::Format::eR16G16Unorm:
+    case vk::Format::eR16G16Snorm:
+    case vk::Format::eR16G16Sfloat:
+    case vk::Format::eR32G32Sfloat:
+    case vk::Format::eBc5UnormBlock:
+    case vk::Format::eBc5SnormBlock:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void get_format_block_info(
+    vk::Format fmt,
+    uint32_t& block_size,
+    uint32_t& block_width,
+    uint32_t& block_height
+){
+    block_width = 1;
+    block_height = 1;
+    switch(fmt)
+    {
+    case vk::Format::eR8Unorm:
+    case vk::Format::eR8Snorm:
+    case vk::Format::eR8Srgb:
+        block_size = 1;
+        break;
+    case vk::Format::eR8G8Unorm:
+    case vk::Format::eR8G8Snorm:
+    case vk::Format::eR8G8Srgb:
+    case vk::Format::eR16Unorm:
+    case vk::Format::eR16Sfloat:
+        block_size = 2;
+        break;
+    case vk::Format::eR8G8B8Unorm:
+    case vk::Format::eR8G8B8Srgb:
+        block_size = 3;
+        break;
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Snorm:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Unorm:
+    case vk::Format::eB8G8R8A8Srgb:
+    case vk::Format::eR16G16Unorm:
+    case vk::Format::eR16G16Sfloat:
+    case vk::Format::eR32Sfloat:
+        block_size = 4;
+        break;
+    case vk::Format::eR16G16B16Sfloat:
+        block_size = 6;
+        break;
+    case vk::Format::eR16G16B16A16Unorm:
+    case vk::Format::eR16G16B16A16Sfloat:
+    case vk::Format::eR32G32Sfloat:
+        block_size = 8;
+        break;
+    case vk::Format::eR32G32B32Sfloat:
+        block_size = 12;
+        break;
+    case vk::Format::eR32G32B32A32Sfloat:
+        block_size = 16;
+        break;
+    case vk::Format::eBc4UnormBlock:
+    case vk::Format::eBc4SnormBlock:
+        block_size = 8;
+        block_width = 4;
+        block_height = 4;
+        break;
+    case vk::Format::eBc5UnormBlock:
+    case vk::Format::eBc5SnormBlock:
+    case vk::Format::eBc7UnormBlock:
+    case vk::Format::eBc7SrgbBlock:
+        block_size = 16;
+        block_width = 4;
+        block_height = 4;
+        break;
+    default:
+        throw std::runtime_error(
+            "Unsupported format for size calculation: " + vk::to_string(fmt)
+        );
+    }
+}
+
+std::vector<size_t> get_mip_level_offsets(
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels
+){
+    uint32_t block_size, block_width, block_height;
+    get_format_block_info(fmt, block_size, block_width, block_height);
+
+    // 3, 6 and 12-byte texels don't divide 16.
+    size_t alignment = std::lcm(size_t(16), size_t(block_size));
+    std::vector<size_t> offsets;
+    size_t offset = 0;
+    for(uint32_t i = 0; i < mip_levels; ++i)
+    {
+        offsets.push_back(offset);
+        size_t w = std::max(extent.width >> i, 1u);
+        size_t h = std::max(extent.height >> i, 1u);
+        size_t d = std::max(extent.depth >> i, 1u);
+        size_t level_size = (w + block_width - 1) / block_width *
+            ((h + block_height - 1) / block_height) * d * block_size;
+        offset = (offset + level_size + alignment - 1) / alignment * alignment;
+    }
+    offsets.push_back(offset);
+    return offsets;
+}
+
+std::vector<vk::BufferImageCopy> get_mip_chain_copy_regions(
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels,
+    size_t buffer_offset
+){
+    std::vector<size_t> offsets = get_mip_level_offsets(fmt, extent, mip_levels);
+    std::vector<vk::BufferImageCopy> regions;
+    for(uint32_t i = 0; i < mip_levels; ++i)
+    {
+        regions.push_back({
+            buffer_offset + offsets[i], 0, 0,
+            {deduce_aspect_mask(fmt), i, 0, 1},
+            {0,0,0},
+            {
+                std::max(extent.width >> i, 1u),
+                std::max(extent.height >> i, 1u),
+                std::max(extent.depth >> i, 1u)
+            }
+        });
+    }
+    return regions;
+}
+
 void deduce_layout_access_stage(
     vk::ImageLayout layout,
     vk::AccessFlags& access,
@@ -387,12 +533,60 @@ void deduce_layout_access_stage(
     }
 }
 
+void generate_mipmaps(
+    vk::CommandBuffer cb,
+    vk::Image img,
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels,
+    vk::ImageLayout final_layout
+){
+    ivec2 sz = ivec2(extent.width, extent.height);
+    for(uint32_t i = 1; i < mip_levels; ++i)
+    {
+        transition_image_layout(
+            cb, img, fmt,
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::ImageLayout::eTransferSrcOptimal,
+            i-1, 1
+        );
+        ivec2 next_sz = max(sz/2, ivec2(1));
+        vk::ImageAspectFlags mask = deduce_aspect_mask(fmt);
+        vk::ImageBlit blit(
+            {mask, i-1, 0, 1},
+            {{{0,0,0}, {sz.x,sz.y,1}}},
+            {mask, i, 0, 1},
+            {{{0,0,0}, {next_sz.x,next_sz.y,1}}}
+        );
+        cb.blitImage(
+            img, vk::ImageLayout::eTransferSrcOptimal,
+            img, vk::ImageLayout::eTransferDstOptimal,
+            blit, vk::Filter::eLinear
+        );
+        sz = next_sz;
+        transition_image_layout(
+            cb, img, fmt,
+            vk::ImageLayout::eTransferSrcOptimal,
+            final_layout,
+            i-1, 1
+        );
+    }
+
+    transition_image_layout(
+        cb, img, fmt,
+        vk::ImageLayout::eTransferDstOptimal,
+        final_layout,
+        mip_levels-1, 1
+    );
+}
+
 vkm<vk::Image> sync_create_gpu_image(
     device& dev,
     vk::ImageCreateInfo info,
     vk::ImageLayout final_layout,
     size_t data_size,
-    void* data
+    const void* data,
+    bool data_has_mipmaps
 ){
     vk::Image img;
     VmaAllocation alloc;
@@ -408,11 +602,16 @@ vkm<vk::Image> sync_create_gpu_image(
             &alloc, nullptr
         );
 
-        vk::CommandBuffer cb = begin_command_buffer(dev);
-        transition_image_layout(
-            cb, img, info.format, vk::ImageLayout::eUndefined, final_layout
-        );
-        end_command_buffer(dev, cb);
+        if(dev.active_uploads)
+            dev.active_uploads->upload_image(dev, img, info, final_layout);
+        else
+        {
+            vk::CommandBuffer cb = begin_command_buffer(dev);
+            transition_image_layout(
+                cb, img, info.format, vk::ImageLayout::eUndefined, final_layout
+            );
+            end_command_buffer(dev, cb);
+        }
     }
     else
     {
@@ -429,6 +628,15 @@ vkm<vk::Image> sync_create_gpu_image(
             &alloc, &vma_alloc_info
         );
 
+        if(dev.active_uploads)
+        {
+            dev.active_uploads->upload_image(
+                dev, img, info, final_layout, data_size, data,
+                data_has_mipmaps
+            );
+            return vkm<vk::Image>(dev, img, alloc);
+        }
+
         vkm<vk::Buffer> staging_buffer = create_staging_buffer(
             dev, data_size, data
         );
@@ -441,55 +649,39 @@ vkm<vk::Image> sync_create_gpu_image(
             0, info.mipLevels
         );
 
-        vk::BufferImageCopy region(
-            0, 0, 0,
-            {deduce_aspect_mask(info.format), 0, 0, 1},
-            {0,0,0},
-            info.extent
-        );
-        cb.copyBufferToImage(
-            staging_buffer, img, vk::ImageLayout::eTransferDstOptimal, 1, &region
-        );
-
-        // Generate mipmaps.
-        ivec2 sz = ivec2(info.extent.width, info.extent.height);
-        for(uint32_t i = 1; i < info.mipLevels; ++i)
+        if(data_has_mipmaps)
         {
+            cb.copyBufferToImage(
+                staging_buffer, img, vk::ImageLayout::eTransferDstOptimal,
+                get_mip_chain_copy_regions(
+                    info.format, info.extent, info.mipLevels
+                )
+            );
             transition_image_layout(
                 cb, img, info.format,
                 vk::ImageLayout::eTransferDstOptimal,
-                vk::ImageLayout::eTransferSrcOptimal,
-                i-1, 1
+                final_layout,
+                0, info.mipLevels
             );
-            ivec2 next_sz = max(sz/2, ivec2(1));
-            vk::ImageAspectFlags mask = deduce_aspect_mask(info.format);
-            vk::ImageBlit blit(
-                {mask, i-1, 0, 1},
-                {{{0,0,0}, {sz.x,sz.y,1}}},
-                {mask, i, 0, 1},
-                {{{0,0,0}, {next_sz.x,next_sz.y,1}}}
+        }
+        else
+        {
+            vk::BufferImageCopy region(
+                0, 0, 0,
+                {deduce_aspect_mask(info.format), 0, 0, 1},
+                {0,0,0},
+                info.extent
             );
-            cb.blitImage(
-                img, vk::ImageLayout::eTransferSrcOptimal,
-                img, vk::ImageLayout::eTransferDstOptimal,
-                blit, vk::Filter::eLinear
+            cb.copyBufferToImage(
+                staging_buffer, img, vk::ImageLayout::eTransferDstOptimal,
+                1, &region
             );
-            sz = next_sz;
-            transition_image_layout(
-                cb, img, info.format,
-                vk::ImageLayout::eTransferSrcOptimal,
-                final_layout,
-                i-1, 1
+
+            generate_mipmaps(
+                cb, img, info.format, info.extent, info.mipLevels, final_layout
             );
         }
 
-        transition_image_layout(
-            cb, img, info.format,
-            vk::ImageLayout::eTransferDstOptimal,
-            final_layout,
-            info.mipLevels-1, 1
-        );
-
         end_command_buffer(dev, cb);
 
         staging_buffer.destroy();
@@ -585,6 +777,53 @@ std::string load_text_file(const std::string& path)
     return ret;
 }
 
+bool try_load_binary_file(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f) return false;
+
+    fseek(f, 0, SEEK_END);
+    size_t sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data.resize(sz);
+    bool success = fread(data.data(), 1, sz, f) == sz;
+    fclose(f);
+    return success;
+}
+
+bool write_binary_file(const std::string& path, const void* data, size_t size)
+{
+    std::string tmp_path = path + ".tmp" + std::to_string(std::random_device()());
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if(!f) return false;
+
+    bool success = fwrite(data, 1, size, f) == size;
+    success = fclose(f) == 0 && success;
+
+    std::error_code ec;
+    if(success)
+        fs::rename(tmp_path, path, ec);
+    if(!success || ec)
+    {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+uint64_t hash_data(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = seed;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 bool nonblock_getline(std::string& line)
 {
     static std::stringstream reading;
@@ -89,18 +89,65 @@ void destroy_host_allocated_buffer(
 
 vk::ImageAspectFlags deduce_aspect_mask(vk::Format fmt);
 
+// Formats with only red and green channels, where blue reads as zero.
+bool is_two_channel_format(vk::Format fmt);
+
+// Size of one texel block in bytes, and its width & height in texels. Blocks
+// are 1x1 for uncompressed formats. Throws for unsupported formats.
+void get_format_block_info(
+    vk::Format fmt,
+    uint32_t& block_size,
+    uint32_t& block_width,
+    uint32_t& block_height
+);
+
+// Precomputed mip chains are stored level after level, each level starting
+// at a common multiple of 16 bytes and the texel block size. That keeps copy
+// offsets valid on transfer queues for every texel size. Returns
+// mip_levels+1 offsets, where the last one is the size of the whole chain.
+std::vector<size_t> get_mip_level_offsets(
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels
+);
+
 void deduce_layout_access_stage(
     vk::ImageLayout layout,
     vk::AccessFlags& access,
     vk::PipelineStageFlags& stage
 );
 
+// Fills mip levels 1+ by blitting from level 0. All levels must be in
+// eTransferDstOptimal, and are left in final_layout.
+void generate_mipmaps(
+    vk::CommandBuffer cb,
+    vk::Image img,
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels,
+    vk::ImageLayout final_layout
+);
+
+// If the device has an active upload_batch, the upload is only recorded into
+// it and is not finished when this returns. If data_has_mipmaps is set, data
+// contains all mip levels as laid out by get_mip_level_offsets(). Otherwise,
+// it only contains the first level and the rest are generated.
 vkm<vk::Image> sync_create_gpu_image(
     device& dev,
     vk::ImageCreateInfo info,
     vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal,
     size_t data_size = 0,
-    void* data = nullptr
+    const void* data = nullptr,
+    bool data_has_mipmaps = false
+);
+
+// Regions for copying a whole mip chain laid out by get_mip_level_offsets(),
+// starting at buffer_offset.
+std::vector<vk::BufferImageCopy> get_mip_chain_copy_regions(
+    vk::Format fmt,
+    vk::Extent3D extent,
+    uint32_t mip_levels,
+    size_t buffer_offset = 0
 );
 
 // The hammer for all problems (if you don't care about performance at all)
@@ -114,6 +161,20 @@ vk::SampleCountFlagBits get_max_available_sample_count(context& ctx);
 
 std::string get_resource_path(const std::string& path);
 std::string load_text_file(const std::string& path);
+// Returns false if the file cannot be read.
+bool try_load_binary_file(const std::string& path, std::vector<uint8_t>& data);
+// Writes into a temporary file first and renames it over 'path', so that
+// concurrent readers never see partially written files. Returns false on
+// failure.
+bool write_binary_file(const std::string& path, const void* data, size_t size);
+
+// FNV-1a. Unlike std::hash, this is stable across runs and platforms, so it
+// can be used for keys of on-disk caches.
+uint64_t hash_data(
+    const void* data,
+    size_t size,
+    uint64_t seed = 0xcbf29ce484222325ull
+);
 bool nonblock_getline(std::string& line);
 
 template<typename T>
@@ -14,25 +14,31 @@ struct joint_data_gpu
 namespace tr
 {
 
-model::model(): shadow_terminator_offset(0.0f) {}
+std::atomic<uint64_t> model::change_counter = 1;
+
+model::model(): shadow_terminator_offset(0.0f), revision(1) {}
 model::model(const model& other)
+:   groups(other.groups), joints(other.joints),
+    shadow_terminator_offset(other.shadow_terminator_offset), revision(1)
 {
-    operator=(other);
 }
 
 model::model(model&& other)
+:   groups(std::move(other.groups)), joints(std::move(other.joints)),
+    joint_buffer(std::move(other.joint_buffer)),
+    shadow_terminator_offset(other.shadow_terminator_offset), revision(1)
 {
-    operator=(std::move(other));
 }
 
 model::model(const material& mat, mesh* m)
-: shadow_terminator_offset(0.0f)
+: shadow_terminator_offset(0.0f), revision(1)
 {
-    add_vertex_group(mat, m);
+    groups.push_back({mat, m});
 }
 
 model& model::operator=(model&& other)
 {
+    bump_revision();
     groups = std::move(other.groups);
     joints = std::move(other.joints);
     joint_buffer = std::move(other.joint_buffer);
@@ -42,6 +48,7 @@ model& model::operator=(model&& other)
 
 model& model::operator=(const model& other)
 {
+    bump_revision();
     groups = other.groups;
     joints = other.joints;
     joint_buffer.reset();
@@ -50,8 +57,27 @@ model& model::operator=(const model& other)
     return *this;
 }
 
-void model::add_vertex_group(const material& mat, mesh* m) { groups.push_back({mat, m}); }
-void model::clear_vertex_groups() { groups.clear(); }
+void model::add_vertex_group(const material& mat, mesh* m)
+{
+    bump_revision();
+    groups.push_back({mat, m});
+}
+
+void model::clear_vertex_groups()
+{
+    bump_revision();
+    groups.clear();
+}
+
+uint64_t model::get_revision() const
+{
+    return revision;
+}
+
+uint64_t model::get_change_counter()
+{
+    return change_counter;
+}
 
 bool model::is_skinned() const
 {
@@ -133,4 +159,10 @@ float model::get_shadow_terminator_offset() const
     return shadow_terminator_offset;
 }
 
+void model::bump_revision()
+{
+    revision++;
+    change_counter++;
+}
+
 }
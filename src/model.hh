@@ -3,6 +3,7 @@
 #include "mesh.hh"
 #include "material.hh"
 #include <vector>
+#include <atomic>
 
 namespace tr
 {
@@ -33,6 +34,15 @@ public:
     void add_vertex_group(const material& mat, mesh* m);
     void clear_vertex_groups();
 
+    // Incremented whenever the vertex groups of this model are added, removed
+    // or replaced. Modifying vertex groups in-place through operator[] or the
+    // iterators doesn't count.
+    uint64_t get_revision() const;
+    // Incremented along with the revision of any model, so that users caching
+    // static objects only need to check their revisions after this changes.
+    // Constructing new models doesn't count.
+    static uint64_t get_change_counter();
+
     bool is_skinned() const;
 
     size_t group_count() const;
@@ -64,10 +74,15 @@ public:
     float get_shadow_terminator_offset() const;
 
 private:
+    void bump_revision();
+
+    static std::atomic<uint64_t> change_counter;
+
     std::vector<vertex_group> groups;
     std::vector<joint_data> joints;
     std::optional<gpu_buffer> joint_buffer;
     float shadow_terminator_offset;
+    uint64_t revision;
 };
 
 }
@@ -523,13 +523,28 @@
         "different BLAS. per-model assigns each model a BLAS. " \
         "static-merged-dynamic-per-model merges all static geometries into " \
         "one BLAS, while dynamic geometries are given per-model BLASes. " \
-        "all-merged puts everything in one. Each approach has different " \
-        "performance and memory tradeoffs.", \
+        "all-merged puts everything in one. clustered splits static " \
+        "geometry into spatially coherent BLASes of --as-cluster-triangles " \
+        "each, while dynamic geometries are given per-model BLASes. Each " \
+        "approach has different performance and memory tradeoffs. auto " \
+        "picks one based on the scene, within --as-memory-budget.", \
         blas_strategy::STATIC_MERGED_DYNAMIC_PER_MODEL, \
         {"per-material", blas_strategy::PER_MATERIAL}, \
         {"per-model", blas_strategy::PER_MODEL}, \
         {"static-merged-dynamic-per-model", blas_strategy::STATIC_MERGED_DYNAMIC_PER_MODEL}, \
-        {"all-merged", blas_strategy::ALL_MERGED_STATIC} \
+        {"all-merged", blas_strategy::ALL_MERGED_STATIC}, \
+        {"clustered", blas_strategy::STATIC_CLUSTERED_DYNAMIC_PER_MODEL}, \
+        {"auto", blas_strategy::AUTO} \
+    ) \
+    TR_INT_OPT(as_memory_budget, \
+        "Estimated acceleration structure memory in megabytes that " \
+        "--as-strategy=auto tries to stay under.", \
+        1024, 1, INT_MAX \
+    ) \
+    TR_INT_OPT(as_cluster_triangles, \
+        "Target triangle count of each static BLAS with " \
+        "--as-strategy=clustered.", \
+        1000000, 1, INT_MAX \
     ) \
     TR_BOOL_OPT(silent, \
         "Disables general prints. Errors and timing data is still shown.", \
@@ -538,6 +553,73 @@
     TR_STRING_OPT(timing_output, \
         "Sets the timing data output file. Default is stdout.", \
         "" \
+    ) \
+    TR_STRING_OPT(shader_cache, \
+        "Directory for caching compiled shaders between runs. Disabled if " \
+        "empty.", \
+        "" \
+    ) \
+    TR_STRING_OPT(pipeline_cache, \
+        "Directory for caching Vulkan pipelines between runs, with a " \
+        "separate file for each GPU and driver. Disabled if empty.", \
+        "" \
+    ) \
+    TR_BOOL_OPT(compress_textures, \
+        "Block-compresses 8-bit glTF textures to reduce VRAM use: BC7 for " \
+        "color, BC5 for normal and metallic-roughness maps and BC4 for " \
+        "single-channel textures. Encoding is slow, so combine with " \
+        "--texture-cache.", \
+        false \
+    ) \
+    TR_STRING_OPT(texture_cache, \
+        "Directory for caching glTF textures between runs, with their " \
+        "precomputed mipmaps and compression. Disabled if empty.", \
+        "" \
+    ) \
+    TR_STRING_OPT(scene_cache, \
+        "Directory for caching processed glTF meshes and textures between " \
+        "runs. Later runs map the cache file instead of decoding the scene " \
+        "data again. Disabled if empty.", \
+        "" \
+    ) \
+    TR_BOOL_OPT(release_mesh_data, \
+        "Frees the CPU-side copies of static mesh data once it has been " \
+        "uploaded to the GPU, to reduce host memory use. Skinned meshes " \
+        "keep theirs.", \
+        false \
+    ) \
+    TR_INT_OPT(worker_threads, \
+        "Number of worker threads for CPU-side work, such as scene loading " \
+        "and per-frame scene updates. 0 uses one per hardware thread.", \
+        0, 0, INT_MAX \
+    ) \
+    TR_INT_OPT(frames_in_flight, \
+        "Number of frames that can be prepared on the CPU before waiting " \
+        "for the GPU to finish earlier ones. Higher values give more " \
+        "throughput at the cost of latency.", \
+        2, 1, MAX_FRAMES_IN_FLIGHT \
+    ) \
+    TR_BOOL_OPT(simulate_ahead, \
+        "Advances animations for the next frame while the current one is " \
+        "being submitted. Only applies to replays, where input latency " \
+        "doesn't matter.", \
+        false \
+    ) \
+    TR_INT_OPT(as_rebuild_interval, \
+        "Rebuilds dynamic acceleration structures after this many frames of " \
+        "refitting. 0 refits them forever.", \
+        0, 0, INT_MAX \
+    ) \
+    TR_FLOAT_OPT(as_rebuild_regression, \
+        "Rebuilds dynamic acceleration structures when ray tracing time has " \
+        "grown by this fraction since they were last rebuilt. 0 disables " \
+        "this.", \
+        0.0f, 0.0f, FLT_MAX \
+    ) \
+    TR_INT_OPT(as_rebuilds_per_frame, \
+        "Maximum number of acceleration structures rebuilt per frame by the " \
+        "above, the rest wait for later frames.", \
+        1, 1, INT_MAX \
     )
 //==============================================================================
 // END OF OPTIONS
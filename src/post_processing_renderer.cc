@@ -79,7 +79,7 @@ dependencies post_processing_renderer::get_gbuffer_write_dependencies() const
 {
     uint32_t swapchain_index, frame_index;
     dev->ctx->get_indices(swapchain_index, frame_index);
-    return delay_deps[(frame_index + 1) % MAX_FRAMES_IN_FLIGHT];
+    return delay_deps[(frame_index + 1) % dev->ctx->get_frames_in_flight()];
 }
 
 dependencies post_processing_renderer::render(dependencies deps)
@@ -275,7 +275,7 @@ void raster_pipeline::init_pipeline()
 
 void raster_pipeline::init_framebuffers()
 {
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         std::vector<vk::ImageView> fb_attachments;
 
@@ -26,8 +26,11 @@ struct push_constant_buffer
     pvec3 ambient_color;
 };
 
-raster_shader_sources load_sources(const raster_stage::options& opt, const gbuffer_target& gbuf)
-{
+raster_shader_sources load_sources(
+    device& dev,
+    const raster_stage::options& opt,
+    const gbuffer_target& gbuf
+){
     std::map<std::string, std::string> defines;
     defines["SH_ORDER"] = std::to_string(opt.sh_order);
     defines["SH_COEF_COUNT"] = std::to_string(
@@ -36,10 +39,12 @@ raster_shader_sources load_sources(const raster_stage::options& opt, const gbuff
     if(!opt.use_probe_visibility)
         defines["SH_INTERPOLATION_TRILINEAR"];
     gbuf.get_location_defines(defines);
-    return {
-        {"shader/forward.vert"},
-        {"shader/forward.frag", defines}
+    raster_shader_sources src = {
+        shader_source::deferred("shader/forward.vert"),
+        shader_source::deferred("shader/forward.frag", defines)
     };
+    compile_shaders(src, dev.ctx->get_thread_pool());
+    return src;
 }
 
 using color_attachment_state = raster_pipeline::pipeline_state::color_attachment_state;
@@ -152,7 +157,7 @@ raster_stage::raster_stage(
         array_pipelines.emplace_back(new raster_pipeline(dev, {
             target.get_size(),
             uvec4(0, 0, target.get_size()),
-            load_sources(opt, target),
+            load_sources(dev, opt, target),
             {
                 {"textures", (uint32_t)opt.max_samplers},
                 {"textures3d", (uint32_t)opt.max_3d_samplers},
@@ -196,7 +201,7 @@ void raster_stage::update(uint32_t)
         return;
 
     clear_commands();
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_graphics();
 
@@ -236,7 +241,7 @@ void raster_stage::update(uint32_t)
 
                 gfx->push_constants(cb, control);
 
-                cb.drawIndexed(m->get_indices().size(), 1, 0, 0, 0);
+                cb.drawIndexed(m->get_index_count(), 1, 0, 0, 0);
             }
             gfx->end_render_pass(cb);
         }
@@ -109,7 +109,7 @@ void rt_camera_stage::init_descriptors(basic_pipeline& pp)
 {
     rt_stage::init_descriptors(pp);
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         ss->bind(pp, i);
         pp.update_descriptor_set({
@@ -160,7 +160,7 @@ void rt_renderer<Pipeline>::set_device_workloads(const std::vector<double>& rati
             // that can actually accumulate samples normally when workload ratio
             // changes.
             per_device[i].ray_tracer->reset_accumulated_samples();
-            for(size_t j = 0; j < MAX_FRAMES_IN_FLIGHT; ++j)
+            for(size_t j = 0; j < ctx->get_frames_in_flight(); ++j)
                 prepare_transfers(false);
         }
     }
@@ -88,6 +88,7 @@ rt_stage::rt_stage(
     scene_state_counter(0),
     force_refresh(true)
 {
+    ss.add_trace_timer(timer_name);
 }
 
 void rt_stage::set_local_sampler_parameters(
@@ -144,7 +145,7 @@ void rt_stage::init_descriptors(basic_pipeline& pp)
         {"indices", opt.max_instances},
         {"textures", opt.max_samplers}
     });
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         pp.update_descriptor_set({
             {"sampling_data", {sampling_data[dev->id], 0, VK_WHOLE_SIZE}}
@@ -160,7 +161,7 @@ unsigned rt_stage::get_pass_count() const
 void rt_stage::record_command_buffers()
 {
     clear_commands();
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         size_t pass_count_left = pass_count;
         while(pass_count_left != 0)
@@ -16,19 +16,75 @@ sampler_table::sampler_table(device_mask dev, bool use_mipmaps)
 {
 }
 
-void sampler_table::update_scene(scene_stage* s)
+void sampler_table::update_scene(scene_stage* s, uint64_t frame_counter)
 {
     const std::vector<scene_stage::instance>& instances = s->get_instances();
+
+    // Ids and factors are compared against the previous ones, so that only
+    // materials that actually changed are reported as such.
+    std::unordered_map<const material*, material_entry> prev_entries;
+    for(const material_entry& entry: materials)
+        prev_entries[entry.mat] = entry;
+
     table.clear();
     index_counter = 0;
+    materials.clear();
+    instance_materials.resize(instances.size());
+    std::unordered_map<const material*, uint32_t> material_indices;
     for(size_t i = 0; i < instances.size(); ++i)
     {
-        const material& mat = *instances[i].mat;
-        register_tex_id(mat.albedo_tex);
-        register_tex_id(mat.metallic_roughness_tex);
-        register_tex_id(mat.normal_tex);
-        register_tex_id(mat.emission_tex);
+        const material* mat = instances[i].mat;
+        auto it = material_indices.find(mat);
+        if(it == material_indices.end())
+        {
+            it = material_indices.emplace(mat, materials.size()).first;
+            material_entry entry = {};
+            entry.mat = mat;
+            entry.factors = material_factors(*mat);
+            resolve_material(entry);
+
+            auto prev_it = prev_entries.find(mat);
+            if(
+                prev_it != prev_entries.end() &&
+                prev_it->second.factors == entry.factors &&
+                prev_it->second.ids.albedo == entry.ids.albedo &&
+                prev_it->second.ids.metallic_roughness == entry.ids.metallic_roughness &&
+                prev_it->second.ids.normal == entry.ids.normal &&
+                prev_it->second.ids.emission == entry.ids.emission
+            ) entry.ids.change_frame = prev_it->second.ids.change_frame;
+            else entry.ids.change_frame = frame_counter;
+            materials.push_back(entry);
+        }
+        instance_materials[i] = it->second;
+    }
+}
+
+bool sampler_table::refresh_materials(uint64_t frame_counter)
+{
+    int prev_index_counter = index_counter;
+    for(material_entry& entry: materials)
+    {
+        const material& mat = *entry.mat;
+        material_factors factors(mat);
+        if(!(entry.factors == factors))
+        {
+            entry.factors = factors;
+            entry.ids.change_frame = frame_counter;
+        }
+
+        if(
+            entry.albedo_tex == mat.albedo_tex &&
+            entry.metallic_roughness_tex == mat.metallic_roughness_tex &&
+            entry.normal_tex == mat.normal_tex &&
+            entry.emission_tex == mat.emission_tex
+        ) continue;
+
+        if(resolve_material(entry))
+            entry.ids.change_frame = frame_counter;
     }
+    // Textures that are no longer used stay in the table until the next
+    // update_scene(), which is harmless.
+    return index_counter != prev_index_counter;
 }
 
 std::vector<vk::DescriptorImageInfo> sampler_table::get_image_infos(device_id id) const
@@ -60,6 +116,48 @@ void sampler_table::register_tex_id(combined_tex_sampler cs)
     }
 }
 
+sampler_table::material_factors::material_factors(const material& mat)
+:   albedo(mat.albedo_factor), metallic(mat.metallic_factor),
+    roughness(mat.roughness_factor), normal(mat.normal_factor), ior(mat.ior),
+    emission(mat.emission_factor), transmittance(mat.transmittance),
+    double_sided(mat.double_sided)
+{
+}
+
+bool sampler_table::material_factors::operator==(
+    const material_factors& other
+) const {
+    return albedo == other.albedo && metallic == other.metallic &&
+        roughness == other.roughness && normal == other.normal &&
+        ior == other.ior && emission == other.emission &&
+        transmittance == other.transmittance &&
+        double_sided == other.double_sided;
+}
+
+bool sampler_table::resolve_material(material_entry& entry)
+{
+    const material& mat = *entry.mat;
+    entry.albedo_tex = mat.albedo_tex;
+    entry.metallic_roughness_tex = mat.metallic_roughness_tex;
+    entry.normal_tex = mat.normal_tex;
+    entry.emission_tex = mat.emission_tex;
+
+    register_tex_id(mat.albedo_tex);
+    register_tex_id(mat.metallic_roughness_tex);
+    register_tex_id(mat.normal_tex);
+    register_tex_id(mat.emission_tex);
+
+    material_tex_ids prev = entry.ids;
+    entry.ids.albedo = find_tex_id(mat.albedo_tex);
+    entry.ids.metallic_roughness = find_tex_id(mat.metallic_roughness_tex);
+    entry.ids.normal = find_tex_id(mat.normal_tex);
+    entry.ids.emission = find_tex_id(mat.emission_tex);
+    return prev.albedo != entry.ids.albedo ||
+        prev.metallic_roughness != entry.ids.metallic_roughness ||
+        prev.normal != entry.ids.normal ||
+        prev.emission != entry.ids.emission;
+}
+
 int sampler_table::find_tex_id(combined_tex_sampler cs)
 {
     if(cs.first)
@@ -74,4 +172,10 @@ int sampler_table::find_tex_id(combined_tex_sampler cs)
     else return -1;
 }
 
+const sampler_table::material_tex_ids& sampler_table::get_instance_tex_ids(
+    size_t instance_index
+) const {
+    return materials[instance_materials[instance_index]].ids;
+}
+
 }
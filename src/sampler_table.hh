@@ -20,14 +20,71 @@ class sampler_table
 public:
     sampler_table(device_mask dev, bool mipmap_default);
 
-    void update_scene(scene_stage* s);
+    // Texture ids of a material, resolved once per change instead of on
+    // every lookup.
+    struct material_tex_ids
+    {
+        int albedo;
+        int metallic_roughness;
+        int normal;
+        int emission;
+        // The frame on which any of the ids or the material's factors last
+        // changed, so that users can tell which of their cached copies are
+        // stale.
+        uint64_t change_frame;
+    };
+
+    // Rebuilds the whole table from the materials of the instances of the
+    // scene stage. Needs to be called when the instances change.
+    void update_scene(scene_stage* s, uint64_t frame_counter);
+    // Checks the materials seen by update_scene() for changed textures and
+    // factors. This is cheap enough to call on every frame. Returns true if
+    // new textures were added, meaning that get_image_infos() has changed.
+    bool refresh_materials(uint64_t frame_counter);
+
     std::vector<vk::DescriptorImageInfo> get_image_infos(device_id id) const;
     int find_tex_id(combined_tex_sampler cs);
+    // Indexed the same way as scene_stage::get_instances() was during the
+    // last update_scene().
+    const material_tex_ids& get_instance_tex_ids(size_t instance_index) const;
 
 private:
     void register_tex_id(combined_tex_sampler cs);
 
+    // The non-texture parts of a material that end up in the instance data.
+    struct material_factors
+    {
+        vec4 albedo;
+        float metallic;
+        float roughness;
+        float normal;
+        float ior;
+        vec3 emission;
+        float transmittance;
+        bool double_sided;
+
+        material_factors() = default;
+        material_factors(const material& mat);
+        bool operator==(const material_factors& other) const;
+    };
+
+    struct material_entry
+    {
+        const material* mat;
+        // The texture-sampler pairs that the ids were resolved from.
+        combined_tex_sampler albedo_tex;
+        combined_tex_sampler metallic_roughness_tex;
+        combined_tex_sampler normal_tex;
+        combined_tex_sampler emission_tex;
+        material_factors factors;
+        material_tex_ids ids;
+    };
+    // Returns true if the ids changed.
+    bool resolve_material(material_entry& entry);
+
     sampler default_sampler;
+    std::vector<material_entry> materials;
+    std::vector<uint32_t> instance_materials;
     int index_counter = 0;
     std::unordered_map<
         combined_tex_sampler, int, combined_tex_sampler_hash
@@ -5,6 +5,7 @@
 #include "sh_grid.hh"
 #include "shadow_map.hh"
 #include "environment_map.hh"
+#include "thread_pool.hh"
 #include <algorithm>
 #include <unordered_set>
 
@@ -210,6 +211,38 @@ sh_grid* get_largest_sh_grid(scene& s, int* index)
     return best != INVALID_ENTITY ? s.get<sh_grid>(best) : nullptr;
 }
 
+namespace
+{
+
+// Nodes per task when updating animations.
+constexpr size_t ANIMATION_CHUNK_SIZE = 128;
+
+// Animation controllers only modify their own node, so they can be updated in
+// any order.
+template<typename F>
+void foreach_animated(scene& s, thread_pool* pool, F&& f)
+{
+    if(!pool || s.count<animated>() <= ANIMATION_CHUNK_SIZE)
+    {
+        s.foreach([&](transformable& t, animated& a){ f(t, a); });
+        return;
+    }
+
+    std::vector<std::pair<transformable*, animated*>> nodes;
+    nodes.reserve(s.count<animated>());
+    s.foreach([&](transformable& t, animated& a){ nodes.push_back({&t, &a}); });
+
+    size_t chunk_count =
+        (nodes.size() + ANIMATION_CHUNK_SIZE - 1) / ANIMATION_CHUNK_SIZE;
+    pool->parallel_for(chunk_count, [&](size_t chunk){
+        size_t end = std::min((chunk+1) * ANIMATION_CHUNK_SIZE, nodes.size());
+        for(size_t i = chunk * ANIMATION_CHUNK_SIZE; i < end; ++i)
+            f(*nodes[i].first, *nodes[i].second);
+    }, "animation");
+}
+
+}
+
 void play(
     scene& s,
     const std::string& name,
@@ -223,14 +256,29 @@ void play(
     s.emit(animation_update_event{true, 0});
 }
 
-void update(scene& s, time_ticks dt, bool force_update)
+void update(scene& s, time_ticks dt, bool force_update, thread_pool* pool)
 {
-    s.foreach([&](camera& c){ c.step_jitter(); });
+    update_animations(s, dt, force_update, pool);
+    finish_update(s, dt);
+}
 
+void update_animations(
+    scene& s,
+    time_ticks dt,
+    bool force_update,
+    thread_pool* pool
+){
     if(dt > 0 || force_update)
     {
-        s.foreach([&](transformable& t, animated& a){ a.update(t, dt); });
+        foreach_animated(s, pool, [&](transformable& t, animated& a){
+            a.update(t, dt);
+        });
     }
+}
+
+void finish_update(scene& s, time_ticks dt)
+{
+    s.foreach([&](camera& c){ c.step_jitter(); });
     s.emit(animation_update_event{false, dt});
 }
 
@@ -243,9 +291,9 @@ bool is_playing(scene& s)
     return playing;
 }
 
-void set_animation_time(scene& s, time_ticks dt)
+void set_animation_time(scene& s, time_ticks dt, thread_pool* pool)
 {
-    s.foreach([&](transformable& t, animated& a){
+    foreach_animated(s, pool, [&](transformable& t, animated& a){
         if(!t.is_static())
         {
             a.restart();
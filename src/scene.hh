@@ -11,6 +11,7 @@ using namespace monkero;
 
 class environment_map;
 class sh_grid;
+class thread_pool;
 // Used for internal camera list reordering; it's needed for spatial
 // reprojection from sparsely rendered viewports.
 struct camera_metadata
@@ -61,9 +62,31 @@ void play(
     bool loop = false,
     bool use_fallback = false
 );
-void update(scene& s, time_ticks dt, bool force_update = false);
+// Animated nodes are updated in one batch, spread over the thread pool if one
+// is given.
+void update(
+    scene& s,
+    time_ticks dt,
+    bool force_update = false,
+    thread_pool* pool = nullptr
+);
+// update() is split into these two parts for callers that advance animations
+// on another thread. update_animations() only touches animated nodes, while
+// finish_update() steps camera jitter and emits animation_update_event, so
+// that subscribers are always called from the thread that calls it.
+void update_animations(
+    scene& s,
+    time_ticks dt,
+    bool force_update = false,
+    thread_pool* pool = nullptr
+);
+void finish_update(scene& s, time_ticks dt);
 bool is_playing(scene& s);
-void set_animation_time(scene& s, time_ticks dt);
+void set_animation_time(
+    scene& s,
+    time_ticks dt,
+    thread_pool* pool = nullptr
+);
 
 }
 
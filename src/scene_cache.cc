@@ -0,0 +1,593 @@
+#include "scene_cache.hh"
+#include "misc.hh"
+#include "log.hh"
+#include <filesystem>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+namespace fs = std::filesystem;
+
+namespace
+{
+using namespace tr;
+
+// Bump this whenever the layout or the cached data changes, e.g. due to mesh
+// or texture processing changes in the loaders.
+constexpr uint32_t SCENE_CACHE_VERSION = 3;
+constexpr uint32_t SCENE_CACHE_MAGIC = 0x43535254; // "TRSC"
+// Blobs are aligned so that the mapped arrays can be read directly.
+constexpr uint64_t BLOB_ALIGNMENT = 16;
+
+struct file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    // The vertex formats are raw structs, so their sizes are part of the
+    // version.
+    uint32_t vertex_size;
+    uint32_t skin_size;
+    uint64_t texture_count;
+    uint64_t mesh_count;
+    uint64_t dependency_count;
+    uint64_t data_count;
+    uint64_t table_offset;
+    uint64_t file_size;
+};
+
+struct texture_entry
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t fmt;
+    uint32_t mip_levels;
+    uint32_t opaque;
+    uint32_t components[4];
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct mesh_entry
+{
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t skin_count;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint64_t skin_offset;
+};
+
+struct dependency_entry
+{
+    uint64_t path_offset;
+    uint64_t path_size;
+    uint64_t stamp[2];
+};
+
+struct data_entry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+bool in_range(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+// The size and modification time of the file.
+bool get_file_stamp(const fs::path& path, uint64_t stamp[2])
+{
+    std::error_code ec;
+    uint64_t file_size = fs::file_size(path, ec);
+    if(ec) return false;
+    auto mtime = fs::last_write_time(path, ec);
+    if(ec) return false;
+
+    stamp[0] = file_size;
+    stamp[1] = mtime.time_since_epoch().count();
+    return true;
+}
+
+// Checks that the texture data matches its format and size, such that the
+// upload cannot read past the blob.
+bool is_texture_entry_valid(const texture_entry& e, uint64_t file_size)
+{
+    if(
+        e.width == 0 || e.height == 0 || e.mip_levels == 0 ||
+        e.mip_levels > calculate_mipmap_count(uvec2(e.width, e.height)) ||
+        !in_range(e.offset, e.size, file_size)
+    ) return false;
+
+    uint32_t block_size, block_width, block_height;
+    try
+    {
+        get_format_block_info(
+            vk::Format(e.fmt), block_size, block_width, block_height
+        );
+    }
+    catch(const std::runtime_error&)
+    {
+        return false;
+    }
+
+    // Only the last level may lack its alignment padding.
+    vk::Extent3D extent(e.width, e.height, 1);
+    std::vector<size_t> offsets = get_mip_level_offsets(
+        vk::Format(e.fmt), extent, e.mip_levels
+    );
+    uint32_t last = e.mip_levels - 1;
+    uint64_t w = std::max(e.width >> last, 1u);
+    uint64_t h = std::max(e.height >> last, 1u);
+    uint64_t last_size = (w + block_width - 1) / block_width *
+        ((h + block_height - 1) / block_height) * block_size;
+    return e.size >= offsets[last] + last_size && e.size <= offsets.back();
+}
+
+template<typename T>
+T read_entry(const uint8_t* table, size_t index)
+{
+    T entry;
+    memcpy(&entry, table + index * sizeof(T), sizeof(T));
+    return entry;
+}
+
+template<typename T>
+void append_entry(std::vector<uint8_t>& table, const T& entry)
+{
+    const uint8_t* bytes = (const uint8_t*)&entry;
+    table.insert(table.end(), bytes, bytes + sizeof(T));
+}
+
+}
+
+namespace tr
+{
+
+std::string get_scene_cache_path(
+    const std::string& cache_dir,
+    const std::string& scene_path,
+    uint64_t flags
+){
+    std::error_code ec;
+    fs::path abs_path = fs::absolute(scene_path, ec);
+    if(ec) return "";
+
+    std::string path_str = abs_path.string();
+    uint64_t stamp[2];
+    if(!get_file_stamp(abs_path, stamp))
+        return "";
+    uint64_t hash = hash_data(path_str.data(), path_str.size());
+    hash = hash_data(stamp, sizeof(stamp), hash);
+
+    uint64_t params[4] = {
+        flags, SCENE_CACHE_VERSION, sizeof(mesh::vertex),
+        sizeof(mesh::skin_data)
+    };
+    hash = hash_data(params, sizeof(params), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.trscene", (unsigned long long)hash);
+    return (fs::path(cache_dir) / name).string();
+}
+
+scene_cache_reader::scene_cache_reader()
+:   data(nullptr), size(0), texture_count(0), mesh_count(0),
+    dependency_count(0), data_count(0)
+#ifdef _WIN32
+, file_handle(nullptr), mapping_handle(nullptr)
+#endif
+{
+}
+
+scene_cache_reader::~scene_cache_reader()
+{
+    close();
+}
+
+bool scene_cache_reader::open(const std::string& path)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr
+    );
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+    file_handle = file;
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    size = file_size.QuadPart;
+
+    mapping_handle = CreateFileMappingA(
+        file, nullptr, PAGE_READONLY, 0, 0, nullptr
+    );
+    if(!mapping_handle)
+    {
+        close();
+        return false;
+    }
+    data = (const uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if(!data)
+    {
+        close();
+        return false;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the descriptor.
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        size = 0;
+        return false;
+    }
+    data = (const uint8_t*)mapping;
+    // Everything gets uploaded front to back.
+    madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+
+    file_header header;
+    if(size < sizeof(header))
+    {
+        close();
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if(
+        header.magic != SCENE_CACHE_MAGIC ||
+        header.version != SCENE_CACHE_VERSION ||
+        header.vertex_size != sizeof(mesh::vertex) ||
+        header.skin_size != sizeof(mesh::skin_data) ||
+        header.file_size != size ||
+        header.texture_count > size / sizeof(texture_entry) ||
+        header.mesh_count > size / sizeof(mesh_entry) ||
+        header.dependency_count > size / sizeof(dependency_entry) ||
+        header.data_count > size / sizeof(data_entry) ||
+        !in_range(
+            header.table_offset,
+            header.texture_count * sizeof(texture_entry) +
+            header.mesh_count * sizeof(mesh_entry) +
+            header.dependency_count * sizeof(dependency_entry) +
+            header.data_count * sizeof(data_entry),
+            size
+        )
+    ){
+        close();
+        return false;
+    }
+    texture_count = header.texture_count;
+    mesh_count = header.mesh_count;
+    dependency_count = header.dependency_count;
+    data_count = header.data_count;
+
+    // Validate all entries now, so that reading them later cannot fail.
+    const uint8_t* texture_table = data + header.table_offset;
+    for(size_t i = 0; i < texture_count; ++i)
+    {
+        texture_entry e = read_entry<texture_entry>(texture_table, i);
+        if(!is_texture_entry_valid(e, size))
+        {
+            close();
+            return false;
+        }
+    }
+    const uint8_t* mesh_table =
+        texture_table + texture_count * sizeof(texture_entry);
+    for(size_t i = 0; i < mesh_count; ++i)
+    {
+        mesh_entry e = read_entry<mesh_entry>(mesh_table, i);
+        if(
+            e.vertex_count > size / sizeof(mesh::vertex) ||
+            e.index_count > size / sizeof(uint32_t) ||
+            e.skin_count > size / sizeof(mesh::skin_data) ||
+            !in_range(e.vertex_offset, e.vertex_count * sizeof(mesh::vertex), size) ||
+            !in_range(e.index_offset, e.index_count * sizeof(uint32_t), size) ||
+            !in_range(e.skin_offset, e.skin_count * sizeof(mesh::skin_data), size)
+        ){
+            close();
+            return false;
+        }
+    }
+    const uint8_t* dependency_table =
+        mesh_table + mesh_count * sizeof(mesh_entry);
+    for(size_t i = 0; i < dependency_count; ++i)
+    {
+        dependency_entry e = read_entry<dependency_entry>(dependency_table, i);
+        uint64_t stamp[2];
+        if(
+            !in_range(e.path_offset, e.path_size, size) ||
+            !get_file_stamp(
+                std::string((const char*)data + e.path_offset, e.path_size),
+                stamp
+            ) ||
+            stamp[0] != e.stamp[0] || stamp[1] != e.stamp[1]
+        ){
+            close();
+            return false;
+        }
+    }
+    const uint8_t* data_table =
+        dependency_table + dependency_count * sizeof(dependency_entry);
+    for(size_t i = 0; i < data_count; ++i)
+    {
+        data_entry e = read_entry<data_entry>(data_table, i);
+        if(!in_range(e.offset, e.size, size))
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void scene_cache_reader::close()
+{
+#ifdef _WIN32
+    if(data) UnmapViewOfFile(data);
+    if(mapping_handle) CloseHandle(mapping_handle);
+    if(file_handle) CloseHandle(file_handle);
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+#else
+    if(data) munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+    texture_count = 0;
+    mesh_count = 0;
+    dependency_count = 0;
+    data_count = 0;
+}
+
+size_t scene_cache_reader::get_texture_count() const
+{
+    return texture_count;
+}
+
+size_t scene_cache_reader::get_mesh_count() const
+{
+    return mesh_count;
+}
+
+size_t scene_cache_reader::get_data_count() const
+{
+    return data_count;
+}
+
+texture* scene_cache_reader::create_texture(device_mask dev, size_t index) const
+{
+    file_header header;
+    memcpy(&header, data, sizeof(header));
+    texture_entry e = read_entry<texture_entry>(
+        data + header.table_offset, index
+    );
+
+    texture::decoded_image img;
+    img.size = uvec2(e.width, e.height);
+    img.fmt = vk::Format(e.fmt);
+    img.mip_levels = e.mip_levels;
+    img.opaque = e.opaque;
+    img.components = {
+        vk::ComponentSwizzle(e.components[0]),
+        vk::ComponentSwizzle(e.components[1]),
+        vk::ComponentSwizzle(e.components[2]),
+        vk::ComponentSwizzle(e.components[3])
+    };
+    return new texture(dev, img, data + e.offset, e.size);
+}
+
+void scene_cache_reader::load_mesh(size_t index, mesh& m) const
+{
+    file_header header;
+    memcpy(&header, data, sizeof(header));
+    mesh_entry e = read_entry<mesh_entry>(
+        data + header.table_offset + texture_count * sizeof(texture_entry),
+        index
+    );
+
+    // Blobs are aligned, so the arrays can be used in place.
+    m.load_buffers(
+        (const mesh::vertex*)(data + e.vertex_offset), e.vertex_count,
+        (const uint32_t*)(data + e.index_offset), e.index_count,
+        (const mesh::skin_data*)(data + e.skin_offset), e.skin_count
+    );
+}
+
+const uint8_t* scene_cache_reader::get_data(
+    size_t index,
+    size_t& data_size
+) const
+{
+    file_header header;
+    memcpy(&header, data, sizeof(header));
+    data_entry e = read_entry<data_entry>(
+        data + header.table_offset + texture_count * sizeof(texture_entry) +
+        mesh_count * sizeof(mesh_entry) +
+        dependency_count * sizeof(dependency_entry),
+        index
+    );
+    data_size = e.size;
+    return data + e.offset;
+}
+
+scene_cache_writer::scene_cache_writer(const std::string& path)
+:   path(path), tmp_path(path + ".tmp" + std::to_string(std::random_device()())),
+    f(nullptr), offset(0)
+{
+    f = fopen(tmp_path.c_str(), "wb");
+    if(!f)
+    {
+        TR_WARN("Failed to create scene cache file ", tmp_path);
+        return;
+    }
+
+    // The real header is written in finish().
+    file_header header = {};
+    if(fwrite(&header, sizeof(header), 1, f) != 1)
+        fail();
+    offset = sizeof(header);
+}
+
+scene_cache_writer::~scene_cache_writer()
+{
+    fail();
+}
+
+void scene_cache_writer::add_dependency(const std::string& dep_path)
+{
+    dependency_entry e;
+    if(!get_file_stamp(dep_path, e.stamp))
+    {
+        // The cache could never be validated.
+        fail();
+        return;
+    }
+    e.path_size = dep_path.size();
+    e.path_offset = write_blob(dep_path.data(), dep_path.size());
+    append_entry(dependency_table, e);
+}
+
+void scene_cache_writer::add_texture(const texture::decoded_image& img)
+{
+    texture_entry e = {
+        img.size.x, img.size.y, (uint32_t)img.fmt, img.mip_levels, img.opaque,
+        {
+            (uint32_t)img.components.r, (uint32_t)img.components.g,
+            (uint32_t)img.components.b, (uint32_t)img.components.a
+        },
+        write_blob(img.pixels.data(), img.pixels.size()),
+        img.pixels.size()
+    };
+    append_entry(texture_table, e);
+}
+
+void scene_cache_writer::add_mesh(const mesh& m)
+{
+    const std::vector<mesh::vertex>& vertices = m.get_vertices();
+    const std::vector<uint32_t>& indices = m.get_indices();
+    const std::vector<mesh::skin_data>& skin = m.get_skin();
+    mesh_entry e;
+    e.vertex_count = vertices.size();
+    e.index_count = indices.size();
+    e.skin_count = skin.size();
+    e.vertex_offset = write_blob(vertices.data(), vertices.size() * sizeof(mesh::vertex));
+    e.index_offset = write_blob(indices.data(), indices.size() * sizeof(uint32_t));
+    e.skin_offset = write_blob(skin.data(), skin.size() * sizeof(mesh::skin_data));
+    append_entry(mesh_table, e);
+}
+
+void scene_cache_writer::add_data(const void* data, size_t data_size)
+{
+    data_entry e;
+    e.size = data_size;
+    e.offset = write_blob(data, data_size);
+    append_entry(data_table, e);
+}
+
+bool scene_cache_writer::finish()
+{
+    if(!f) return false;
+
+    file_header header;
+    header.magic = SCENE_CACHE_MAGIC;
+    header.version = SCENE_CACHE_VERSION;
+    header.vertex_size = sizeof(mesh::vertex);
+    header.skin_size = sizeof(mesh::skin_data);
+    header.texture_count = texture_table.size() / sizeof(texture_entry);
+    header.mesh_count = mesh_table.size() / sizeof(mesh_entry);
+    header.dependency_count = dependency_table.size() / sizeof(dependency_entry);
+    header.data_count = data_table.size() / sizeof(data_entry);
+    // The tables are read back to back, so they must go in a single blob to
+    // avoid alignment padding in between.
+    std::vector<uint8_t> tables = std::move(texture_table);
+    tables.insert(tables.end(), mesh_table.begin(), mesh_table.end());
+    tables.insert(tables.end(), dependency_table.begin(), dependency_table.end());
+    tables.insert(tables.end(), data_table.begin(), data_table.end());
+    header.table_offset = write_blob(tables.data(), tables.size());
+    header.file_size = offset;
+
+    if(
+        !f || fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, f) != 1
+    ){
+        fail();
+        return false;
+    }
+
+    bool success = fclose(f) == 0;
+    f = nullptr;
+    std::error_code ec;
+    if(success)
+        fs::rename(tmp_path, path, ec);
+    if(!success || ec)
+    {
+        fs::remove(tmp_path, ec);
+        TR_WARN("Failed to write scene cache file ", path);
+        return false;
+    }
+    return true;
+}
+
+uint64_t scene_cache_writer::write_blob(const void* data, size_t size)
+{
+    if(!f) return 0;
+
+    static const uint8_t padding[BLOB_ALIGNMENT] = {};
+    uint64_t pad = (BLOB_ALIGNMENT - offset % BLOB_ALIGNMENT) % BLOB_ALIGNMENT;
+    if(pad != 0 && fwrite(padding, 1, pad, f) != pad)
+    {
+        fail();
+        return 0;
+    }
+    offset += pad;
+
+    uint64_t blob_offset = offset;
+    if(size != 0 && fwrite(data, 1, size, f) != size)
+    {
+        fail();
+        return 0;
+    }
+    offset += size;
+    return blob_offset;
+}
+
+void scene_cache_writer::fail()
+{
+    if(!f) return;
+    fclose(f);
+    f = nullptr;
+    std::error_code ec;
+    fs::remove(tmp_path, ec);
+}
+
+}
@@ -0,0 +1,102 @@
+#ifndef TAURAY_SCENE_CACHE_HH
+#define TAURAY_SCENE_CACHE_HH
+#include "mesh.hh"
+#include "texture.hh"
+#include <cstdio>
+
+namespace tr
+{
+
+// Tauray's own binary format for the heavy parts of a loaded scene: textures
+// after decoding, mipmapping and compression, and the final vertex, index and
+// skin arrays of each mesh. The scene graph, materials and animations are
+// cheap to parse, so they still come from the original file. Loaders can also
+// store raw data blobs, so that they don't need the source file's binary data
+// at all on a cache hit.
+//
+// Cache files are keyed by the source file's path, size and modification time
+// along with any loader flags that change the cached data, see
+// get_scene_cache_path(). The external files that the scene references are
+// recorded in the cache file and checked when opening it.
+
+// Returns the path of the cache file for the given scene file, or an empty
+// string if the scene file doesn't exist. This only looks at the file's
+// metadata, so it can be called before parsing the file.
+std::string get_scene_cache_path(
+    const std::string& cache_dir,
+    const std::string& scene_path,
+    uint64_t flags
+);
+
+// Memory-mapped, read-only view of a scene cache file.
+class scene_cache_reader
+{
+public:
+    scene_cache_reader();
+    scene_cache_reader(const scene_cache_reader& other) = delete;
+    ~scene_cache_reader();
+
+    // Returns false if the file is missing, from an older version, out of
+    // date with its dependencies or otherwise broken.
+    bool open(const std::string& path);
+    void close();
+
+    size_t get_texture_count() const;
+    size_t get_mesh_count() const;
+    size_t get_data_count() const;
+
+    // These upload straight from the mapping, so the cached data is never
+    // copied into intermediate host memory.
+    texture* create_texture(device_mask dev, size_t index) const;
+    void load_mesh(size_t index, mesh& m) const;
+    // The returned pointer stays valid until the reader is closed.
+    const uint8_t* get_data(size_t index, size_t& data_size) const;
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t texture_count;
+    size_t mesh_count;
+    size_t dependency_count;
+    size_t data_count;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+};
+
+// Streams data into a new scene cache file. The file only appears at the
+// given path once finish() succeeds, so partially written caches are never
+// read.
+class scene_cache_writer
+{
+public:
+    scene_cache_writer(const std::string& path);
+    scene_cache_writer(const scene_cache_writer& other) = delete;
+    ~scene_cache_writer();
+
+    // The cache becomes stale when the given file changes.
+    void add_dependency(const std::string& dep_path);
+    void add_texture(const texture::decoded_image& img);
+    void add_mesh(const mesh& m);
+    void add_data(const void* data, size_t data_size);
+    bool finish();
+
+private:
+    uint64_t write_blob(const void* data, size_t size);
+    void fail();
+
+    std::string path;
+    std::string tmp_path;
+    FILE* f;
+    uint64_t offset;
+    // Entries are collected here and written at the end of the file.
+    std::vector<uint8_t> texture_table;
+    std::vector<uint8_t> mesh_table;
+    std::vector<uint8_t> dependency_table;
+    std::vector<uint8_t> data_table;
+};
+
+}
+
+#endif
@@ -6,6 +6,9 @@
 #include "light.hh"
 #include "misc.hh"
 #include "log.hh"
+#include <deque>
+#include <algorithm>
+#include <unordered_set>
 
 namespace
 {
@@ -19,7 +22,7 @@ struct material_buffer
     float transmittance;
     float ior;
     float normal_factor;
-    float pad[1];
+    int normal_two_channel;
     int albedo_tex_id;
     int metallic_roughness_tex_id;
     int normal_tex_id;
@@ -199,6 +202,17 @@ const quat face_orientations[6] = {
     glm::quatLookAt(vec3(0,0,1), vec3(0,1,0))
 };
 
+// Instances per task when filling the instance buffer.
+constexpr size_t INSTANCE_CHUNK_SIZE = 256;
+
+// Rough size of a BLAS per triangle, only used for estimating memory usage
+// in blas_strategy::AUTO. The layout is driver-specific, but compacted
+// triangle BVHs generally land somewhere around 40-100 bytes per triangle,
+// and static BLASes are compacted here. Being off by a constant factor doesn't
+// change how the candidates rank against each other, only how they compare
+// to options::as_memory_budget.
+constexpr uint64_t BLAS_BYTES_PER_TRIANGLE = 64;
+
 vec2 align_cascade(vec2 offset, vec2 area, float scale, uvec2 resolution)
 {
     vec2 cascade_step_size = (area*scale)/vec2(resolution);
@@ -213,6 +227,8 @@ namespace tr
 scene_stage::scene_stage(device_mask dev, const options& opt)
 :   multi_device_stage(dev),
     prev_was_rebuild(false),
+    as_instance_count(0),
+    tlas_instances_outdated(true),
     envmap_change_counter(1),
     geometry_change_counter(1),
     light_change_counter(1),
@@ -220,6 +236,10 @@ scene_stage::scene_stage(device_mask dev, const options& opt)
     lights_outdated(true),
     force_instance_refresh_frames(0),
     cur_scene(nullptr),
+    instance_sources_outdated(true),
+    static_change_counter(0),
+    model_change_counter(0),
+    mesh_id_counter(0),
     envmap(nullptr),
     ambient(0),
     pre_transformed_vertices(dev),
@@ -267,6 +287,10 @@ scene_stage::scene_stage(device_mask dev, const options& opt)
         true,
         false
     ),
+    trace_time_baseline(0.0f),
+    trace_time_baseline_frame(0),
+    as_rebuild_requested(false),
+    as_rebuild_request_frame(0),
     skinning(dev, compute_pipeline::params{{"shader/skinning.comp"}, {}, 1, true}),
     extract_tri_lights(dev, compute_pipeline::params{
         {"shader/extract_tri_lights.comp", opt.pre_transform_vertices ?
@@ -297,6 +321,7 @@ scene_stage::scene_stage(device_mask dev, const options& opt)
 
     if(dev.get_context()->is_ray_tracing_supported())
     {
+        as_scratch.emplace(dev);
         tlas.emplace(dev, opt.max_instances);
 
         if(opt.max_lights > 0)
@@ -324,8 +349,8 @@ void scene_stage::set_scene(scene* target)
 {
     cur_scene = target;
 
-    events[0].emplace(target->subscribe([this](scene&, const add_component<model>&){ geometry_outdated = true; }));
-    events[1].emplace(target->subscribe([this](scene&, const remove_component<model>&){ geometry_outdated = true; }));
+    events[0].emplace(target->subscribe([this](scene&, const add_component<model>&){ geometry_outdated = true; instance_sources_outdated = true; }));
+    events[1].emplace(target->subscribe([this](scene&, const remove_component<model>&){ geometry_outdated = true; instance_sources_outdated = true; }));
     events[2].emplace(target->subscribe([this](scene&, const add_component<point_light>&){ lights_outdated = true; }));
     events[3].emplace(target->subscribe([this](scene&, const remove_component<point_light>&){ lights_outdated = true; }));
     events[4].emplace(target->subscribe([this](scene&, const add_component<directional_light>&){ lights_outdated = true; }));
@@ -334,15 +359,20 @@ void scene_stage::set_scene(scene* target)
     events[7].emplace(target->subscribe([this](scene&, const remove_component<spotlight>&){ lights_outdated = true; }));
     events[8].emplace(target->subscribe([this](scene&, const add_component<sh_grid>&){ lights_outdated = true; }));
     events[9].emplace(target->subscribe([this](scene&, const remove_component<sh_grid>&){ lights_outdated = true; }));
+    events[10].emplace(target->subscribe([this](scene&, const add_component<transformable>&){ instance_sources_outdated = true; }));
+    events[11].emplace(target->subscribe([this](scene&, const remove_component<transformable>&){ instance_sources_outdated = true; }));
 
     prev_was_rebuild = false;
-    force_instance_refresh_frames = MAX_FRAMES_IN_FLIGHT;
+    tlas_instances_outdated = true;
+    group_strategy = opt.group_strategy;
+    force_instance_refresh_frames = get_context()->get_frames_in_flight();
 
     envmap_change_counter++;
     geometry_change_counter++;
     light_change_counter++;
     geometry_outdated = true;
     lights_outdated = true;
+    instance_sources_outdated = true;
 }
 
 scene* scene_stage::get_scene() const
@@ -395,6 +425,12 @@ vk::AccelerationStructureKHR scene_stage::get_acceleration_structure(
     return *tlas->get_tlas_handle(id);
 }
 
+void scene_stage::add_trace_timer(const std::string& name)
+{
+    if(std::find(trace_timers.begin(), trace_timers.end(), name) == trace_timers.end())
+        trace_timers.push_back(name);
+}
+
 vec2 scene_stage::get_shadow_map_atlas_pixel_margin() const
 {
     if(shadow_atlas)
@@ -589,98 +625,105 @@ int scene_stage::get_shadow_map_index(const light* l)
 bool scene_stage::refresh_instance_cache()
 {
     uint64_t frame_counter = get_context()->get_frame_counter();
-    size_t i = 0;
-    entity last_object_id = INVALID_ENTITY;
-    group_cache.clear();
     bool scene_changed = false;
 
+    // Inactive sources are never revisited, so they're only checked when
+    // something may have changed in any scene.
+    uint64_t static_changes = transformable::get_static_change_counter();
+    uint64_t model_changes = model::get_change_counter();
+    uint64_t mesh_ids = mesh::get_id_counter();
+    if(
+        static_changes != static_change_counter ||
+        model_changes != model_change_counter ||
+        mesh_ids != mesh_id_counter
+    ){
+        static_change_counter = static_changes;
+        model_change_counter = model_changes;
+        mesh_id_counter = mesh_ids;
+        if(!instance_sources_outdated && instance_sources_changed())
+            instance_sources_outdated = true;
+    }
+
+    // Without structural changes, only objects that can move or were just
+    // changed need to be looked at. Static scenes skip all of this.
+    if(!instance_sources_outdated)
+    {
+        bool valid = true;
+        size_t kept = 0;
+        for(size_t index: active_instance_sources)
+        {
+            instance_source& src = instance_sources[index];
+            if(!refresh_instance_source(src, frame_counter, false, scene_changed))
+            {
+                valid = false;
+                break;
+            }
+            if(!src.t->is_static() || src.last_refresh_frame >= frame_counter)
+                active_instance_sources[kept++] = index;
+        }
+        if(valid)
+        {
+            active_instance_sources.resize(kept);
+            if(scene_changed)
+                ensure_blas();
+            return scene_changed;
+        }
+    }
+
+    // Stays AUTO while the scene is empty, so that the choice is made once
+    // there is something to base it on.
+    if(group_strategy == blas_strategy::AUTO)
+        group_strategy = choose_blas_strategy();
+
+    size_t i = 0;
+    entity last_object_id = INVALID_ENTITY;
+    std::vector<instance_group> prev_group_cache;
+    prev_group_cache.swap(group_cache);
+    instance_sources.clear();
+    active_instance_sources.clear();
+
+    auto add_source = [&](
+        entity id, transformable& t, model& mod,
+        bool static_mesh, bool static_transformable
+    ){
+        instance_source src;
+        src.id = id;
+        src.t = &t;
+        src.transform_index = transforms.get_index(&t);
+        src.mod = &mod;
+        src.first_instance = i;
+        src.instance_count = 0;
+        src.static_mesh = static_mesh;
+        src.static_transformable = static_transformable;
+        src.model_revision = mod.get_revision();
+        src.last_refresh_frame = 0;
+        refresh_instance_source(src, frame_counter, true, scene_changed);
+        assign_instance_groups(src, last_object_id);
+        i += src.instance_count;
+
+        // Sources without instances are kept too, so that vertex groups
+        // being added to their models are noticed.
+        if(
+            src.instance_count != 0 &&
+            (!t.is_static() || src.last_refresh_frame >= frame_counter)
+        ) active_instance_sources.push_back(instance_sources.size());
+        instance_sources.push_back(src);
+    };
     auto add_instances = [&](bool static_mesh, bool static_transformable){
         cur_scene->foreach([&](entity id, transformable& t, model& mod){
             // If requesting dynamic meshes, we don't care about the
             // transformable staticness any more.
             if(static_mesh && static_transformable != t.is_static())
                 return;
-
-            bool fetched_transforms = false;
-            mat4 transform;
-            mat4 normal_transform;
-            for(const auto& vg: mod)
-            {
-                bool is_static = !vg.m->is_skinned() && !vg.m->get_animation_source();
-                if(static_mesh != is_static)
-                    continue;
-
-                if(i == instances.size())
-                {
-                    instances.push_back({
-                        mat4(0),
-                        mat4(0),
-                        mat4(0),
-                        nullptr,
-                        nullptr,
-                        nullptr,
-                        frame_counter
-                    });
-                    scene_changed = true;
-                }
-                instance& inst = instances[i];
-
-                assign_group_cache(
-                    vg.m->get_id(),
-                    static_mesh,
-                    static_transformable,
-                    id,
-                    last_object_id
-                );
-
-                if(inst.mat != &vg.mat)
-                {
-                    inst.mat = &vg.mat;
-                    inst.prev_transform = mat4(0);
-                    inst.last_refresh_frame = frame_counter;
-                    scene_changed = true;
-                }
-                if(inst.m != vg.m)
-                {
-                    inst.m = vg.m;
-                    inst.prev_transform = mat4(0);
-                    inst.last_refresh_frame = frame_counter;
-                    scene_changed = true;
-                }
-                if(inst.mod != &mod)
-                {
-                    inst.mod = &mod;
-                    inst.prev_transform = mat4(0);
-                    inst.last_refresh_frame = frame_counter;
-                    scene_changed = true;
-                }
-
-                if(inst.last_refresh_frame+1 >= frame_counter || !t.is_static())
-                {
-                    if(!fetched_transforms)
-                    {
-                        transform = t.get_global_transform();
-                        normal_transform = t.get_global_inverse_transpose_transform();
-                        fetched_transforms = true;
-                    }
-
-                    if(inst.prev_transform != inst.transform)
-                    {
-                        inst.prev_transform = inst.transform;
-                        inst.last_refresh_frame = frame_counter;
-                    }
-                    if(inst.transform != transform)
-                    {
-                        inst.transform = transform;
-                        inst.normal_transform = normal_transform;
-                        inst.last_refresh_frame = frame_counter;
-                    }
-                }
-                ++i;
-            }
+            add_source(id, t, mod, static_mesh, static_transformable);
         });
     };
-    add_instances(true, true);
+    if(group_strategy == blas_strategy::STATIC_CLUSTERED_DYNAMIC_PER_MODEL)
+    {
+        for(const static_object& obj: get_static_objects_in_morton_order())
+            add_source(obj.id, *obj.t, *obj.mod, true, true);
+    }
+    else add_instances(true, true);
     add_instances(true, false);
     add_instances(false, false);
     if(instances.size() > i)
@@ -688,19 +731,229 @@ bool scene_stage::refresh_instance_cache()
         instances.resize(i);
         scene_changed = true;
     }
+    // The same instances can still be grouped differently, e.g. when an
+    // object stops being static.
+    if(
+        group_cache.size() != prev_group_cache.size() ||
+        !std::equal(
+            group_cache.begin(), group_cache.end(), prev_group_cache.begin(),
+            [](const instance_group& a, const instance_group& b){
+                return a.id == b.id && a.size == b.size;
+            }
+        )
+    ) scene_changed = true;
+    instance_sources_outdated = false;
     if(scene_changed)
         ensure_blas();
     return scene_changed;
 }
 
+bool scene_stage::instance_sources_changed() const
+{
+    for(const instance_source& src: instance_sources)
+    {
+        if(
+            (src.static_mesh && src.static_transformable != src.t->is_static()) ||
+            src.model_revision != src.mod->get_revision()
+        ) return true;
+
+        for(size_t i = 0; i < src.instance_count; ++i)
+        {
+            const instance& inst = instances[src.first_instance + i];
+            if(inst.mesh_id != inst.m->get_id())
+                return true;
+        }
+    }
+    return false;
+}
+
+bool scene_stage::refresh_instance_source(
+    instance_source& src,
+    uint64_t frame_counter,
+    bool building,
+    bool& scene_changed
+){
+    transformable& t = *src.t;
+    if(
+        !building && src.static_mesh &&
+        src.static_transformable != t.is_static()
+    ) return false;
+
+    size_t i = src.first_instance;
+    size_t end = src.first_instance + src.instance_count;
+    src.last_refresh_frame = 0;
+    bool fetched_transforms = false;
+    mat4 transform;
+    mat4 normal_transform;
+    for(const auto& vg: *src.mod)
+    {
+        bool is_static = !vg.m->is_skinned() && !vg.m->get_animation_source();
+        if(src.static_mesh != is_static)
+            continue;
+
+        if(building)
+        {
+            if(i == instances.size())
+            {
+                instances.push_back({
+                    mat4(0),
+                    mat4(0),
+                    mat4(0),
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    0,
+                    frame_counter
+                });
+                scene_changed = true;
+            }
+        }
+        // Changed meshes can affect grouping, so they need a full rebuild.
+        else if(
+            i == end || instances[i].m != vg.m ||
+            instances[i].mesh_id != vg.m->get_id()
+        ) return false;
+
+        instance& inst = instances[i];
+        if(inst.mat != &vg.mat)
+        {
+            inst.mat = &vg.mat;
+            inst.prev_transform = mat4(0);
+            inst.last_refresh_frame = frame_counter;
+            scene_changed = true;
+        }
+        if(inst.m != vg.m)
+        {
+            inst.m = vg.m;
+            inst.prev_transform = mat4(0);
+            inst.last_refresh_frame = frame_counter;
+            scene_changed = true;
+        }
+        if(inst.mod != src.mod)
+        {
+            inst.mod = src.mod;
+            inst.prev_transform = mat4(0);
+            inst.last_refresh_frame = frame_counter;
+            scene_changed = true;
+        }
+        inst.mesh_id = vg.m->get_id();
+
+        if(inst.last_refresh_frame+1 >= frame_counter || !t.is_static())
+        {
+            if(!fetched_transforms)
+            {
+                transform = transforms.get_global_transform(
+                    src.transform_index
+                );
+                normal_transform =
+                    transforms.get_global_inverse_transpose_transform(
+                        src.transform_index
+                    );
+                fetched_transforms = true;
+            }
+
+            if(inst.prev_transform != inst.transform)
+            {
+                inst.prev_transform = inst.transform;
+                inst.last_refresh_frame = frame_counter;
+            }
+            if(inst.transform != transform)
+            {
+                inst.transform = transform;
+                inst.normal_transform = normal_transform;
+                inst.last_refresh_frame = frame_counter;
+            }
+        }
+        src.last_refresh_frame = std::max(
+            src.last_refresh_frame, inst.last_refresh_frame
+        );
+        ++i;
+    }
+
+    if(!building && i != end)
+        return false;
+    src.instance_count = i - src.first_instance;
+    return true;
+}
+
+std::vector<scene_stage::static_object>
+scene_stage::get_static_objects_in_morton_order()
+{
+    std::vector<static_object> objects;
+    std::vector<vec3> centers;
+    aabb scene_bounds = {vec3(INFINITY), vec3(-INFINITY)};
+    cur_scene->foreach([&](entity id, transformable& t, model& mod){
+        if(!t.is_static())
+            return;
+
+        int index = transforms.get_index(&t);
+        mat4 transform = index >= 0 ?
+            transforms.get_global_transform(index) : t.get_global_transform();
+        aabb bounds = {vec3(INFINITY), vec3(-INFINITY)};
+        for(const auto& vg: mod)
+        {
+            if(vg.m->is_skinned() || vg.m->get_animation_source())
+                continue;
+            aabb b = transform_aabb(vg.m->get_bounds(), transform);
+            bounds.min = min(bounds.min, b.min);
+            bounds.max = max(bounds.max, b.max);
+        }
+        // Objects without static meshes don't produce static instances.
+        if(bounds.min.x > bounds.max.x)
+            return;
+
+        vec3 center = (bounds.min + bounds.max) * 0.5f;
+        scene_bounds.min = min(scene_bounds.min, center);
+        scene_bounds.max = max(scene_bounds.max, center);
+        objects.push_back({id, &t, &mod, 0});
+        centers.push_back(center);
+    });
+
+    vec3 size = max(scene_bounds.max - scene_bounds.min, vec3(1e-6f));
+    for(size_t i = 0; i < objects.size(); ++i)
+    {
+        vec3 p = (centers[i] - scene_bounds.min) / size;
+        objects[i].morton_code = morton_encode(
+            uvec3(clamp(p * 1024.0f, vec3(0.0f), vec3(1023.0f)))
+        );
+    }
+    std::stable_sort(
+        objects.begin(), objects.end(),
+        [](const static_object& a, const static_object& b){
+            return a.morton_code < b.morton_code;
+        }
+    );
+    return objects;
+}
+
+void scene_stage::assign_instance_groups(
+    const instance_source& src,
+    entity& last_object_index
+){
+    for(size_t i = 0; i < src.instance_count; ++i)
+    {
+        const instance& inst = instances[src.first_instance + i];
+        assign_group_cache(
+            inst.mesh_id,
+            inst.m->get_triangle_count(),
+            inst.transform,
+            src.static_mesh,
+            src.static_transformable,
+            src.id,
+            last_object_index
+        );
+    }
+}
+
 void scene_stage::ensure_blas()
 {
     if(!get_context()->is_ray_tracing_supported())
         return;
-    bool built_one = false;
-    // Goes through all groups and ensures they have valid BLASes.
+    // Goes through all groups and ensures they have valid BLASes. Missing
+    // ones are all built together at the end.
     size_t offset = 0;
-    std::vector<bottom_level_acceleration_structure::entry> entries;
+    std::deque<std::vector<bottom_level_acceleration_structure::entry>> batch_entries;
+    std::vector<bottom_level_acceleration_structure::batch_entry> batch;
     for(const instance_group& group: group_cache)
     {
         auto it = blas_cache.find(group.id);
@@ -710,12 +963,8 @@ void scene_stage::ensure_blas()
             continue;
         }
 
-        if(!built_one)
-            TR_LOG("Building acceleration structures");
-
-        built_one = true;
-
-        entries.clear();
+        std::vector<bottom_level_acceleration_structure::entry>& entries =
+            batch_entries.emplace_back();
         bool double_sided = false;
         for(size_t i = 0; i < group.size; ++i, ++offset)
         {
@@ -728,23 +977,182 @@ void scene_stage::ensure_blas()
                 !inst.mat->potentially_transparent()
             });
         }
-        blas_cache.emplace(
+        auto res = blas_cache.emplace(
             group.id,
             bottom_level_acceleration_structure(
                 get_device_mask(),
                 entries,
                 !double_sided,
                 group_strategy == blas_strategy::ALL_MERGED_STATIC ? false : !group.static_mesh,
-                group.static_mesh
+                group.static_mesh,
+                false
             )
         );
+        batch.push_back({&res.first->second, &entries});
     }
-    if(built_one)
+    if(batch.size() != 0)
+    {
+        TR_LOG("Building ", batch.size(), " acceleration structures");
+        bottom_level_acceleration_structure::build_batch(get_device_mask(), batch);
         TR_LOG("Finished building acceleration structures");
+    }
+}
+
+blas_strategy scene_stage::choose_blas_strategy()
+{
+    struct candidate
+    {
+        blas_strategy strategy;
+        const char* name;
+        // TLAS instances and unique triangles across all BLASes.
+        size_t instances;
+        uint64_t triangles;
+        // Expected number of BLASes a ray has to enter at any point.
+        float overlap;
+        float cost;
+    };
+
+    size_t model_count = 0;
+    size_t vertex_group_count = 0;
+    size_t dynamic_model_count = 0;
+    uint64_t total_triangles = 0;
+    uint64_t merged_triangles = 0;
+    uint64_t per_model_triangles = 0;
+    uint64_t per_material_triangles = 0;
+    std::unordered_set<uint64_t> seen_meshes;
+    std::unordered_set<uint64_t> seen_models;
+    std::vector<aabb> static_bounds;
+    aabb scene_bounds = {vec3(INFINITY), vec3(-INFINITY)};
+
+    cur_scene->foreach([&](transformable& t, model& mod){
+        int index = transforms.get_index(&t);
+        mat4 transform = index >= 0 ?
+            transforms.get_global_transform(index) : t.get_global_transform();
+
+        uint64_t model_id = 0;
+        uint64_t model_triangles = 0;
+        uint64_t static_triangles = 0;
+        aabb bounds = {vec3(INFINITY), vec3(-INFINITY)};
+        for(const auto& vg: mod)
+        {
+            size_t triangles = vg.m->get_triangle_count();
+            model_id = hash_combine(model_id, vg.m->get_id());
+            model_triangles += triangles;
+            vertex_group_count++;
+            if(seen_meshes.insert(vg.m->get_id()).second)
+                per_material_triangles += triangles;
+
+            bool static_mesh = !vg.m->is_skinned() && !vg.m->get_animation_source();
+            if(static_mesh && t.is_static())
+            {
+                static_triangles += triangles;
+                aabb b = transform_aabb(vg.m->get_bounds(), transform);
+                bounds.min = min(bounds.min, b.min);
+                bounds.max = max(bounds.max, b.max);
+            }
+        }
+        if(mod.group_count() == 0)
+            return;
+
+        model_count++;
+        total_triangles += model_triangles;
+        // Static parts get baked into the merged BLAS once per instance,
+        // everything else is shared per model like in PER_MODEL.
+        merged_triangles += static_triangles;
+        bool new_model = seen_models.insert(model_id).second;
+        if(new_model)
+        {
+            per_model_triangles += model_triangles;
+            merged_triangles += model_triangles - static_triangles;
+        }
+        if(static_triangles != model_triangles)
+            dynamic_model_count++;
+        if(static_triangles != 0)
+        {
+            static_bounds.push_back(bounds);
+            scene_bounds.min = min(scene_bounds.min, bounds.min);
+            scene_bounds.max = max(scene_bounds.max, bounds.max);
+        }
+    });
+
+    if(model_count == 0)
+        return blas_strategy::AUTO;
+
+    // Average number of static model bounds covering a point in the scene.
+    // Flat boxes would have no volume, so each side is at least 1% of the
+    // scene's.
+    float overlap = 1.0f;
+    if(static_bounds.size() > 1)
+    {
+        vec3 scene_size = max(scene_bounds.max - scene_bounds.min, vec3(1e-6f));
+        float volume_sum = 0.0f;
+        for(const aabb& b: static_bounds)
+        {
+            vec3 size = max(b.max - b.min, scene_size * 0.01f);
+            volume_sum += size.x * size.y * size.z;
+        }
+        overlap = std::max(
+            volume_sum / (scene_size.x * scene_size.y * scene_size.z), 1.0f
+        );
+    }
+
+    // Materials of one model usually cover the same space, so splitting them
+    // multiplies the overlap.
+    //
+    // STATIC_CLUSTERED_DYNAMIC_PER_MODEL is not a candidate: it stores the
+    // same triangles as static-merged, and since clusters don't overlap, its
+    // estimated cost is the same as well. What it gains is smaller builds,
+    // which this model doesn't capture, so it is only used when requested.
+    float material_overlap = overlap * vertex_group_count / (float)model_count;
+    candidate candidates[] = {
+        {
+            blas_strategy::STATIC_MERGED_DYNAMIC_PER_MODEL,
+            "static-merged-dynamic-per-model",
+            1 + dynamic_model_count, merged_triangles, 1.0f, 0.0f
+        },
+        {
+            blas_strategy::PER_MODEL, "per-model",
+            model_count, per_model_triangles, overlap, 0.0f
+        },
+        {
+            blas_strategy::PER_MATERIAL, "per-material",
+            vertex_group_count, per_material_triangles, material_overlap, 0.0f
+        }
+    };
+
+    // Tracing cost is estimated as the TLAS depth plus the depth of every
+    // overlapping BLAS. The cheapest one that fits in the budget is picked,
+    // or the smallest one if none fit.
+    const candidate* best = nullptr;
+    const candidate* smallest = nullptr;
+    for(candidate& c: candidates)
+    {
+        float triangles_per_instance = total_triangles / (float)c.instances;
+        c.cost = std::log2(std::max((float)c.instances, 1.0f)) +
+            c.overlap * std::log2(std::max(triangles_per_instance, 2.0f));
+        if(!smallest || c.triangles < smallest->triangles)
+            smallest = &c;
+        if(
+            c.triangles * BLAS_BYTES_PER_TRIANGLE <= opt.as_memory_budget &&
+            (!best || c.cost < best->cost)
+        ) best = &c;
+    }
+    if(!best) best = smallest;
+
+    TR_LOG(
+        "Using BLAS strategy ", best->name, " for ", model_count, " models, ",
+        seen_models.size(), " unique, with static overlap ", overlap,
+        ". Estimated size ",
+        best->triangles * BLAS_BYTES_PER_TRIANGLE / (1024*1024), " MiB, budget ",
+        opt.as_memory_budget / (1024*1024), " MiB"
+    );
+    return best->strategy;
 }
 
 void scene_stage::assign_group_cache(
     uint64_t id,
+    size_t triangle_count,
+    const mat4& transform,
     bool static_mesh,
     bool static_transformable,
     entity object_index,
@@ -805,6 +1213,47 @@ void scene_stage::assign_group_cache(
             group.size++;
         }
         break;
+    case blas_strategy::STATIC_CLUSTERED_DYNAMIC_PER_MODEL:
+        // Static instances arrive in Morton order, so filling up clusters
+        // in order keeps them spatially coherent.
+        if(static_mesh && static_transformable)
+        {
+            // Cluster BLASes have the transforms of their members baked
+            // in, and cluster membership shifts whenever static objects
+            // are added or removed. So the ID must cover the placement of
+            // each member, not just its mesh.
+            id = hash_combine(
+                hash_combine(id, object_index),
+                hash_data(&transform, sizeof(transform))
+            );
+            if(
+                group_cache.size() != 0 &&
+                group_cache.back().static_transformable &&
+                group_cache.back().triangle_count + triangle_count <= opt.as_cluster_triangles
+            ){
+                instance_group& group = group_cache.back();
+                group.id = hash_combine(group.id, id);
+                group.size++;
+                group.triangle_count += triangle_count;
+            }
+            else group_cache.push_back({id, 1, true, true, triangle_count});
+        }
+        else if(
+            group_cache.size() != 0 &&
+            !group_cache.back().static_transformable &&
+            last_object_index == object_index
+        ){
+            instance_group& group = group_cache.back();
+            group.id = hash_combine(group.id, id);
+            if(!static_mesh) group.static_mesh = false;
+            group.size++;
+        }
+        else group_cache.push_back({id, 1, static_mesh, false});
+        break;
+    case blas_strategy::AUTO:
+        throw std::runtime_error(
+            "BLAS strategy must be chosen before grouping instances"
+        );
     }
     last_object_index = object_index;
 }
@@ -882,7 +1331,7 @@ std::vector<descriptor_state> scene_stage::get_descriptor_info(device_id id, int
             for(size_t i = 0; i < instances.size(); ++i)
             {
                 const mesh* m = instances[i].m;
-                size_t bytes = m->get_vertices().size() * sizeof(mesh::vertex);
+                size_t bytes = m->get_vertex_count() * sizeof(mesh::vertex);
                 dbi_vertex.push_back({ptv.buf, offset, bytes});
                 offset += bytes;
             }
@@ -1028,74 +1477,129 @@ void scene_stage::update(uint32_t frame_index)
         lights_outdated = true;
     }
 
+    // All global transforms are brought up to date here in one go, after this
+    // they're only read.
+    if(transforms.update(*cur_scene, &get_context()->get_thread_pool()))
+        instance_sources_outdated = true;
     geometry_outdated |= refresh_instance_cache();
     track_shadow_maps(*cur_scene);
 
     uint64_t frame_counter = get_context()->get_frame_counter();
+    uint32_t frames_in_flight = get_context()->get_frames_in_flight();
+    thread_pool& pool = get_context()->get_thread_pool();
+
+    // Joint nodes are in the scene, so their transforms are already up to
+    // date and each model only writes into its own joint buffer. Nothing
+    // below depends on the palettes, so they're computed in the background
+    // and joined before the update finishes.
+    task_group joint_tasks(pool, "joint palettes");
     cur_scene->foreach([&](model& mod){
         if(mod.has_joints_buffer())
-            mod.update_joints(frame_index);
+            joint_tasks.run([&mod, frame_index](){
+                mod.update_joints(frame_index);
+            });
     });
 
     size_t tri_light_count = 0;
     size_t vertex_count = 0;
 
+    // New textures change the descriptor set, which is only rebound along
+    // with geometry.
     if(geometry_outdated)
+        s_table.update_scene(this, frame_counter);
+    else if(s_table.refresh_materials(frame_counter))
+        geometry_outdated = true;
+
+    // The grid lookup must only read from the scene during the parallel
+    // fill, so it's brought up to date here. Moved grids can change the grid
+    // of instances that are otherwise skipped, so those are refreshed too.
+    if(opt.alloc_sh_grids && sh_grids.update(*cur_scene))
+        force_instance_refresh_frames = frames_in_flight;
+
+    // Instances are filled in chunks on the thread pool. Light and vertex
+    // offsets are prefix sums over the instances: each chunk's total is
+    // computed first, then scanned to get the base offset of every chunk.
+    size_t chunk_count =
+        (instances.size() + INSTANCE_CHUNK_SIZE - 1) / INSTANCE_CHUNK_SIZE;
+    std::vector<size_t> chunk_tri_lights(chunk_count, 0);
+    std::vector<size_t> chunk_vertices(chunk_count, 0);
+    pool.parallel_for(chunk_count, [&](size_t chunk){
+        size_t end = std::min((chunk+1) * INSTANCE_CHUNK_SIZE, instances.size());
+        for(size_t i = chunk * INSTANCE_CHUNK_SIZE; i < end; ++i)
+        {
+            if(instances[i].mat->emission_factor != vec3(0))
+                chunk_tri_lights[chunk] += instances[i].m->get_triangle_count();
+            chunk_vertices[chunk] += instances[i].m->get_index_count();
+        }
+    }, "instance counts");
+    for(size_t chunk = 0; chunk < chunk_count; ++chunk)
     {
-        // TODO: This won't catch changing materials! The correct solution would
-        // probably be to update the sampler table on every frame, but make it
-        // faster than it currently is and report if there was a change.
-        s_table.update_scene(this);
+        size_t chunk_tri_light_count = chunk_tri_lights[chunk];
+        chunk_tri_lights[chunk] = tri_light_count;
+        tri_light_count += chunk_tri_light_count;
+        vertex_count += chunk_vertices[chunk];
     }
 
     scene_data.resize(sizeof(instance_buffer) * instances.size());
-    scene_data.foreach<instance_buffer>(
-        frame_index, instances.size(),
-        [&](instance_buffer& inst, size_t i){
-            if(instances[i].mat->emission_factor != vec3(0))
-            {
-                inst.light_base_id = tri_light_count;
-                tri_light_count += instances[i].m->get_indices().size() / 3;
-            }
-            else inst.light_base_id = -1;
-
-            vertex_count += instances[i].m->get_indices().size();
-
-            // Skip unchanged instances.
-            if(
-                force_instance_refresh_frames == 0 &&
-                instances[i].last_refresh_frame+MAX_FRAMES_IN_FLIGHT < frame_counter
-            ) return;
-
-            pmat4 model = instances[i].transform;
-            inst.model = model;
-            inst.model_normal = instances[i].normal_transform;
-            inst.model_prev = instances[i].prev_transform;
-            int index = -1;
-            if(opt.alloc_sh_grids && !get_sh_grid(*cur_scene, model[3], &index))
-                get_largest_sh_grid(*cur_scene, &index);
-            inst.sh_grid_index = index;
-            inst.pad = 0;
-            inst.shadow_terminator_mul = 1.0f/(
-                1.0f-0.5f * instances[i].mod->get_shadow_terminator_offset()
-            );
+    scene_data.map<instance_buffer>(
+        frame_index,
+        [&](instance_buffer* data){
+            pool.parallel_for(chunk_count, [&](size_t chunk){
+                size_t light_base_id = chunk_tri_lights[chunk];
+                size_t end = std::min(
+                    (chunk+1) * INSTANCE_CHUNK_SIZE, instances.size()
+                );
+                for(size_t i = chunk * INSTANCE_CHUNK_SIZE; i < end; ++i)
+                {
+                    instance_buffer& inst = data[i];
+                    if(instances[i].mat->emission_factor != vec3(0))
+                    {
+                        inst.light_base_id = light_base_id;
+                        light_base_id += instances[i].m->get_triangle_count();
+                    }
+                    else inst.light_base_id = -1;
+
+                    // Skip unchanged instances.
+                    const sampler_table::material_tex_ids& tex_ids =
+                        s_table.get_instance_tex_ids(i);
+                    if(
+                        force_instance_refresh_frames == 0 &&
+                        instances[i].last_refresh_frame+frames_in_flight < frame_counter &&
+                        tex_ids.change_frame+frames_in_flight < frame_counter
+                    ) continue;
+
+                    pmat4 model = instances[i].transform;
+                    inst.model = model;
+                    inst.model_normal = instances[i].normal_transform;
+                    inst.model_prev = instances[i].prev_transform;
+                    inst.sh_grid_index =
+                        opt.alloc_sh_grids ? sh_grids.find(model[3]) : -1;
+                    inst.pad = 0;
+                    inst.shadow_terminator_mul = 1.0f/(
+                        1.0f-0.5f * instances[i].mod->get_shadow_terminator_offset()
+                    );
 
-            const material& mat = *instances[i].mat;
-            inst.mat.albedo_factor = mat.albedo_factor;
-            inst.mat.metallic_roughness_factor =
-                vec4(mat.metallic_factor, mat.roughness_factor, 0, 0);
-            inst.mat.emission_factor_double_sided = vec4(
-                mat.emission_factor, mat.double_sided ? 1.0f : 0.0f
-            );
-            inst.mat.transmittance = mat.transmittance;
-            inst.mat.ior = mat.ior;
-            inst.mat.normal_factor = mat.normal_factor;
-
-            inst.mat.albedo_tex_id = s_table.find_tex_id(mat.albedo_tex);
-            inst.mat.metallic_roughness_tex_id =
-                s_table.find_tex_id(mat.metallic_roughness_tex);
-            inst.mat.normal_tex_id = s_table.find_tex_id(mat.normal_tex);
-            inst.mat.emission_tex_id = s_table.find_tex_id(mat.emission_tex);
+                    const material& mat = *instances[i].mat;
+                    inst.mat.albedo_factor = mat.albedo_factor;
+                    inst.mat.metallic_roughness_factor =
+                        vec4(mat.metallic_factor, mat.roughness_factor, 0, 0);
+                    inst.mat.emission_factor_double_sided = vec4(
+                        mat.emission_factor, mat.double_sided ? 1.0f : 0.0f
+                    );
+                    inst.mat.transmittance = mat.transmittance;
+                    inst.mat.ior = mat.ior;
+                    inst.mat.normal_factor = mat.normal_factor;
+                    inst.mat.normal_two_channel =
+                        mat.normal_tex.first &&
+                        is_two_channel_format(mat.normal_tex.first->get_format());
+
+                    inst.mat.albedo_tex_id = tex_ids.albedo;
+                    inst.mat.metallic_roughness_tex_id =
+                        tex_ids.metallic_roughness;
+                    inst.mat.normal_tex_id = tex_ids.normal;
+                    inst.mat.emission_tex_id = tex_ids.emission;
+                }
+            }, "instance buffer");
         }
     );
     if(force_instance_refresh_frames > 0) force_instance_refresh_frames--;
@@ -1129,33 +1633,39 @@ void scene_stage::update(uint32_t frame_index)
     camera_data_offsets.clear();
     size_t start_offset = 0;
     std::vector<entity> camera_entities = get_sorted_cameras(*cur_scene);
+    // The scene isn't safe to access from other threads, so components are
+    // looked up here.
+    std::vector<std::pair<camera*, transformable*>> cameras;
     for(entity id: camera_entities)
     {
         camera* cam = cur_scene->get<camera>(id);
+        cameras.push_back({cam, cur_scene->get<transformable>(id)});
         size_t buf_size = camera::get_projection_type_uniform_buffer_size(cam->get_projection_type()) * 2;
         camera_data_offsets.push_back({start_offset, buf_size});
         start_offset += buf_size;
     }
     camera_data.resize(start_offset);
     old_camera_data.resize(start_offset);
-    camera_data.map<uint8_t>(
-        frame_index, [&](uint8_t* data){
-            uint8_t* old_data = old_camera_data.data();
-            size_t i = 0;
-            for(entity id: camera_entities)
-            {
-                camera* cam = cur_scene->get<camera>(id);
-                transformable* t = cur_scene->get<transformable>(id);
-                uint8_t* cur_data = data + camera_data_offsets[i].first;
-                size_t buf_size = camera::get_projection_type_uniform_buffer_size(cam->get_projection_type());
-                cam->write_uniform_buffer(*t, cur_data);
-                memcpy(cur_data + buf_size, old_data, buf_size);
-                memcpy(old_data, cur_data, buf_size);
-                old_data += buf_size;
-                ++i;
+    // Cameras are packed in the background while the lights are processed.
+    task_group camera_tasks(pool, "camera data");
+    camera_tasks.run([this, frame_index, cameras = std::move(cameras)](){
+        camera_data.map<uint8_t>(
+            frame_index, [&](uint8_t* data){
+                uint8_t* old_data = old_camera_data.data();
+                size_t i = 0;
+                for(auto [cam, t]: cameras)
+                {
+                    uint8_t* cur_data = data + camera_data_offsets[i].first;
+                    size_t buf_size = camera::get_projection_type_uniform_buffer_size(cam->get_projection_type());
+                    cam->write_uniform_buffer(*t, cur_data);
+                    memcpy(cur_data + buf_size, old_data, buf_size);
+                    memcpy(old_data, cur_data, buf_size);
+                    old_data += buf_size;
+                    ++i;
+                }
             }
-        }
-    );
+        );
+    });
 
     if(opt.shadow_mapping)
     {
@@ -1336,6 +1846,9 @@ void scene_stage::update(uint32_t frame_index)
             }
         );
 
+        // BLAS addresses and instance indices only change along with geometry.
+        bool write_all_tlas_instances =
+            tlas_instances_outdated || geometry_outdated || lights_outdated;
         for(device& dev: get_device_mask())
         {
             if(geometry_outdated)
@@ -1372,11 +1885,29 @@ void scene_stage::update(uint32_t frame_index)
                 dev.id,
                 frame_index,
                 [&](vk::AccelerationStructureInstanceKHR* as_instances){
-                    // Update instance staging buffer
+                    // Update instance staging buffer. The GPU-side buffer
+                    // keeps its contents, so only instances that changed this
+                    // frame are written and uploaded.
+                    auto mark = [&](size_t index){
+                        instance_buffer.mark_dirty(
+                            dev.id, frame_index,
+                            index * sizeof(vk::AccelerationStructureInstanceKHR),
+                            sizeof(vk::AccelerationStructureInstanceKHR)
+                        );
+                    };
                     size_t offset = 0;
                     for(size_t j = 0; j < group_cache.size() && as_instance_count < total_max_capacity; ++j)
                     {
                         const instance_group& group = group_cache[j];
+                        if(!write_all_tlas_instances && (
+                            group.static_transformable ||
+                            instances[offset].last_refresh_frame != frame_counter
+                        )){
+                            as_instance_count++;
+                            offset += group.size;
+                            continue;
+                        }
+
                         const bottom_level_acceleration_structure& blas = blas_cache.at(group.id);
                         vk::AccelerationStructureInstanceKHR inst = vk::AccelerationStructureInstanceKHR(
                             {}, offset, 1<<0, 0, // Hit group 0 for triangle meshes.
@@ -1392,24 +1923,54 @@ void scene_stage::update(uint32_t frame_index)
                             (void*)&global_transform,
                             sizeof(inst.transform)
                         );
+                        mark(as_instance_count);
                         as_instances[as_instance_count++] = inst;
                         offset += group.size;
                     }
 
                     if(light_aabb_count != 0 && as_instance_count < total_max_capacity && light_blas.has_value())
                     {
-                        vk::AccelerationStructureInstanceKHR& inst = as_instances[as_instance_count++];
-                        inst = vk::AccelerationStructureInstanceKHR(
-                            {}, as_instance_count, 1<<1, 2,
-                            vk::GeometryInstanceFlagBitsKHR::eTriangleCullDisable,
-                            light_blas->get_blas_address(dev.id)
-                        );
-                        mat4 id_mat = mat4(1.0f);
-                        memcpy((void*)&inst.transform, (void*)&id_mat, sizeof(inst.transform));
+                        if(write_all_tlas_instances)
+                        {
+                            mark(as_instance_count);
+                            vk::AccelerationStructureInstanceKHR& inst = as_instances[as_instance_count];
+                            inst = vk::AccelerationStructureInstanceKHR(
+                                {}, as_instance_count+1, 1<<1, 2,
+                                vk::GeometryInstanceFlagBitsKHR::eTriangleCullDisable,
+                                light_blas->get_blas_address(dev.id)
+                            );
+                            mat4 id_mat = mat4(1.0f);
+                            memcpy((void*)&inst.transform, (void*)&id_mat, sizeof(inst.transform));
+                        }
+                        as_instance_count++;
                     }
                 }
             );
+
+            if(instance_buffer.is_dirty(dev.id, frame_index))
+            {
+                vk::CommandBuffer cb = begin_frame_commands(dev.id);
+                // The previous frame's TLAS build may still be reading the
+                // instances.
+                cb.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    vk::PipelineStageFlagBits::eTransfer,
+                    {}, {}, {}, {}
+                );
+                instance_buffer.upload_dirty(dev.id, frame_index, cb);
+                vk::MemoryBarrier barrier(
+                    vk::AccessFlagBits::eTransferWrite,
+                    vk::AccessFlagBits::eAccelerationStructureReadKHR
+                );
+                cb.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eTransfer,
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    {}, barrier, {}, {}
+                );
+                end_frame_commands(cb, dev.id);
+            }
         }
+        tlas_instances_outdated = false;
 
         if(opt.pre_transform_vertices)
             geometry_outdated |= reserve_pre_transformed_vertices(vertex_count);
@@ -1417,11 +1978,19 @@ void scene_stage::update(uint32_t frame_index)
             clear_pre_transformed_vertices();
     }
 
+    joint_tasks.wait();
+    camera_tasks.wait();
+
     if(lights_outdated) light_change_counter++;
     if(geometry_outdated) geometry_change_counter++;
 
+    // Full rebuilds are recorded below anyway.
+    if(!lights_outdated && !geometry_outdated)
+        rebuild_degraded_as(frame_index);
+
     if(lights_outdated || geometry_outdated)
     {
+        assign_as_scratch();
         record_command_buffers(light_aabb_count, true);
         prev_was_rebuild = true;
         lights_outdated = false;
@@ -1432,6 +2001,179 @@ void scene_stage::update(uint32_t frame_index)
         record_command_buffers(light_aabb_count, false);
         prev_was_rebuild = false;
     }
+    count_as_updates();
+}
+
+void scene_stage::assign_as_scratch()
+{
+    if(!as_scratch) return;
+
+    // Only structures that get rebuilt in the recorded commands need scratch
+    // memory, static BLASes are already done.
+    as_scratch->clear();
+    tlas->set_scratch(*as_scratch);
+    if(light_blas.has_value())
+        light_blas->set_scratch(*as_scratch);
+    for(const instance_group& group: group_cache)
+    {
+        if(!group.static_mesh)
+            blas_cache.at(group.id).set_scratch(*as_scratch);
+    }
+    as_scratch->commit();
+}
+
+void scene_stage::rebuild_degraded_as(uint32_t frame_index)
+{
+    if(!as_scratch) return;
+
+    uint64_t frame_counter = get_context()->get_frame_counter();
+    if(opt.as_rebuild_regression > 0.0f && !as_rebuild_requested)
+    {
+        // Traces can't be timed per instance group, so the total is watched
+        // instead and all dynamic structures are rebuilt once it regresses.
+        float trace_time = 0.0f;
+        for(device& dev: get_device_mask())
+        {
+            for(const std::string& name: trace_timers)
+                trace_time += get_context()->get_timing().get_duration(dev.id, name);
+        }
+
+        if(trace_time > 0.0f && frame_counter >= trace_time_baseline_frame)
+        {
+            if(trace_time_baseline == 0.0f)
+                trace_time_baseline = trace_time;
+            else if(trace_time > trace_time_baseline * (1.0f + opt.as_rebuild_regression))
+            {
+                as_rebuild_requested = true;
+                as_rebuild_request_frame = frame_counter;
+            }
+            else trace_time_baseline = std::min(trace_time_baseline, trace_time);
+        }
+    }
+
+    // Updates are counted once per frame, so a structure that hasn't been
+    // rebuilt since the request has more of them than there have been frames.
+    auto is_degraded = [&](size_t updates){
+        return (opt.as_rebuild_interval > 0 && updates >= opt.as_rebuild_interval) ||
+            (as_rebuild_requested && updates > frame_counter - as_rebuild_request_frame);
+    };
+
+    struct candidate
+    {
+        size_t updates;
+        bottom_level_acceleration_structure* blas;
+        std::vector<bottom_level_acceleration_structure::entry> entries;
+    };
+    std::vector<candidate> candidates;
+    if(is_degraded(tlas->get_updates_since_rebuild()))
+        candidates.push_back({tlas->get_updates_since_rebuild(), nullptr, {}});
+
+    size_t offset = 0;
+    for(const instance_group& group: group_cache)
+    {
+        bottom_level_acceleration_structure* blas = &blas_cache.at(group.id);
+        bool seen = std::any_of(
+            candidates.begin(), candidates.end(),
+            [&](const candidate& c){ return c.blas == blas; }
+        );
+        if(
+            !blas->is_dynamic() || seen ||
+            !is_degraded(blas->get_updates_since_rebuild())
+        )
+        {
+            offset += group.size;
+            continue;
+        }
+
+        candidate& c = candidates.emplace_back();
+        c.updates = blas->get_updates_since_rebuild();
+        c.blas = blas;
+        for(size_t i = 0; i < group.size; ++i, ++offset)
+        {
+            const instance& inst = instances[offset];
+            c.entries.push_back({
+                inst.m,
+                0, nullptr,
+                group.static_transformable ? inst.transform : mat4(1),
+                !inst.mat->potentially_transparent()
+            });
+        }
+    }
+
+    if(candidates.size() == 0)
+    {
+        if(as_rebuild_requested)
+        {
+            // Everything has been rebuilt, start looking for the next
+            // regression once the new timings come in.
+            as_rebuild_requested = false;
+            trace_time_baseline = 0.0f;
+            trace_time_baseline_frame =
+                frame_counter + get_context()->get_frames_in_flight();
+        }
+        return;
+    }
+
+    // The most refitted ones are likely the worst, so they go first.
+    std::sort(
+        candidates.begin(), candidates.end(),
+        [](const candidate& a, const candidate& b){ return a.updates > b.updates; }
+    );
+    candidates.resize(std::min(
+        candidates.size(), (size_t)std::max(opt.as_rebuilds_per_frame, 1u)
+    ));
+
+    // The rebuilds use last frame's vertices, the recorded refits then bring
+    // them up to date.
+    for(device& dev: get_device_mask())
+    {
+        vk::CommandBuffer cb = begin_frame_commands(dev.id);
+        // Earlier frames may still be tracing against these.
+        vk::MemoryBarrier barrier(
+            vk::AccessFlagBits::eAccelerationStructureReadKHR|
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR
+        );
+        cb.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAllCommands,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            {}, barrier, {}, {}
+        );
+        bool rebuild_tlas = false;
+        for(const candidate& c: candidates)
+        {
+            if(c.blas) c.blas->rebuild(dev.id, frame_index, cb, c.entries, false);
+            else rebuild_tlas = true;
+        }
+        if(rebuild_tlas)
+            tlas->rebuild(dev.id, cb, as_instance_count, false);
+
+        // The recorded refits use the same scratch memory.
+        barrier = vk::MemoryBarrier(
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR,
+            vk::AccessFlagBits::eAccelerationStructureReadKHR|
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR
+        );
+        cb.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            {}, barrier, {}, {}
+        );
+        end_frame_commands(cb, dev.id);
+    }
+}
+
+void scene_stage::count_as_updates()
+{
+    if(!as_scratch) return;
+
+    // Every recorded frame refits these once.
+    tlas->count_update();
+    for(auto& [id, blas]: blas_cache)
+    {
+        if(blas.is_dynamic())
+            blas.count_update();
+    }
 }
 
 void scene_stage::record_command_buffers(size_t light_aabb_count, bool rebuild_as)
@@ -1446,7 +2188,7 @@ void scene_stage::record_command_buffers(size_t light_aabb_count, bool rebuild_a
             bind(extract_tri_lights[dev.id], 0, 0);
         }
 
-        for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        for(size_t i = 0; i < get_context()->get_frames_in_flight(); ++i)
         {
             vk::CommandBuffer cb = begin_graphics(dev.id);
             stage_timer.begin(cb, dev.id, i);
@@ -1490,7 +2232,7 @@ void scene_stage::record_skinning(device_id id, uint32_t frame_index, vk::Comman
         {
             mesh* dst = vg.m;
             mesh* src = dst->get_animation_source();
-            uint32_t vertex_count = vg.m->get_vertices().size();
+            uint32_t vertex_count = vg.m->get_vertex_count();
 
             skinning[id].push_constants(cb, skinning_push_constants{vertex_count});
             skinning[id].push_descriptors(cb, {
@@ -1556,7 +2298,6 @@ void scene_stage::record_as_build(
     size_t light_aabb_count,
     bool rebuild
 ){
-    auto& instance_buffer = tlas->get_instances_buffer();
     bool as_update = !rebuild;
 
     if(light_blas.has_value())
@@ -1570,23 +2311,8 @@ void scene_stage::record_as_build(
         );
     }
 
-    if(as_instance_count > 0)
-    {
-        instance_buffer.upload(id, frame_index, cb);
-
-        vk::MemoryBarrier barrier(
-            vk::AccessFlagBits::eTransferWrite,
-            vk::AccessFlagBits::eAccelerationStructureWriteKHR
-        );
-
-        cb.pipelineBarrier(
-            vk::PipelineStageFlagBits::eTransfer,
-            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
-            {},
-            barrier, {}, {}
-        );
-    }
-
+    // The instances are uploaded separately in update(), only the changed
+    // ones.
     tlas->rebuild(id, cb, as_instance_count, as_update);
 }
 
@@ -1602,7 +2328,7 @@ void scene_stage::record_tri_light_extraction(
             continue;
 
         extract_tri_light_push_constants pc;
-        pc.triangle_count = inst.m->get_indices().size() / 3;
+        pc.triangle_count = inst.m->get_triangle_count();
         pc.instance_id = i;
 
         extract_tri_lights[id].push_constants(cb, pc);
@@ -1622,7 +2348,7 @@ void scene_stage::record_pre_transform(
         const instance& inst = instances[i];
 
         pre_tranform_push_constants pc;
-        pc.vertex_count = inst.m->get_vertices().size();
+        pc.vertex_count = inst.m->get_vertex_count();
         pc.instance_id = i;
 
         size_t bytes = pc.vertex_count * sizeof(mesh::vertex);
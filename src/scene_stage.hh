@@ -12,6 +12,8 @@
 #include "timer.hh"
 #include "atlas.hh"
 #include "camera.hh"
+#include "sh_grid.hh"
+#include "transform_hierarchy.hh"
 
 namespace tr
 {
@@ -21,7 +23,13 @@ enum class blas_strategy
     PER_MATERIAL,
     PER_MODEL,
     STATIC_MERGED_DYNAMIC_PER_MODEL,
-    ALL_MERGED_STATIC
+    ALL_MERGED_STATIC,
+    // Static geometry is split into spatially coherent BLASes of roughly
+    // options::as_cluster_triangles each, dynamic ones are per-model.
+    STATIC_CLUSTERED_DYNAMIC_PER_MODEL,
+    // Picks PER_MATERIAL, PER_MODEL or STATIC_MERGED_DYNAMIC_PER_MODEL based
+    // on the scene when it's loaded.
+    AUTO
 };
 
 class scene_stage: public multi_device_stage
@@ -36,6 +44,19 @@ public:
         bool shadow_mapping = false;
         bool alloc_sh_grids = false;
         blas_strategy group_strategy = blas_strategy::STATIC_MERGED_DYNAMIC_PER_MODEL;
+        // Dynamic acceleration structures are refitted every frame. They're
+        // rebuilt after this many refits, or when trace time has grown by
+        // this fraction since the last rebuilds. Zero disables either.
+        unsigned as_rebuild_interval = 0;
+        float as_rebuild_regression = 0.0f;
+        // Upper limit of rebuilds per frame, so that they're spread out.
+        unsigned as_rebuilds_per_frame = 1;
+        // In bytes, blas_strategy::AUTO avoids strategies that are estimated
+        // to exceed this.
+        uint64_t as_memory_budget = 1024*1024*1024;
+        // Target triangle count of the static BLASes of
+        // blas_strategy::STATIC_CLUSTERED_DYNAMIC_PER_MODEL.
+        size_t as_cluster_triangles = 1000000;
     };
 
     scene_stage(device_mask dev, const options& opt);
@@ -63,6 +84,7 @@ public:
         const material* mat;
         const mesh* m;
         const model* mod;
+        uint64_t mesh_id;
         uint64_t last_refresh_frame;
     };
     const std::vector<instance>& get_instances() const;
@@ -73,6 +95,10 @@ public:
         device_id id
     ) const;
 
+    // Ray tracing stages register their timers here. Their total duration is
+    // used to notice when refitted acceleration structures have degraded.
+    void add_trace_timer(const std::string& name);
+
     void bind(basic_pipeline& pipeline, uint32_t frame_index, int32_t camera_offset = 0);
     void push(basic_pipeline& pipeline, vk::CommandBuffer cmd, int32_t camera_offset = 0);
     static void bind_placeholders(
@@ -113,6 +139,9 @@ protected:
     void update(uint32_t frame_index) override;
 
 private:
+    void assign_as_scratch();
+    void rebuild_degraded_as(uint32_t frame_index);
+    void count_as_updates();
     void record_command_buffers(size_t light_aabb_count, bool rebuild_as);
     void record_skinning(device_id id, uint32_t frame_index, vk::CommandBuffer cb);
     void record_as_build(device_id id, uint32_t frame_index, vk::CommandBuffer cb, size_t light_aabb_count, bool rebuild);
@@ -123,6 +152,9 @@ private:
 
     bool prev_was_rebuild;
     size_t as_instance_count;
+    // Forces all TLAS instances to be written and uploaded on the next
+    // update.
+    bool tlas_instances_outdated;
 
     uint32_t envmap_change_counter;
     uint32_t geometry_change_counter;
@@ -133,6 +165,38 @@ private:
     unsigned force_instance_refresh_frames;
     scene* cur_scene;
 
+    // Instances are produced by these, each covering a contiguous range of
+    // 'instances'. Only the active ones are revisited every frame: those with
+    // dynamic transforms and those that changed during the last frame. Any
+    // models or transformables being added or removed in the scene causes a
+    // full rebuild. So does changing the static flag of a transformable, the
+    // vertex groups of a model through its setters or the ID of a mesh. Those
+    // are noticed on inactive sources by checking all sources whenever the
+    // global counters of transformable, model or mesh change. Vertex groups
+    // of static objects must not be modified in-place, as that is not noticed
+    // until the next rebuild.
+    struct instance_source
+    {
+        entity id;
+        transformable* t;
+        // Index in transforms.
+        int transform_index;
+        model* mod;
+        size_t first_instance;
+        size_t instance_count;
+        bool static_mesh;
+        bool static_transformable;
+        uint64_t model_revision;
+        uint64_t last_refresh_frame;
+    };
+    transform_hierarchy transforms;
+    std::vector<instance_source> instance_sources;
+    std::vector<size_t> active_instance_sources;
+    bool instance_sources_outdated;
+    uint64_t static_change_counter;
+    uint64_t model_change_counter;
+    uint64_t mesh_id_counter;
+
     //==========================================================================
     // Light stuff
     //==========================================================================
@@ -155,6 +219,8 @@ private:
         size_t size = 0;
         bool static_mesh = false;
         bool static_transformable = false;
+        // Only tracked for static clusters.
+        size_t triangle_count = 0;
     };
 
     struct pre_transformed_data
@@ -169,9 +235,39 @@ private:
     blas_strategy group_strategy;
 
     bool refresh_instance_cache();
+    // Checks all sources for changes that aren't visible through the scene's
+    // events.
+    bool instance_sources_changed() const;
+    // Returns false if the instances no longer match the source, in which
+    // case the whole cache must be rebuilt. When building, instances are
+    // added as needed.
+    bool refresh_instance_source(
+        instance_source& src,
+        uint64_t frame_counter,
+        bool building,
+        bool& scene_changed
+    );
+    struct static_object
+    {
+        entity id;
+        transformable* t;
+        model* mod;
+        uint32_t morton_code;
+    };
+    // Objects with static transforms and meshes, sorted by the Morton code
+    // of their bounding box center.
+    std::vector<static_object> get_static_objects_in_morton_order();
+    void assign_instance_groups(
+        const instance_source& src,
+        entity& last_object_index
+    );
     void ensure_blas();
+    // Returns AUTO if the scene has no models to decide on yet.
+    blas_strategy choose_blas_strategy();
     void assign_group_cache(
         uint64_t id,
+        size_t triangle_count,
+        const mat4& transform,
         bool static_mesh,
         bool static_transformable,
         entity object_index,
@@ -219,9 +315,21 @@ private:
     // Offsets and sizes to the camera uniform buffer.
     std::vector<std::pair<size_t, size_t>> camera_data_offsets;
     std::unordered_map<sh_grid*, texture> sh_grid_textures;
+    sh_grid_bvh sh_grids;
 
+    std::optional<scratch_arena> as_scratch;
     std::optional<top_level_acceleration_structure> tlas;
-    std::optional<event_subscription> events[10];
+    std::vector<std::string> trace_timers;
+    // Smallest trace time seen since the last requested rebuilds, zero if
+    // not measured yet. Timings lag behind, so ones before
+    // trace_time_baseline_frame are ignored.
+    float trace_time_baseline;
+    uint64_t trace_time_baseline_frame;
+    // Set when trace time has regressed, all dynamic structures not rebuilt
+    // since as_rebuild_request_frame are then rebuilt.
+    bool as_rebuild_requested;
+    uint64_t as_rebuild_request_frame;
+    std::optional<event_subscription> events[12];
 
     //==========================================================================
     // Pipelines
@@ -29,7 +29,7 @@ sh_compact_stage::sh_compact_stage(
     comp(dev, compute_pipeline::params{sh_compact::load_source(), {} }),
     compact_timer(dev, "SH compact")
 {
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev.ctx->get_frames_in_flight(); ++i)
     {
         // Bind descriptors
         comp.update_descriptor_set({
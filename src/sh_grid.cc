@@ -1,4 +1,6 @@
 #include "sh_grid.hh"
+#include <algorithm>
+#include <limits>
 
 namespace tr
 {
@@ -115,7 +117,14 @@ int sh_grid::get_coef_count(int order)
 
 float sh_grid::point_distance(transformable& self, vec3 p) const
 {
-    vec3 local_p = transpose(self.get_global_inverse_transpose_transform()) * vec4(p, 1);
+    return point_distance(
+        transpose(self.get_global_inverse_transpose_transform()), p
+    );
+}
+
+float sh_grid::point_distance(const mat4& pos_from_world, vec3 p) const
+{
+    vec3 local_p = pos_from_world * vec4(p, 1);
 
     if(all(lessThanEqual(abs(local_p), vec3(1.0f))))
         return 0.0f;
@@ -143,4 +152,200 @@ float sh_grid::calc_volume(transformable& self) const
     return size.x * size.y * size.z;
 }
 
+sh_grid_bvh::sh_grid_bvh()
+: largest(-1)
+{
+}
+
+bool sh_grid_bvh::update(scene& s)
+{
+    bool changed = false;
+    size_t i = 0;
+    float largest_volume = 0.0f;
+    int new_largest = -1;
+    s.foreach([&](transformable& t, sh_grid& g){
+        const mat4& transform = t.get_global_transform();
+        if(
+            i == grids.size() || grids[i].g != &g ||
+            grids[i].transform != transform ||
+            grids[i].radius != g.get_radius() ||
+            grids[i].resolution != g.get_resolution()
+        ){
+            if(i == grids.size())
+                grids.emplace_back();
+            grid& entry = grids[i];
+            entry.g = &g;
+            entry.transform = transform;
+            entry.radius = g.get_radius();
+            entry.resolution = g.get_resolution();
+            entry.pos_from_world =
+                transpose(t.get_global_inverse_transpose_transform());
+            entry.density = g.calc_density(t);
+
+            // The influence region is the unit cube grown by the radius.
+            vec3 r = vec3(1.0f + entry.radius);
+            entry.bounds = {vec3(INFINITY), vec3(-INFINITY)};
+            for(int c = 0; c < 8; ++c)
+            {
+                vec3 corner = vec3(
+                    c&1 ? r.x : -r.x, c&2 ? r.y : -r.y, c&4 ? r.z : -r.z
+                );
+                vec3 p = transform * vec4(corner, 1);
+                entry.bounds.min = min(entry.bounds.min, p);
+                entry.bounds.max = max(entry.bounds.max, p);
+            }
+            // Slack for rounding, points on the edge must not be missed.
+            vec3 slack = (entry.bounds.max - entry.bounds.min) * 1e-4f;
+            entry.bounds.min -= slack;
+            entry.bounds.max += slack;
+            changed = true;
+        }
+
+        float volume = g.calc_volume(t);
+        if(volume > largest_volume)
+        {
+            largest_volume = volume;
+            new_largest = i;
+        }
+        ++i;
+    });
+    largest = new_largest;
+
+    if(i != grids.size())
+    {
+        grids.resize(i);
+        changed = true;
+    }
+    if(!changed)
+        return false;
+
+    grid_order.resize(grids.size());
+    for(uint32_t j = 0; j < grid_order.size(); ++j)
+        grid_order[j] = j;
+    nodes.clear();
+    if(grids.size() != 0)
+    {
+        nodes.resize(1);
+        build(0, 0, grid_order.size());
+    }
+    return true;
+}
+
+int sh_grid_bvh::find(vec3 pos) const
+{
+    // The selection depends on iteration order, so candidates are gathered
+    // first and then considered in the same order as get_sh_grid() would.
+    uint32_t candidates[64];
+    size_t candidate_count = 0;
+    std::vector<uint32_t> overflow;
+
+    uint32_t stack[64];
+    size_t stack_size = 0;
+    if(nodes.size() != 0)
+        stack[stack_size++] = 0;
+    while(stack_size > 0)
+    {
+        const node& n = nodes[stack[--stack_size]];
+        if(
+            any(lessThan(pos, n.bounds.min)) ||
+            any(greaterThan(pos, n.bounds.max))
+        ) continue;
+
+        if(n.count == 0)
+        {
+            stack[stack_size++] = n.first;
+            stack[stack_size++] = n.first+1;
+            continue;
+        }
+
+        for(uint32_t j = n.first; j < n.first + n.count; ++j)
+        {
+            if(candidate_count < 64)
+                candidates[candidate_count++] = grid_order[j];
+            else overflow.push_back(grid_order[j]);
+        }
+    }
+
+    if(overflow.size() != 0)
+    {
+        overflow.insert(overflow.end(), candidates, candidates + candidate_count);
+        std::sort(overflow.begin(), overflow.end());
+    }
+    else std::sort(candidates, candidates + candidate_count);
+    const uint32_t* sorted = overflow.size() != 0 ? overflow.data() : candidates;
+    size_t sorted_count = overflow.size() != 0 ? overflow.size() : candidate_count;
+
+    float closest_distance = std::numeric_limits<float>::infinity();
+    float densest = 0.0f;
+    int best = -1;
+    for(size_t j = 0; j < sorted_count; ++j)
+    {
+        const grid& entry = grids[sorted[j]];
+        float distance = entry.g->point_distance(entry.pos_from_world, pos);
+        if(distance >= 0 && distance <= closest_distance)
+        {
+            closest_distance = distance;
+            if(distance == 0)
+            {
+                if(entry.density > densest)
+                {
+                    densest = entry.density;
+                    best = sorted[j];
+                }
+            }
+            else best = sorted[j];
+        }
+    }
+    return best >= 0 ? best : largest;
+}
+
+void sh_grid_bvh::build(uint32_t node_index, uint32_t begin, uint32_t end)
+{
+    constexpr uint32_t MAX_LEAF_SIZE = 4;
+
+    aabb bounds = {vec3(INFINITY), vec3(-INFINITY)};
+    aabb centroid_bounds = bounds;
+    for(uint32_t j = begin; j < end; ++j)
+    {
+        const aabb& b = grids[grid_order[j]].bounds;
+        bounds.min = min(bounds.min, b.min);
+        bounds.max = max(bounds.max, b.max);
+        vec3 centroid = (b.min + b.max) * 0.5f;
+        centroid_bounds.min = min(centroid_bounds.min, centroid);
+        centroid_bounds.max = max(centroid_bounds.max, centroid);
+    }
+    nodes[node_index].bounds = bounds;
+
+    vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    if(end - begin <= MAX_LEAF_SIZE || all(equal(extent, vec3(0))))
+    {
+        nodes[node_index].first = begin;
+        nodes[node_index].count = end - begin;
+        return;
+    }
+
+    // Median split along the longest axis keeps the tree balanced, so the
+    // traversal stack in find() can't overflow.
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) :
+        (extent.y > extent.z ? 1 : 2);
+    uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(
+        grid_order.begin() + begin,
+        grid_order.begin() + mid,
+        grid_order.begin() + end,
+        [&](uint32_t a, uint32_t b){
+            const aabb& ba = grids[a].bounds;
+            const aabb& bb = grids[b].bounds;
+            return ba.min[axis] + ba.max[axis] < bb.min[axis] + bb.max[axis];
+        }
+    );
+
+    uint32_t children = nodes.size();
+    nodes[node_index].first = children;
+    nodes[node_index].count = 0;
+    nodes.resize(children + 2);
+    build(children, begin, mid);
+    build(children+1, mid, end);
+}
+
 }
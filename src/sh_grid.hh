@@ -2,6 +2,7 @@
 #define TR_SH_GRID_HH
 #include "texture.hh"
 #include "transformable.hh"
+#include "scene.hh"
 #include <vector>
 
 namespace tr
@@ -46,6 +47,8 @@ public:
     // Negative: out of influence. Zero: fully in influence. Positive: outside,
     // but within radius.
     float point_distance(transformable& self, vec3 p) const;
+    // Same, but with the inverse of the global transform given directly.
+    float point_distance(const mat4& pos_from_world, vec3 p) const;
     float calc_density(transformable& self) const;
     float calc_volume(transformable& self) const;
 
@@ -55,6 +58,52 @@ private:
     uvec3 resolution;
 };
 
+// Bounding volume hierarchy over the influence regions of all SH grids in a
+// scene, for picking the grid of many points quickly. Queries give the same
+// results as get_sh_grid(), falling back to get_largest_sh_grid(). Only
+// update() touches the scene, so find() can be called from multiple threads.
+class sh_grid_bvh
+{
+public:
+    sh_grid_bvh();
+
+    // Rebuilds the hierarchy if grids were added, removed, moved, resized or
+    // changed resolution since the last call. Returns true if that happened.
+    bool update(scene& s);
+
+    // Returns the index of the grid in scene iteration order, or -1 if there
+    // are no grids.
+    int find(vec3 pos) const;
+
+private:
+    struct grid
+    {
+        const sh_grid* g;
+        mat4 transform;
+        float radius;
+        // The density depends on this.
+        uvec3 resolution;
+        mat4 pos_from_world;
+        float density;
+        aabb bounds;
+    };
+    struct node
+    {
+        aabb bounds;
+        // Leaves refer to grid_order[first...first+count-1], inner nodes have
+        // their children at 'first' and 'first+1'.
+        uint32_t first;
+        uint32_t count;
+    };
+
+    void build(uint32_t node_index, uint32_t begin, uint32_t end);
+
+    std::vector<grid> grids;
+    std::vector<uint32_t> grid_order;
+    std::vector<node> nodes;
+    int largest;
+};
+
 }
 
 #endif
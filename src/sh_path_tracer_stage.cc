@@ -20,10 +20,16 @@ struct grid_data_buffer
 
 namespace sh_path_tracer
 {
-    rt_shader_sources load_sources(const sh_path_tracer_stage::options& opt)
-    {
-        shader_source pl_rint("shader/path_tracer_point_light.rint");
-        shader_source shadow_chit("shader/path_tracer_shadow.rchit");
+    rt_shader_sources load_sources(
+        device& dev,
+        const sh_path_tracer_stage::options& opt
+    ){
+        shader_source pl_rint = shader_source::deferred(
+            "shader/path_tracer_point_light.rint"
+        );
+        shader_source shadow_chit = shader_source::deferred(
+            "shader/path_tracer_shadow.rchit"
+        );
         std::map<std::string, std::string> defines;
         defines["MAX_BOUNCES"] = std::to_string(opt.max_ray_depth);
 
@@ -44,22 +50,22 @@ namespace sh_path_tracer
 
         rt_stage::get_common_defines(defines, opt);
 
-        return {
-            {"shader/sh_path_tracer.rgen", defines},
+        rt_shader_sources src = {
+            shader_source::deferred("shader/sh_path_tracer.rgen", defines),
             {
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                    {"shader/path_tracer.rchit"},
-                    {"shader/path_tracer.rahit"}
+                    shader_source::deferred("shader/path_tracer.rchit"),
+                    shader_source::deferred("shader/path_tracer.rahit")
                 },
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
                     shadow_chit,
-                    {"shader/path_tracer_shadow.rahit"}
+                    shader_source::deferred("shader/path_tracer_shadow.rahit")
                 },
                 {
                     vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup,
-                    {"shader/path_tracer_point_light.rchit"},
+                    shader_source::deferred("shader/path_tracer_point_light.rchit"),
                     {},
                     pl_rint
                 },
@@ -71,10 +77,12 @@ namespace sh_path_tracer
                 }
             },
             {
-                {"shader/path_tracer.rmiss"},
-                {"shader/path_tracer_shadow.rmiss"}
+                shader_source::deferred("shader/path_tracer.rmiss"),
+                shader_source::deferred("shader/path_tracer_shadow.rmiss")
             }
         };
+        compile_shaders(src, dev.ctx->get_thread_pool());
+        return src;
     }
 
     struct push_constant_buffer
@@ -108,7 +116,9 @@ sh_path_tracer_stage::sh_path_tracer_stage(
     vk::ImageLayout output_layout,
     const options& opt
 ):  rt_stage(dev, ss, opt, "SH path tracing", 1),
-    gfx(dev, rt_stage::get_common_options(sh_path_tracer::load_sources(opt), opt)),
+    gfx(dev, rt_stage::get_common_options(
+        sh_path_tracer::load_sources(dev, opt), opt
+    )),
     opt(opt),
     output_grid(&output_grid),
     output_layout(output_layout),
@@ -148,7 +158,7 @@ void sh_path_tracer_stage::init_scene_resources()
 {
     rt_stage::init_scene_resources();
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         ss->bind(gfx, i, -1);
         gfx.update_descriptor_set({
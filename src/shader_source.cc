@@ -9,7 +9,12 @@
 #include "spirv_reflect.h"
 
 #include <filesystem>
+#include <mutex>
+#include <future>
+#include <cstring>
+#include <cstdio>
 #include "misc.hh"
+#include "log.hh"
 namespace fs = std::filesystem;
 
 namespace
@@ -120,6 +125,256 @@ void append_shader_names(
     }
 }
 
+// Bump this whenever the disk cache layout or the compiler options change.
+constexpr uint32_t DISK_CACHE_VERSION = 1;
+constexpr uint32_t DISK_CACHE_MAGIC = 0x56505354; // "TSPV"
+
+struct included_file
+{
+    std::string path;
+    uint64_t hash;
+};
+
+// Remembers every file glslang includes, so that the disk cache can be
+// invalidated when any of them changes.
+class recording_includer: public DirStackFileIncluder
+{
+public:
+    std::vector<included_file> included;
+
+    IncludeResult* includeLocal(
+        const char* header_name,
+        const char* includer_name,
+        size_t inclusion_depth
+    ) override
+    {
+        return record(DirStackFileIncluder::includeLocal(
+            header_name, includer_name, inclusion_depth
+        ));
+    }
+
+    IncludeResult* includeSystem(
+        const char* header_name,
+        const char* includer_name,
+        size_t inclusion_depth
+    ) override
+    {
+        return record(DirStackFileIncluder::includeSystem(
+            header_name, includer_name, inclusion_depth
+        ));
+    }
+
+private:
+    IncludeResult* record(IncludeResult* res)
+    {
+        if(res && res->headerData)
+        {
+            std::error_code ec;
+            fs::path path = fs::absolute(res->headerName, ec);
+            included.push_back({
+                ec ? res->headerName : path.string(),
+                hash_data(res->headerData, res->headerLength)
+            });
+        }
+        return res;
+    }
+};
+
+struct cache_writer
+{
+    std::vector<uint8_t> data;
+
+    void write(const void* ptr, size_t size)
+    {
+        data.insert(data.end(), (const uint8_t*)ptr, (const uint8_t*)ptr + size);
+    }
+
+    void write_u32(uint32_t v) { write(&v, sizeof(v)); }
+    void write_u64(uint64_t v) { write(&v, sizeof(v)); }
+
+    void write_string(const std::string& str)
+    {
+        write_u32(str.size());
+        write(str.data(), str.size());
+    }
+};
+
+// All reads are bounds-checked, a truncated or corrupted file just makes the
+// reader fail.
+struct cache_reader
+{
+    const std::vector<uint8_t>& data;
+    size_t offset = 0;
+    bool failed = false;
+
+    void read(void* ptr, size_t size)
+    {
+        if(failed || offset + size > data.size())
+        {
+            failed = true;
+            memset(ptr, 0, size);
+            return;
+        }
+        memcpy(ptr, data.data() + offset, size);
+        offset += size;
+    }
+
+    uint32_t read_u32() { uint32_t v; read(&v, sizeof(v)); return v; }
+    uint64_t read_u64() { uint64_t v; read(&v, sizeof(v)); return v; }
+
+    std::string read_string()
+    {
+        uint32_t size = read_u32();
+        if(failed || offset + size > data.size())
+        {
+            failed = true;
+            return {};
+        }
+        std::string str((const char*)data.data() + offset, size);
+        offset += size;
+        return str;
+    }
+};
+
+std::string get_disk_cache_path(
+    const std::string& cache_dir,
+    const std::string& src,
+    const std::string& ext,
+    const std::string& dir_path
+){
+    // The include directory is part of the key, since it changes what the
+    // includes in the source resolve to.
+    uint64_t hash = hash_data(src.data(), src.size());
+    hash = hash_data(ext.data(), ext.size(), hash);
+    hash = hash_data(dir_path.data(), dir_path.size(), hash);
+    hash = hash_data(&DISK_CACHE_VERSION, sizeof(DISK_CACHE_VERSION), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)hash);
+    return (fs::path(cache_dir) / name).string();
+}
+
+void write_disk_cache(
+    const std::string& cache_path,
+    const shader_source& shader,
+    const std::vector<included_file>& included
+){
+    cache_writer w;
+    w.write_u32(DISK_CACHE_MAGIC);
+    w.write_u32(DISK_CACHE_VERSION);
+
+    w.write_u32(included.size());
+    for(const included_file& inc: included)
+    {
+        w.write_string(inc.path);
+        w.write_u64(inc.hash);
+    }
+
+    w.write_u32(shader.bindings.size());
+    for(const vk::DescriptorSetLayoutBinding& b: shader.bindings)
+    {
+        w.write_u32(b.binding);
+        w.write_u32((uint32_t)b.descriptorType);
+        w.write_u32(b.descriptorCount);
+        w.write_u32((uint32_t)b.stageFlags);
+    }
+
+    w.write_u32(shader.binding_names.size());
+    for(const auto& pair: shader.binding_names)
+    {
+        w.write_string(pair.first);
+        w.write_u32(pair.second);
+    }
+
+    w.write_u32(shader.push_constant_ranges.size());
+    for(const vk::PushConstantRange& r: shader.push_constant_ranges)
+    {
+        w.write_u32((uint32_t)r.stageFlags);
+        w.write_u32(r.offset);
+        w.write_u32(r.size);
+    }
+
+    w.write_u32(shader.data.size());
+    w.write(shader.data.data(), shader.data.size() * sizeof(uint32_t));
+
+    if(!write_binary_file(cache_path, w.data.data(), w.data.size()))
+        TR_WARN("Failed to write shader cache file ", cache_path);
+}
+
+bool included_file_unchanged(const included_file& inc)
+{
+    std::vector<uint8_t> data;
+    if(!try_load_binary_file(inc.path, data))
+        return false;
+    return hash_data(data.data(), data.size()) == inc.hash;
+}
+
+bool read_disk_cache(const std::string& cache_path, shader_source& shader)
+{
+    std::vector<uint8_t> data;
+    if(!try_load_binary_file(cache_path, data))
+        return false;
+
+    cache_reader r{data};
+    if(r.read_u32() != DISK_CACHE_MAGIC || r.read_u32() != DISK_CACHE_VERSION)
+        return false;
+
+    uint32_t count = r.read_u32();
+    for(uint32_t i = 0; i < count && !r.failed; ++i)
+    {
+        included_file inc;
+        inc.path = r.read_string();
+        inc.hash = r.read_u64();
+        if(r.failed || !included_file_unchanged(inc))
+            return false;
+    }
+
+    shader_source res;
+    count = r.read_u32();
+    for(uint32_t i = 0; i < count && !r.failed; ++i)
+    {
+        vk::DescriptorSetLayoutBinding& b = res.bindings.emplace_back();
+        b.binding = r.read_u32();
+        b.descriptorType = vk::DescriptorType(r.read_u32());
+        b.descriptorCount = r.read_u32();
+        b.stageFlags = vk::ShaderStageFlags(r.read_u32());
+    }
+
+    count = r.read_u32();
+    for(uint32_t i = 0; i < count && !r.failed; ++i)
+    {
+        std::string name = r.read_string();
+        res.binding_names[name] = r.read_u32();
+    }
+
+    count = r.read_u32();
+    for(uint32_t i = 0; i < count && !r.failed; ++i)
+    {
+        vk::PushConstantRange& range = res.push_constant_ranges.emplace_back();
+        range.stageFlags = vk::ShaderStageFlags(r.read_u32());
+        range.offset = r.read_u32();
+        range.size = r.read_u32();
+    }
+
+    count = r.read_u32();
+    if(r.failed || count > (data.size() - r.offset) / sizeof(uint32_t))
+        return false;
+    res.data.resize(count);
+    r.read(res.data.data(), count * sizeof(uint32_t));
+
+    if(r.failed || r.offset != data.size())
+        return false;
+
+    shader = std::move(res);
+    return true;
+}
+
+void compile_all(const std::vector<shader_source*>& shaders, thread_pool& pool)
+{
+    pool.parallel_for(shaders.size(), [&](size_t i){
+        shaders[i]->compile();
+    });
+}
 
 }
 
@@ -127,12 +382,46 @@ namespace tr
 {
 
 // Ad-hoc binary caching :P SPIR-V is platform independent, so the same
-// "binaries" are fine on all GPUs.
-static std::map<std::string, shader_source> binaries;
+// "binaries" are fine on all GPUs. Shaders that are still being compiled on
+// another thread are in the map as well, so that they are only compiled once.
+static std::mutex binaries_mutex;
+static std::map<std::string, std::shared_future<shader_source>> binaries;
+static std::string disk_cache_dir;
+
+// glslang must only be initialized once per process for multithreaded use.
+static std::once_flag glslang_init_flag;
 
 shader_source::shader_source(
     const std::string& path,
     const std::map<std::string, std::string>& defines
+){
+    load(path, defines);
+}
+
+shader_source shader_source::deferred(
+    const std::string& path,
+    const std::map<std::string, std::string>& defines
+){
+    shader_source res;
+    res.deferred_path = path;
+    res.deferred_defines = defines;
+    return res;
+}
+
+void shader_source::compile()
+{
+    if(deferred_path.empty()) return;
+
+    std::string path = std::move(deferred_path);
+    std::map<std::string, std::string> defines = std::move(deferred_defines);
+    deferred_path.clear();
+    deferred_defines.clear();
+    load(path, defines);
+}
+
+void shader_source::load(
+    const std::string& path,
+    const std::map<std::string, std::string>& defines
 ){
     std::string res_path = get_resource_path(path);
     fs::path fs_path(res_path);
@@ -152,109 +441,183 @@ shader_source::shader_source(
         src = src.substr(0, offset) + definition_src + src.substr(offset);
     }
 
-    auto it = binaries.find(src);
-    if(it == binaries.end())
+    std::promise<shader_source> promise;
     {
-        glslang::InitializeProcess();
+        std::unique_lock lk(binaries_mutex);
+        auto it = binaries.find(src);
+        if(it != binaries.end())
+        {
+            std::shared_future<shader_source> binary = it->second;
+            lk.unlock();
+            operator=(binary.get());
+            return;
+        }
+        binaries[src] = promise.get_future().share();
+    }
 
-        // Prepare the shader source for glslang
-        EShLanguage type = detect_shader_language(ext);
-        glslang::TShader shader(type);
-        const char* c_str = src.c_str();
-        shader.setStrings(&c_str, 1);
-        shader.setEnvInput(glslang::EShSourceGlsl, type, glslang::EShClientVulkan, 100);
-        shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
-        shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
+    try
+    {
+        build(path, src, ext, dir_path);
+    }
+    catch(...)
+    {
+        // Failed shaders are not cached, so that they can be fixed and
+        // reloaded. Anyone already waiting for this one gets the error too.
+        {
+            std::unique_lock lk(binaries_mutex);
+            binaries.erase(src);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    promise.set_value(*this);
+}
 
-        TBuiltInResource resources = glslang::DefaultTBuiltInResource;
+void shader_source::build(
+    const std::string& path,
+    const std::string& src,
+    const std::string& ext,
+    const std::string& dir_path
+){
+    std::string cache_path;
+    if(!disk_cache_dir.empty())
+    {
+        cache_path = get_disk_cache_path(disk_cache_dir, src, ext, dir_path);
+        if(read_disk_cache(cache_path, *this))
+            return;
+    }
 
-        EShMessages messages = (EShMessages)(EShMsgSpvRules|EShMsgVulkanRules);
+    std::call_once(glslang_init_flag, [](){ glslang::InitializeProcess(); });
 
-        // Preprocessing
-        DirStackFileIncluder includer;
-        includer.pushExternalLocalDirectory(dir_path);
+    // Prepare the shader source for glslang
+    EShLanguage type = detect_shader_language(ext);
+    glslang::TShader shader(type);
+    const char* c_str = src.c_str();
+    shader.setStrings(&c_str, 1);
+    shader.setEnvInput(glslang::EShSourceGlsl, type, glslang::EShClientVulkan, 100);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
+    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
 
-        // Compiling
-        if(!shader.parse(&resources, 100, ENoProfile, false, false, messages, includer))
-            throw std::runtime_error(
-                "Failed to compile " + path + ": " + shader.getInfoLog()
-            );
+    TBuiltInResource resources = glslang::DefaultTBuiltInResource;
 
-        glslang::TProgram program;
-        program.addShader(&shader);
+    EShMessages messages = (EShMessages)(EShMsgSpvRules|EShMsgVulkanRules);
 
-        if(!program.link(messages))
-            throw std::runtime_error(
-                "Failed to link " + path + ": " + shader.getInfoLog()
-            );
+    // Preprocessing
+    recording_includer includer;
+    includer.pushExternalLocalDirectory(dir_path);
 
-        spv::SpvBuildLogger logger;
-        glslang::SpvOptions options;
-        options.generateDebugInfo = true;
-        glslang::GlslangToSpv(
-            *program.getIntermediate(type), data, &logger, &options
+    // Compiling
+    if(!shader.parse(&resources, 100, ENoProfile, false, false, messages, includer))
+        throw std::runtime_error(
+            "Failed to compile " + path + ": " + shader.getInfoLog()
         );
 
-        glslang::FinalizeProcess();
+    glslang::TProgram program;
+    program.addShader(&shader);
 
-        // glslang has built-in reflection, but it's crap! It doesn't find all
-        // things, like blocks that contain unsized arrays. That's why we have
-        // to use a separate library for this.
-        vk::ShaderStageFlags stage = detect_shader_stage(ext);
-
-        SpvReflectShaderModule mod;
-        SpvReflectResult res = spvReflectCreateShaderModule(
-            data.size() * sizeof(data[0]),
-            data.data(),
-            &mod
+    if(!program.link(messages))
+        throw std::runtime_error(
+            "Failed to link " + path + ": " + shader.getInfoLog()
         );
-        if(res != SPV_REFLECT_RESULT_SUCCESS)
-            throw std::runtime_error(
-                "Failed to reflect " + path + ": " + std::to_string(res)
-            );
-
-        // Determine descriptor bindings
-        uint32_t count = 0;
-        spvReflectEnumerateDescriptorBindings(&mod, &count, nullptr);
-        std::vector<SpvReflectDescriptorBinding*> bindings(count);
-        spvReflectEnumerateDescriptorBindings(&mod, &count, bindings.data());
-        for(auto* binding: bindings)
-        {
-            this->bindings.push_back({
-                binding->binding,
-                vk::DescriptorType(binding->descriptor_type),
-                binding->count,
-                stage
-            });
-            this->binding_names[binding->name] = binding->binding;
-        }
 
-        // Determine push constant range
-        spvReflectEnumeratePushConstantBlocks(&mod, &count, nullptr);
-        std::vector<SpvReflectBlockVariable*> push_constant_blocks(count);
-        spvReflectEnumeratePushConstantBlocks(
-            &mod, &count, push_constant_blocks.data()
+    spv::SpvBuildLogger logger;
+    glslang::SpvOptions options;
+    options.generateDebugInfo = true;
+    glslang::GlslangToSpv(
+        *program.getIntermediate(type), data, &logger, &options
+    );
+
+    // glslang has built-in reflection, but it's crap! It doesn't find all
+    // things, like blocks that contain unsized arrays. That's why we have
+    // to use a separate library for this.
+    vk::ShaderStageFlags stage = detect_shader_stage(ext);
+
+    SpvReflectShaderModule mod;
+    SpvReflectResult res = spvReflectCreateShaderModule(
+        data.size() * sizeof(data[0]),
+        data.data(),
+        &mod
+    );
+    if(res != SPV_REFLECT_RESULT_SUCCESS)
+        throw std::runtime_error(
+            "Failed to reflect " + path + ": " + std::to_string(res)
         );
 
-        for(auto* pc: push_constant_blocks)
-        {
-            this->push_constant_ranges.push_back({
-                stage, pc->offset, pc->size
-            });
-        }
+    // Determine descriptor bindings
+    uint32_t count = 0;
+    spvReflectEnumerateDescriptorBindings(&mod, &count, nullptr);
+    std::vector<SpvReflectDescriptorBinding*> bindings(count);
+    spvReflectEnumerateDescriptorBindings(&mod, &count, bindings.data());
+    for(auto* binding: bindings)
+    {
+        this->bindings.push_back({
+            binding->binding,
+            vk::DescriptorType(binding->descriptor_type),
+            binding->count,
+            stage
+        });
+        this->binding_names[binding->name] = binding->binding;
+    }
 
-        spvReflectDestroyShaderModule(&mod);
+    // Determine push constant range
+    spvReflectEnumeratePushConstantBlocks(&mod, &count, nullptr);
+    std::vector<SpvReflectBlockVariable*> push_constant_blocks(count);
+    spvReflectEnumeratePushConstantBlocks(
+        &mod, &count, push_constant_blocks.data()
+    );
 
-        binaries[src] = *this;
+    for(auto* pc: push_constant_blocks)
+    {
+        this->push_constant_ranges.push_back({
+            stage, pc->offset, pc->size
+        });
     }
-    else operator=(it->second);
+
+    spvReflectDestroyShaderModule(&mod);
+
+    if(!cache_path.empty())
+        write_disk_cache(cache_path, *this, includer.included);
 }
 
 void shader_source::clear_binary_cache()
 {
+    std::unique_lock lk(binaries_mutex);
     binaries.clear();
 }
 
+void shader_source::set_disk_cache(const std::string& dir)
+{
+    disk_cache_dir = dir;
+    if(dir.empty()) return;
+
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if(ec)
+    {
+        TR_WARN("Unable to create shader cache directory ", dir, ": ", ec.message());
+        disk_cache_dir.clear();
+    }
+}
+
+void compile_shaders(rt_shader_sources& src, thread_pool& pool)
+{
+    std::vector<shader_source*> shaders = {&src.rgen};
+    for(rt_shader_sources::hit_group& hg: src.rhit)
+    {
+        shaders.push_back(&hg.rchit);
+        shaders.push_back(&hg.rahit);
+        shaders.push_back(&hg.rint);
+    }
+    for(shader_source& s: src.rmiss)
+        shaders.push_back(&s);
+    compile_all(shaders, pool);
+}
+
+void compile_shaders(raster_shader_sources& src, thread_pool& pool)
+{
+    compile_all({&src.vert, &src.frag}, pool);
+}
+
 std::map<std::string, uint32_t> get_binding_names(const rt_shader_sources& src)
 {
     std::map<std::string, uint32_t> names;
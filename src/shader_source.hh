@@ -20,6 +20,14 @@ struct shader_source
         const std::map<std::string, std::string>& defines = {}
     );
 
+    // Only records the path and defines, the shader is compiled later by
+    // compile() or compile_shaders(). This allows compiling whole shader sets
+    // in parallel.
+    static shader_source deferred(
+        const std::string& path,
+        const std::map<std::string, std::string>& defines = {}
+    );
+
     shader_source(const shader_source& other) = default;
     shader_source(shader_source&& other) = default;
 
@@ -31,7 +39,31 @@ struct shader_source
     std::vector<vk::PushConstantRange> push_constant_ranges;
     std::vector<uint32_t> data;
 
+    // Compiles a deferred shader. Does nothing if the shader is already
+    // compiled or empty. Safe to call from multiple threads for different
+    // shaders.
+    void compile();
+
     static void clear_binary_cache();
+    // Compiled shaders are additionally stored in the given directory and
+    // reused in later runs, as long as neither the shader nor any of its
+    // included files have changed. An empty path disables the disk cache.
+    static void set_disk_cache(const std::string& dir);
+
+private:
+    void load(
+        const std::string& path,
+        const std::map<std::string, std::string>& defines
+    );
+    void build(
+        const std::string& path,
+        const std::string& src,
+        const std::string& ext,
+        const std::string& dir_path
+    );
+
+    std::string deferred_path;
+    std::map<std::string, std::string> deferred_defines;
 };
 
 struct raster_shader_sources
@@ -58,6 +90,10 @@ struct rt_shader_sources
 };
 
 
+// Compiles all deferred shaders of the set concurrently on the given pool.
+void compile_shaders(rt_shader_sources& src, thread_pool& pool);
+void compile_shaders(raster_shader_sources& src, thread_pool& pool);
+
 std::map<std::string /* name */, uint32_t /* binding */>
     get_binding_names(const rt_shader_sources& src);
 
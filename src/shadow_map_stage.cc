@@ -159,7 +159,7 @@ void shadow_map_stage::update(uint32_t frame_index)
     {
         clear_commands();
         const std::vector<scene_stage::instance>& instances = ss->get_instances();
-        for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
         {
             // Bind descriptors
             ss->bind(*gfx, i, -1);
@@ -216,7 +216,7 @@ void shadow_map_stage::update(uint32_t frame_index)
 
                     gfx->push_constants(cb, control);
 
-                    cb.drawIndexed(m->get_indices().size(), 1, 0, 0, 0);
+                    cb.drawIndexed(m->get_index_count(), 1, 0, 0, 0);
                 }
                 cb.endRenderPass();
 
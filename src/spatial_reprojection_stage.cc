@@ -61,7 +61,7 @@ spatial_reprojection_stage::spatial_reprojection_stage(
     this->target_viewport.color.layout = vk::ImageLayout::eUndefined;
 
     clear_commands();
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev.ctx->get_frames_in_flight(); ++i)
     {
         comp.update_descriptor_set({
             {"camera_data", {camera_data[dev.id], 0, VK_WHOLE_SIZE}},
@@ -43,11 +43,19 @@ dependencies multi_device_stage::run(dependencies deps)
 
     for(auto[dev, c]: buffers)
     {
-        dev.ctx->get_progress_tracker().set_timeline(dev.id, c.progress, c.command_buffers[cb_index].size());
+        // Per-frame commands go first, they usually upload data for the
+        // recorded ones.
+        std::vector<const vkm<vk::CommandBuffer>*> cmds;
+        for(const vkm<vk::CommandBuffer>& cmd: c.frame_command_buffers)
+            cmds.push_back(&cmd);
+        for(const vkm<vk::CommandBuffer>& cmd: c.command_buffers[cb_index])
+            cmds.push_back(&cmd);
 
-        for(size_t i = 0; i < c.command_buffers[cb_index].size(); ++i)
+        dev.ctx->get_progress_tracker().set_timeline(dev.id, c.progress, cmds.size());
+
+        for(const vkm<vk::CommandBuffer>* cmd_ptr: cmds)
         {
-            const vkm<vk::CommandBuffer>& cmd = c.command_buffers[cb_index][i];
+            const vkm<vk::CommandBuffer>& cmd = *cmd_ptr;
 
             vk::TimelineSemaphoreSubmitInfo timeline_info = deps.get_timeline_info(dev.id);
             c.local_step_counter++;
@@ -70,6 +78,8 @@ dependencies multi_device_stage::run(dependencies deps)
             deps.clear(dev.id);
             deps.add({dev.id, *c.progress, c.local_step_counter});
         }
+        // Destruction is deferred until the frame has finished.
+        c.frame_command_buffers.clear();
     }
 
     return deps;
@@ -153,6 +163,19 @@ void multi_device_stage::end_commands(vk::CommandBuffer buf, vk::CommandPool poo
     buffers[id].command_buffers[index].emplace_back(buffers.get_device(id), buf, pool);
 }
 
+vk::CommandBuffer multi_device_stage::begin_frame_commands(device_id id)
+{
+    return begin_commands(buffers.get_device(id).graphics_pool, id, true);
+}
+
+void multi_device_stage::end_frame_commands(vk::CommandBuffer buf, device_id id)
+{
+    buf.end();
+    buffers[id].frame_command_buffers.emplace_back(
+        buffers.get_device(id), buf, buffers.get_device(id).graphics_pool
+    );
+}
+
 void multi_device_stage::clear_commands()
 {
     for(auto[d, c]: buffers)
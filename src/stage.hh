@@ -40,6 +40,12 @@ protected:
     vk::CommandBuffer begin_transfer(device_id id, bool single_use = false);
     void end_transfer(vk::CommandBuffer buf, device_id id, uint32_t frame_index, uint32_t swapchain_index = 0);
 
+    // Graphics commands that are only submitted once, for the current frame,
+    // before the recorded ones. Meant for recording in update() when the
+    // commands change every frame, such as partial uploads.
+    vk::CommandBuffer begin_frame_commands(device_id id);
+    void end_frame_commands(vk::CommandBuffer buf, device_id id);
+
     void clear_commands();
 
 private:
@@ -49,6 +55,7 @@ private:
     struct cb_data
     {
         std::vector<std::vector<vkm<vk::CommandBuffer>>> command_buffers;
+        std::vector<vkm<vk::CommandBuffer>> frame_command_buffers;
         uint64_t local_step_counter = 0;
         vkm<vk::Semaphore> progress;
     };
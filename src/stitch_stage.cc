@@ -126,7 +126,7 @@ void stitch_stage::record_commands()
     while(!params[primary_index].primary)
         primary_index++;
 
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         // Record command buffer
         vk::CommandBuffer cb = begin_compute();
@@ -100,7 +100,7 @@ void svgf_stage::init_resources()
     atrous_diffuse_pingpong[0]  = render_target_texture[rt_index++]->get_array_render_target(dev->id);
     atrous_diffuse_pingpong[1]  = render_target_texture[rt_index++]->get_array_render_target(dev->id);
 
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         ss->bind(temporal_comp, i);
         temporal_comp.update_descriptor_set({
@@ -136,7 +136,7 @@ void svgf_stage::init_resources()
 void svgf_stage::record_command_buffers()
 {
     clear_commands();
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
 
@@ -80,7 +80,7 @@ void taa_stage::update(uint32_t frame_index)
 
 void taa_stage::init_resources()
 {
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         comp.update_descriptor_set({
             {"current_color", {{}, current_features.color.view, vk::ImageLayout::eGeneral}},
@@ -95,7 +95,7 @@ void taa_stage::record_command_buffers()
 {
     render_target previous_color_rt = previous_color.get_array_render_target(dev->id);
 
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
 
@@ -128,6 +128,37 @@ scene_data load_scenes(context& ctx, const options& opt)
     scene_data data;
     data.s.reset(new scene);
 
+    bool compress_textures = opt.compress_textures;
+    for(device& d: ctx.get_devices())
+    {
+        if(compress_textures && !d.feats.textureCompressionBC)
+        {
+            TR_WARN(
+                "Texture compression disabled, ", d.props.deviceName,
+                " does not support BC formats"
+            );
+            compress_textures = false;
+        }
+    }
+    // Caches are only an optimization, so loading goes on without them if
+    // their directories cannot be created.
+    auto create_cache_dir = [](const std::string& dir, const char* kind){
+        if(dir.size() == 0) return dir;
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        if(ec)
+        {
+            TR_WARN(
+                "Unable to create ", kind, " cache directory ", dir, ": ",
+                ec.message()
+            );
+            return std::string();
+        }
+        return dir;
+    };
+    std::string texture_cache = create_cache_dir(opt.texture_cache, "texture");
+    std::string scene_cache = create_cache_dir(opt.scene_cache, "scene");
+
     for(const std::string& path: opt.scene_paths)
     {
         scene_assets& sa = data.assets.emplace_back();
@@ -136,7 +167,8 @@ scene_data load_scenes(context& ctx, const options& opt)
         if(fsp.extension() == ".gltf" || fsp.extension() == ".glb")
         {
             sa = load_gltf(
-                dev, *data.s, path, opt.force_single_sided, opt.force_double_sided
+                dev, *data.s, path, opt.force_single_sided, opt.force_double_sided,
+                compress_textures, texture_cache, scene_cache
             );
         }
         else
@@ -144,6 +176,11 @@ scene_data load_scenes(context& ctx, const options& opt)
             sa = load_assimp(dev, *data.s, path);
         }
 
+        if(opt.release_mesh_data)
+        {
+            for(auto& m: sa.meshes)
+                m->release_host_data();
+        }
     }
 
     data.s->foreach([&](sh_grid& sg){
@@ -277,6 +314,9 @@ context* create_context(const options& opt)
     ctx_opt.max_timestamps = 128;
     ctx_opt.enable_vulkan_validation = opt.validation;
     ctx_opt.fake_device_multiplier = opt.fake_devices;
+    ctx_opt.pipeline_cache_dir = opt.pipeline_cache;
+    ctx_opt.worker_threads = opt.worker_threads;
+    ctx_opt.frames_in_flight = opt.frames_in_flight;
 
     if(opt.renderer == options::DSHGI_SERVER)
     {
@@ -380,6 +420,11 @@ renderer* create_renderer(context& ctx, options& opt, scene& s)
     scene_options.gather_emissive_triangles = has_tri_lights && opt.sample_emissive_triangles > 0;
     scene_options.pre_transform_vertices = opt.pre_transform_vertices;
     scene_options.group_strategy = opt.as_strategy;
+    scene_options.as_rebuild_interval = opt.as_rebuild_interval;
+    scene_options.as_rebuild_regression = opt.as_rebuild_regression;
+    scene_options.as_rebuilds_per_frame = opt.as_rebuilds_per_frame;
+    scene_options.as_memory_budget = (uint64_t)opt.as_memory_budget*1024*1024;
+    scene_options.as_cluster_triangles = opt.as_cluster_triangles;
 
     taa_stage::options taa;
     taa.blending_ratio = 1.0f - 1.0f/opt.taa.sequence_length;
@@ -718,7 +763,7 @@ void show_stats(scene& s, options& opt)
     uint32_t dyn_obj_count = 0;
     s.foreach([&](transformable& t, model& mod){
         for(auto& group: mod)
-            triangle_count += group.m->get_indices().size() / 3;
+            triangle_count += group.m->get_triangle_count();
         dyn_obj_count += t.is_static() ? 0:1;
     });
     std::cout << "Number of triangles = " << triangle_count << std::endl;
@@ -947,7 +992,10 @@ void interactive_viewer(context& ctx, scene_data& sd, options& opt)
             if(rr) rr->reset_accumulation(false);
         }
 
-        update(s, paused || !opt.animation_flag ? 0 : delta * 1000000);
+        update(
+            s, paused || !opt.animation_flag ? 0 : delta * 1000000, false,
+            &ctx.get_thread_pool()
+        );
 
         try
         {
@@ -1037,9 +1085,20 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
         ctx.get_progress_tracker().begin(popt);
     }
 
+    // With simulate_ahead, the next frame's animations are advanced while
+    // the current frame is being submitted. The scene is only touched by the
+    // simulation task until it is joined, and the rest of the update runs on
+    // this thread afterwards so that event subscribers stay single-threaded.
+    thread_pool& pool = ctx.get_thread_pool();
+    task_group simulation(pool, "simulate ahead");
+    bool simulated_ahead = false;
+    bool playing = true;
+
     for(size_t i = 0; i < frame_count; ++i)
     {
-        if(!opt.frames && is_animated && !is_playing(s))
+        simulation.wait();
+        if(!simulated_ahead) playing = is_playing(s);
+        if(!opt.frames && is_animated && !playing)
             break;
 
         if(!rr)
@@ -1052,7 +1111,7 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
             {
                 if(!opt.skip_render)
                 {
-                    update(s, 0, true);
+                    update(s, 0, true, &ctx.get_thread_pool());
                     rr->render();
                     lb.update(*rr);
                 }
@@ -1065,7 +1124,9 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
 
         // First frame should not update time.
         time_ticks dt = i == 0 ? 0 : update_dt;
-        update(s, dt, true);
+        if(simulated_ahead) finish_update(s, update_dt);
+        else update(s, dt, true, &pool);
+        simulated_ahead = false;
         for(camera_log& clog: camera_logs)
             clog.frame(dt);
 
@@ -1073,6 +1134,18 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
         {
             if(!opt.skip_render && (int)i >= opt.skip_frames)
             {
+                if(opt.simulate_ahead && i+1 < frame_count)
+                {
+                    ctx.queue_frame_submit_callback([&](){
+                        // Checked before advancing, like it would be at the
+                        // start of the next iteration.
+                        playing = is_playing(s);
+                        simulated_ahead = true;
+                        simulation.run([&](){
+                            update_animations(s, update_dt, true, &pool);
+                        });
+                    });
+                }
                 rr->reset_accumulation();
                 rr->render();
                 if(opt.timing) ctx.get_timing().print_last_trace(opt.trace);
@@ -1080,6 +1153,12 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
         }
         catch(vk::OutOfDateKHRError& e)
         {
+            // The frame may have been aborted before its submit callbacks
+            // ran, and they refer to this function's locals.
+            ctx.cancel_frame_submit_callbacks();
+            // The simulation may have been started before presenting failed,
+            // and the renderer must not be torn down while it's running.
+            simulation.wait();
             rr.reset();
             if(window* win = dynamic_cast<window*>(&ctx))
                 win->recreate_swapchains();
@@ -1090,6 +1169,7 @@ void replay_viewer(context& ctx, scene_data& sd, options& opt)
 
         lb.update(*rr);
     }
+    simulation.wait();
 
     if(opt.camera_log != "")
     {
@@ -1122,7 +1202,7 @@ void headless_server(context& ctx, scene_data& sd, options& opt)
         if(ctx.init_frame())
             break;
 
-        update(s, delta * 1000000, true);
+        update(s, delta * 1000000, true, &ctx.get_thread_pool());
 
         rr->reset_accumulation();
 
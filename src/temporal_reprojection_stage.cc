@@ -43,7 +43,7 @@ temporal_reprojection_stage::temporal_reprojection_stage(
 
 void temporal_reprojection_stage::init_resources()
 {
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         comp.update_descriptor_set({
             {"current_color", {{}, current_features.color.view, vk::ImageLayout::eGeneral}},
@@ -60,7 +60,7 @@ void temporal_reprojection_stage::init_resources()
 
 void temporal_reprojection_stage::record_command_buffers()
 {
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         vk::CommandBuffer cb = begin_compute();
 
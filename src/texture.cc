@@ -18,8 +18,10 @@ void create_tex(
     std::vector<vkm<vk::ImageView>>& multiview_block_views,
     vk::ImageCreateInfo info,
     vk::ImageLayout layout,
+    vk::ComponentMapping components,
     size_t data_size,
-    void* pixel_data
+    const void* pixel_data,
+    bool data_has_mipmaps
 ){
     layer_views.clear();
     multiview_block_views.clear();
@@ -28,7 +30,8 @@ void create_tex(
         info,
         layout,
         data_size,
-        pixel_data
+        pixel_data,
+        data_has_mipmaps
     );
 
     vk::ImageViewType base_type = info.imageType == vk::ImageType::e3D ?
@@ -43,7 +46,7 @@ void create_tex(
         img,
         array_type,
         info.format,
-        {},
+        components,
         {
             deduce_aspect_mask(info.format),
             0, info.mipLevels, 0, VK_REMAINING_ARRAY_LAYERS
@@ -221,9 +224,25 @@ namespace tr
 {
 
 texture::texture(device_mask dev, const std::string& path)
-: opaque(false), buffers(dev)
+: precomputed_mip_levels(0), opaque(false), buffers(dev)
+{
+    load_decoded(decode_file(path));
+}
+
+texture::texture(device_mask dev, decoded_image&& img)
+: precomputed_mip_levels(0), opaque(false), buffers(dev)
 {
-    load_from_file(path);
+    load_decoded(std::move(img));
+}
+
+texture::texture(
+    device_mask dev,
+    const decoded_image& img,
+    const void* pixels,
+    size_t pixels_size
+): precomputed_mip_levels(0), opaque(false), buffers(dev)
+{
+    load_decoded(img, pixels, pixels_size);
 }
 
 texture::texture(
@@ -239,7 +258,8 @@ texture::texture(
     vk::SampleCountFlagBits msaa
 ):  dim(size, 1), array_layers(array_layers),
     fmt(fmt), type(vk::ImageType::e2D), tiling(tiling), usage(usage),
-    layout(layout), msaa(msaa), opaque(false), buffers(dev)
+    layout(layout), msaa(msaa), precomputed_mip_levels(0), opaque(false),
+    buffers(dev)
 {
     create(data_size, data);
 }
@@ -253,7 +273,8 @@ texture::texture(
     vk::ImageLayout layout
 ):  dim(dim), array_layers(1), fmt(fmt), type(vk::ImageType::e3D),
     tiling(tiling), usage(usage), layout(layout),
-    msaa(vk::SampleCountFlagBits::e1), opaque(false), buffers(dev)
+    msaa(vk::SampleCountFlagBits::e1), precomputed_mip_levels(0),
+    opaque(false), buffers(dev)
 {
     create(0, nullptr);
 }
@@ -261,7 +282,8 @@ texture::texture(
 texture::texture(texture&& other)
 :   dim(other.dim), array_layers(other.array_layers), fmt(other.fmt),
     type(other.type), tiling(other.tiling), usage(other.usage),
-    layout(other.layout), msaa(other.msaa),
+    layout(other.layout), msaa(other.msaa), components(other.components),
+    precomputed_mip_levels(other.precomputed_mip_levels),
     pixel_data(std::move(other.pixel_data)), opaque(other.opaque),
     buffers(std::move(other.buffers))
 {
@@ -338,6 +360,8 @@ bool texture::potentially_transparent() const
     case vk::Format::eR16G16B16A16Sfloat:
     case vk::Format::eR32G32B32A32Sfloat:
     case vk::Format::eR64G64B64A64Sfloat:
+    case vk::Format::eBc7UnormBlock:
+    case vk::Format::eBc7SrgbBlock:
         return true;
     default:
         return false;
@@ -400,13 +424,14 @@ size_t texture::get_multiview_block_count() const
 void texture::resize(uvec2 size)
 {
     pixel_data.clear();
+    precomputed_mip_levels = 0;
     dim = uvec3(size, 1u);
     create(0, nullptr);
 }
 
-void texture::load_from_file(const std::string& path)
+texture::decoded_image texture::decode_file(const std::string& path)
 {
-    array_layers = 1;
+    decoded_image res;
     fs::path fp(path);
     if(fp.extension().string() == ".exr")
     {
@@ -416,17 +441,17 @@ void texture::load_from_file(const std::string& path)
             throw std::runtime_error("Failed to load texture " + path);
 
         VkDeviceSize size = w*h*n*sizeof(float);
-        pixel_data.resize(size);
-        memcpy(pixel_data.data(), data, size);
+        res.pixels.resize(size);
+        memcpy(res.pixels.data(), data, size);
         free(data);
 
-        this->dim = uvec3(w, h, 1);
-        opaque = n < 4;
+        res.size = uvec2(w, h);
+        res.opaque = n < 4;
 
         if(n == 3)
         {
             float alpha = 1.0f;
-            insert_strided(pixel_data, n*sizeof(float), sizeof(float), &alpha);
+            insert_strided(res.pixels, n*sizeof(float), sizeof(float), &alpha);
             n = 4;
         }
 
@@ -434,25 +459,21 @@ void texture::load_from_file(const std::string& path)
         {
         default:
         case 1:
-            fmt = vk::Format::eR32Sfloat;
+            res.fmt = vk::Format::eR32Sfloat;
             break;
         case 2:
-            fmt = vk::Format::eR32G32Sfloat;
+            res.fmt = vk::Format::eR32G32Sfloat;
             break;
         case 4:
-            fmt = vk::Format::eR32G32B32A32Sfloat;
+            res.fmt = vk::Format::eR32G32B32A32Sfloat;
             break;
         }
-
-        type = vk::ImageType::e2D;
-        tiling = vk::ImageTiling::eOptimal;
-        msaa = vk::SampleCountFlagBits::e1;
-        usage = vk::ImageUsageFlagBits::eSampled;
-        layout = vk::ImageLayout::eShaderReadOnlyOptimal;
     }
     else
     {
-        stbi_set_flip_vertically_on_load(false);
+        // The thread-local flag keeps concurrent decodes from interfering
+        // with each other.
+        stbi_set_flip_vertically_on_load_thread(false);
         bool hdr = stbi_is_hdr(path.c_str());
         int n = 0, w = 0, h = 0;
 
@@ -468,17 +489,17 @@ void texture::load_from_file(const std::string& path)
             data = stbi_load(path.c_str(), &w, &h, &n, 0);
             size = w*h*n;
         }
-        this->dim = uvec3(w, h, 1);
+        res.size = uvec2(w, h);
 
         if(!data)
             throw std::runtime_error("Failed to load texture " + path);
 
-        pixel_data.resize(size);
-        memcpy(pixel_data.data(), data, size);
+        res.pixels.resize(size);
+        memcpy(res.pixels.data(), data, size);
         stbi_image_free(data);
 
         // If there's no alpha channel, the texture is opaque.
-        opaque = n < 4;
+        res.opaque = n < 4;
 
         // Support for 3-channel textures in Vulkan implementations is basically
         // nonexistent, so turn those into 4-channels.
@@ -487,55 +508,81 @@ void texture::load_from_file(const std::string& path)
             if(hdr)
             {
                 float alpha = 1.0f;
-                insert_strided(pixel_data, n*sizeof(float), sizeof(float), &alpha);
+                insert_strided(res.pixels, n*sizeof(float), sizeof(float), &alpha);
             }
             else
             {
                 uint8_t alpha = 255;
-                insert_strided(pixel_data, n*sizeof(uint8_t), sizeof(uint8_t), &alpha);
+                insert_strided(res.pixels, n*sizeof(uint8_t), sizeof(uint8_t), &alpha);
             }
             n = 4;
         }
 
         // Let's use 16-bit floats for hdr images instead of wasting memory with
         // 32-bit data.
-        if(hdr) ::float_to_half(pixel_data);
+        if(hdr) ::float_to_half(res.pixels);
 
         switch(n)
         {
         default:
         case 1:
-            fmt = hdr ? vk::Format::eR16Sfloat : vk::Format::eR8Unorm;
+            res.fmt = hdr ? vk::Format::eR16Sfloat : vk::Format::eR8Unorm;
             break;
         case 2:
-            fmt = hdr ? vk::Format::eR16G16Sfloat : vk::Format::eR8G8Unorm;
+            res.fmt = hdr ? vk::Format::eR16G16Sfloat : vk::Format::eR8G8Unorm;
             break;
         case 3:
-            fmt = hdr ? vk::Format::eR16G16B16Sfloat : vk::Format::eR8G8B8Unorm;
+            res.fmt = hdr ? vk::Format::eR16G16B16Sfloat : vk::Format::eR8G8B8Unorm;
             break;
         case 4:
-            fmt = hdr ? vk::Format::eR16G16B16A16Sfloat : vk::Format::eR8G8B8A8Unorm;
+            res.fmt = hdr ? vk::Format::eR16G16B16A16Sfloat : vk::Format::eR8G8B8A8Unorm;
             break;
         }
-
-        type = vk::ImageType::e2D;
-        tiling = vk::ImageTiling::eOptimal;
-        msaa = vk::SampleCountFlagBits::e1;
-        usage = vk::ImageUsageFlagBits::eSampled;
-        layout = vk::ImageLayout::eShaderReadOnlyOptimal;
     }
+    return res;
+}
+
+void texture::load_decoded(decoded_image&& img)
+{
+    pixel_data = std::move(img.pixels);
+    load_decoded(img, pixel_data.data(), pixel_data.size());
+}
 
-    create(pixel_data.size(), pixel_data.data());
+void texture::load_decoded(
+    const decoded_image& img,
+    const void* pixels,
+    size_t pixels_size
+){
+    dim = uvec3(img.size, 1);
+    array_layers = 1;
+    fmt = img.fmt;
+    type = vk::ImageType::e2D;
+    tiling = vk::ImageTiling::eOptimal;
+    msaa = vk::SampleCountFlagBits::e1;
+    usage = vk::ImageUsageFlagBits::eSampled;
+    layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    opaque = img.opaque;
+    components = img.components;
+    precomputed_mip_levels = img.mip_levels > 1 ? img.mip_levels : 0;
+
+    create(pixels_size, pixels);
 }
 
-void texture::create(size_t data_size, void* data)
+void texture::create(size_t data_size, const void* data)
 {
+    uint32_t mip_levels = 1;
+    if(data)
+    {
+        mip_levels = precomputed_mip_levels != 0 ?
+            precomputed_mip_levels : calculate_mipmap_count(uvec2(dim.x, dim.y));
+    }
+
     vk::ImageCreateInfo img_info{
         {},
         type,
         fmt,
         {(uint32_t)dim.x, (uint32_t)dim.y, (uint32_t)dim.z},
-        data ? calculate_mipmap_count(uvec2(dim.x, dim.y)) : 1,
+        mip_levels,
         array_layers,
         msaa,
         tiling,
@@ -548,7 +595,8 @@ void texture::create(size_t data_size, void* data)
         create_tex(
             dev, array_layers, buf.img, buf.array_view,
             buf.layer_views, buf.multiview_block_views, img_info,
-            layout, data_size, data
+            layout, components, data_size, data,
+            data && precomputed_mip_levels != 0
         );
     }
 }
@@ -6,10 +6,50 @@
 namespace tr
 {
 
+// What a texture is used for. This affects how the mip chain is filtered and
+// which compressed format fits it.
+enum class texture_usage
+{
+    DATA, // Linear values, filtered as-is.
+    COLOR, // sRGB-encoded color.
+    NORMAL, // Tangent-space normal map.
+    METALLIC_ROUGHNESS // glTF layout: roughness in green, metallic in blue.
+};
+
 class texture
 {
 public:
+    // Pixel data decoded from an image file, ready for upload.
+    struct decoded_image
+    {
+        uvec2 size = uvec2(0);
+        vk::Format fmt = vk::Format::eUndefined;
+        bool opaque = false;
+        // If more than one, 'pixels' contains the whole mip chain as laid out
+        // by get_mip_level_offsets(). Otherwise, the mip chain is generated
+        // on the GPU.
+        uint32_t mip_levels = 1;
+        // Applied to the image views, so that compressed formats can put
+        // channels where the shaders expect them.
+        vk::ComponentMapping components = {};
+        std::vector<uint8_t> pixels;
+    };
+
+    // Decoding does not touch Vulkan, so this can be called from worker
+    // threads. Throws if the file cannot be loaded.
+    static decoded_image decode_file(const std::string& path);
+
     texture(device_mask dev, const std::string& path);
+    // Also creates mip chain.
+    texture(device_mask dev, decoded_image&& img);
+    // Same as above, but the pixels are uploaded from the given memory
+    // instead of img.pixels, and no copy of them is kept.
+    texture(
+        device_mask dev,
+        const decoded_image& img,
+        const void* pixels,
+        size_t pixels_size
+    );
     // If no data is given, it is assumed that the texture will be a render
     // target!
     texture(
@@ -64,8 +104,13 @@ protected:
 
 private:
     // Also creates mip chain.
-    void load_from_file(const std::string& path);
-    void create(size_t data_size, void* data);
+    void load_decoded(decoded_image&& img);
+    void load_decoded(
+        const decoded_image& img,
+        const void* pixels,
+        size_t pixels_size
+    );
+    void create(size_t data_size, const void* data);
 
     uvec3 dim;
     unsigned array_layers;
@@ -75,6 +120,9 @@ private:
     vk::ImageUsageFlags usage;
     vk::ImageLayout layout;
     vk::SampleCountFlagBits msaa;
+    vk::ComponentMapping components;
+    // Zero if the mip chain is generated from the first level.
+    uint32_t precomputed_mip_levels;
     std::vector<uint8_t> pixel_data;
     bool opaque;
 
@@ -0,0 +1,471 @@
+#include "texture_compression.hh"
+#include "mipmap.hh"
+#include "misc.hh"
+#include "log.hh"
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+namespace fs = std::filesystem;
+
+namespace
+{
+using namespace tr;
+
+// Bump this whenever the encoders or mipmap filters change, so that old cache entries are not
+// used anymore.
+constexpr uint32_t CACHE_VERSION = 2;
+constexpr uint32_t CACHE_MAGIC = 0x58544354; // "TCTX"
+
+struct cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fmt;
+    uint32_t mip_levels;
+    uint32_t opaque;
+    uint32_t components[4];
+    uint64_t data_size;
+};
+
+// Which source channels go into the encoded block, and how the image views
+// map them back.
+struct encoding
+{
+    vk::Format fmt;
+    unsigned channels[4];
+    vk::ComponentMapping components;
+};
+
+bool select_encoding(
+    unsigned channel_count,
+    texture_usage usage,
+    encoding& enc
+){
+    using cs = vk::ComponentSwizzle;
+    enc.components = {};
+    if(channel_count == 1)
+    {
+        enc.fmt = vk::Format::eBc4UnormBlock;
+        enc.channels[0] = 0;
+    }
+    else if(channel_count == 2)
+    {
+        enc.fmt = vk::Format::eBc5UnormBlock;
+        enc.channels[0] = 0;
+        enc.channels[1] = 1;
+    }
+    else if(channel_count == 4)
+    {
+        switch(usage)
+        {
+        case texture_usage::COLOR:
+            enc.fmt = vk::Format::eBc7UnormBlock;
+            for(unsigned i = 0; i < 4; ++i)
+                enc.channels[i] = i;
+            break;
+        case texture_usage::NORMAL:
+            // BC5 only has two channels, so the shaders reconstruct Z.
+            enc.fmt = vk::Format::eBc5UnormBlock;
+            enc.channels[0] = 0;
+            enc.channels[1] = 1;
+            enc.components = {cs::eR, cs::eG, cs::eZero, cs::eOne};
+            break;
+        case texture_usage::METALLIC_ROUGHNESS:
+            // Roughness is in green and metallic in blue, red is unused.
+            enc.fmt = vk::Format::eBc5UnormBlock;
+            enc.channels[0] = 1;
+            enc.channels[1] = 2;
+            enc.components = {cs::eZero, cs::eR, cs::eG, cs::eOne};
+            break;
+        case texture_usage::DATA:
+            return false;
+        }
+    }
+    else return false;
+    return true;
+}
+
+void fetch_block(
+    const uint8_t* src,
+    uvec2 size,
+    unsigned channel_count,
+    uvec2 block,
+    uint8_t texels[16][4]
+){
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        unsigned x = min(block.x * 4 + i % 4, size.x-1);
+        unsigned y = min(block.y * 4 + i / 4, size.y-1);
+        const uint8_t* texel = src + (y * size.x + x) * channel_count;
+        for(unsigned c = 0; c < 4; ++c)
+            texels[i][c] = c < channel_count ? texel[c] : 0;
+    }
+}
+
+struct bit_writer
+{
+    uint8_t* out;
+    unsigned pos = 0;
+
+    void write(uint32_t value, unsigned bits)
+    {
+        for(unsigned i = 0; i < bits; ++i, ++pos)
+            if((value >> i) & 1)
+                out[pos/8] |= 1 << (pos%8);
+    }
+};
+
+void encode_bc4_block(const uint8_t values[16], uint8_t* out)
+{
+    uint8_t hi = 0, lo = 255;
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        hi = std::max(hi, values[i]);
+        lo = std::min(lo, values[i]);
+    }
+
+    // With hi > lo, the block uses eight interpolated values. If they're equal,
+    // the first palette entry is still exact.
+    int palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for(int i = 2; i < 8; ++i)
+        palette[i] = ((8-i) * hi + (i-1) * lo + 3) / 7;
+
+    memset(out, 0, 8);
+    out[0] = hi;
+    out[1] = lo;
+    bit_writer w{out, 16};
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        unsigned best = 0;
+        int best_err = 256;
+        for(unsigned j = 0; j < 8; ++j)
+        {
+            int err = abs(palette[j] - values[i]);
+            if(err < best_err)
+            {
+                best = j;
+                best_err = err;
+            }
+        }
+        w.write(best, 3);
+    }
+}
+
+// Mode 6 only: one subset with 7.7.7.7 + p-bit endpoints and 4-bit indices.
+// It handles smooth color and alpha well, which is most of what albedo maps
+// contain.
+void encode_bc7_block(const uint8_t texels[16][4], bool opaque, uint8_t* out)
+{
+    static constexpr int weights[16] = {
+        0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+    };
+
+    // Fit a line through the texels along their principal axis.
+    vec4 mean = vec4(0);
+    for(unsigned i = 0; i < 16; ++i)
+        mean += vec4(texels[i][0], texels[i][1], texels[i][2], texels[i][3]);
+    mean /= 16.0f;
+
+    mat4 cov = mat4(0);
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        vec4 d = vec4(texels[i][0], texels[i][1], texels[i][2], texels[i][3]) - mean;
+        cov += glm::outerProduct(d, d);
+    }
+
+    vec4 axis = vec4(1);
+    for(unsigned i = 0; i < 8; ++i)
+    {
+        axis = cov * axis;
+        float len = length(axis);
+        if(len < 1e-6f)
+        {
+            axis = vec4(0);
+            break;
+        }
+        axis /= len;
+    }
+
+    float tmin = 0.0f, tmax = 0.0f;
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        vec4 d = vec4(texels[i][0], texels[i][1], texels[i][2], texels[i][3]) - mean;
+        float t = dot(d, axis);
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+    vec4 ends[2] = {
+        clamp(mean + tmin * axis, vec4(0), vec4(255)),
+        clamp(mean + tmax * axis, vec4(0), vec4(255))
+    };
+
+    // Quantize endpoints, picking the p-bit that fits each one best.
+    int q[2][4];
+    int p[2];
+    int color[2][4];
+    for(unsigned e = 0; e < 2; ++e)
+    {
+        float best_err = -1.0f;
+        for(int pbit = opaque ? 1 : 0; pbit < 2; ++pbit)
+        {
+            float err = 0.0f;
+            int cq[4];
+            for(unsigned c = 0; c < 4; ++c)
+            {
+                cq[c] = clamp((int)std::round((ends[e][c] - pbit) * 0.5f), 0, 127);
+                if(opaque && c == 3) cq[c] = 127;
+                float diff = (cq[c] * 2 + pbit) - ends[e][c];
+                err += diff * diff;
+            }
+            if(best_err < 0.0f || err < best_err)
+            {
+                best_err = err;
+                p[e] = pbit;
+                for(unsigned c = 0; c < 4; ++c)
+                {
+                    q[e][c] = cq[c];
+                    color[e][c] = cq[c] * 2 + pbit;
+                }
+            }
+        }
+    }
+
+    int palette[16][4];
+    for(unsigned i = 0; i < 16; ++i)
+    for(unsigned c = 0; c < 4; ++c)
+        palette[i][c] =
+            ((64 - weights[i]) * color[0][c] + weights[i] * color[1][c] + 32) >> 6;
+
+    unsigned indices[16];
+    for(unsigned i = 0; i < 16; ++i)
+    {
+        int best_err = INT_MAX;
+        for(unsigned j = 0; j < 16; ++j)
+        {
+            int err = 0;
+            for(unsigned c = 0; c < 4; ++c)
+            {
+                int diff = palette[j][c] - texels[i][c];
+                err += diff * diff;
+            }
+            if(err < best_err)
+            {
+                best_err = err;
+                indices[i] = j;
+            }
+        }
+    }
+
+    // The most significant bit of the first index is implicitly zero, so
+    // swap the endpoints if needed.
+    if(indices[0] & 8)
+    {
+        std::swap(q[0], q[1]);
+        std::swap(p[0], p[1]);
+        for(unsigned i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    bit_writer w{out};
+    w.write(1 << 6, 7);
+    for(unsigned c = 0; c < 4; ++c)
+    {
+        w.write(q[0][c], 7);
+        w.write(q[1][c], 7);
+    }
+    w.write(p[0], 1);
+    w.write(p[1], 1);
+    w.write(indices[0], 3);
+    for(unsigned i = 1; i < 16; ++i)
+        w.write(indices[i], 4);
+}
+
+void encode_level(
+    const uint8_t* src,
+    uvec2 size,
+    unsigned channel_count,
+    const encoding& enc,
+    bool opaque,
+    uint8_t* out,
+    thread_pool& pool
+){
+    uvec2 blocks = (size + 3u) / 4u;
+    size_t block_size = enc.fmt == vk::Format::eBc4UnormBlock ? 8 : 16;
+    pool.parallel_for(blocks.y, [&](size_t by){
+        for(unsigned bx = 0; bx < blocks.x; ++bx)
+        {
+            uint8_t texels[16][4];
+            fetch_block(src, size, channel_count, uvec2(bx, by), texels);
+            uint8_t* block = out + (by * blocks.x + bx) * block_size;
+
+            if(enc.fmt == vk::Format::eBc7UnormBlock)
+            {
+                encode_bc7_block(texels, opaque, block);
+                continue;
+            }
+
+            unsigned encoded_channels =
+                enc.fmt == vk::Format::eBc4UnormBlock ? 1 : 2;
+            for(unsigned c = 0; c < encoded_channels; ++c)
+            {
+                uint8_t values[16];
+                for(unsigned i = 0; i < 16; ++i)
+                    values[i] = texels[i][enc.channels[c]];
+                encode_bc4_block(values, block + c * 8);
+            }
+        }
+    });
+}
+
+std::string get_cache_path(
+    const std::string& cache_dir,
+    const texture::decoded_image& img,
+    texture_usage usage,
+    bool compress
+){
+    uint64_t hash = hash_data(img.pixels.data(), img.pixels.size());
+    uint32_t params[6] = {
+        img.size.x, img.size.y, (uint32_t)img.fmt, (uint32_t)usage,
+        (uint32_t)compress, CACHE_VERSION
+    };
+    hash = hash_data(params, sizeof(params), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.trtex", (unsigned long long)hash);
+    return (fs::path(cache_dir) / name).string();
+}
+
+bool read_cache(const std::string& path, texture::decoded_image& img)
+{
+    std::vector<uint8_t> data;
+    if(!try_load_binary_file(path, data) || data.size() < sizeof(cache_header))
+        return false;
+
+    cache_header header;
+    memcpy(&header, data.data(), sizeof(header));
+    if(
+        header.magic != CACHE_MAGIC ||
+        header.version != CACHE_VERSION ||
+        header.data_size != data.size() - sizeof(header)
+    ) return false;
+
+    img.size = uvec2(header.width, header.height);
+    img.fmt = vk::Format(header.fmt);
+    img.mip_levels = header.mip_levels;
+    img.opaque = header.opaque;
+    img.components = {
+        vk::ComponentSwizzle(header.components[0]),
+        vk::ComponentSwizzle(header.components[1]),
+        vk::ComponentSwizzle(header.components[2]),
+        vk::ComponentSwizzle(header.components[3])
+    };
+    img.pixels.assign(data.begin() + sizeof(header), data.end());
+    return true;
+}
+
+void write_cache(const std::string& path, const texture::decoded_image& img)
+{
+    cache_header header = {
+        CACHE_MAGIC, CACHE_VERSION, img.size.x, img.size.y,
+        (uint32_t)img.fmt, img.mip_levels, img.opaque,
+        {
+            (uint32_t)img.components.r, (uint32_t)img.components.g,
+            (uint32_t)img.components.b, (uint32_t)img.components.a
+        },
+        img.pixels.size()
+    };
+    std::vector<uint8_t> data(sizeof(header) + img.pixels.size());
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), img.pixels.data(), img.pixels.size());
+    if(!write_binary_file(path, data.data(), data.size()))
+        TR_WARN("Failed to write texture cache file ", path);
+}
+
+}
+
+namespace tr
+{
+
+bool compress_texture(
+    texture::decoded_image& img,
+    texture_usage usage,
+    thread_pool& pool
+){
+    unsigned channel_count = 0;
+    switch(img.fmt)
+    {
+    case vk::Format::eR8Unorm: channel_count = 1; break;
+    case vk::Format::eR8G8Unorm: channel_count = 2; break;
+    case vk::Format::eR8G8B8A8Unorm: channel_count = 4; break;
+    default: return false;
+    }
+    if(img.size.x == 0 || img.size.y == 0)
+        return false;
+
+    encoding enc;
+    if(!select_encoding(channel_count, usage, enc))
+        return false;
+
+    if(img.mip_levels <= 1)
+        generate_mip_chain(img, usage, pool);
+
+    vk::Extent3D extent(img.size.x, img.size.y, 1);
+    std::vector<size_t> src_offsets = get_mip_level_offsets(
+        img.fmt, extent, img.mip_levels
+    );
+    std::vector<size_t> offsets = get_mip_level_offsets(
+        enc.fmt, extent, img.mip_levels
+    );
+    std::vector<uint8_t> compressed(offsets.back());
+
+    uvec2 size = img.size;
+    for(uint32_t i = 0; i < img.mip_levels; ++i)
+    {
+        encode_level(
+            img.pixels.data() + src_offsets[i], size, channel_count, enc,
+            img.opaque, compressed.data() + offsets[i], pool
+        );
+        size = max(size/2u, uvec2(1));
+    }
+
+    img.fmt = enc.fmt;
+    img.components = enc.components;
+    img.pixels = std::move(compressed);
+    return true;
+}
+
+void prepare_texture(
+    texture::decoded_image& img,
+    texture_usage usage,
+    bool compress,
+    const std::string& cache_dir,
+    thread_pool& pool
+){
+    if(img.mip_levels > 1)
+        return;
+
+    std::string cache_path;
+    if(!cache_dir.empty())
+    {
+        cache_path = get_cache_path(cache_dir, img, usage, compress);
+        if(read_cache(cache_path, img))
+            return;
+    }
+
+    bool prepared = compress && compress_texture(img, usage, pool);
+    if(!prepared)
+        prepared = generate_mip_chain(img, usage, pool);
+    if(!prepared)
+        return;
+
+    if(!cache_path.empty())
+        write_cache(cache_path, img);
+}
+
+}
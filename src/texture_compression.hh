@@ -0,0 +1,34 @@
+#ifndef TAURAY_TEXTURE_COMPRESSION_HH
+#define TAURAY_TEXTURE_COMPRESSION_HH
+#include "texture.hh"
+#include "thread_pool.hh"
+
+namespace tr
+{
+
+// Encodes an 8-bit image into a block-compressed format. The mip chain is
+// generated first if the image doesn't have one yet. Single-channel images
+// always become BC4. Returns false and leaves the image untouched if it cannot
+// be compressed, e.g. because it isn't 8-bit. Doesn't touch Vulkan, so this
+// can be called from worker threads.
+bool compress_texture(
+    texture::decoded_image& img,
+    texture_usage usage,
+    thread_pool& pool
+);
+
+// Gets an image ready for upload: generates its mip chain on the CPU and
+// optionally compresses it. If cache_dir is given, results are stored there
+// and reused instead of processing the image again. Images in unsupported
+// formats are left as-is and get their mipmaps generated on the GPU.
+void prepare_texture(
+    texture::decoded_image& img,
+    texture_usage usage,
+    bool compress,
+    const std::string& cache_dir,
+    thread_pool& pool
+);
+
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include "thread_pool.hh"
+
+namespace
+{
+
+// Lets push() and pop() find the queue of the calling worker.
+thread_local const tr::thread_pool* current_pool = nullptr;
+thread_local int current_worker = -1;
+
+}
+
+namespace tr
+{
+
+thread_pool::thread_pool(unsigned worker_count)
+: queued(0), quit(false)
+{
+    if(worker_count == 0)
+        worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for(unsigned i = 0; i <= worker_count; ++i)
+        queues.emplace_back(new task_queue());
+    for(unsigned i = 0; i < worker_count; ++i)
+        workers.emplace_back(&thread_pool::worker, this, i);
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::unique_lock lk(sleep_mutex);
+        quit = true;
+    }
+    sleep_cv.notify_all();
+    for(std::thread& t: workers)
+        t.join();
+}
+
+unsigned thread_pool::get_worker_count() const
+{
+    return workers.size();
+}
+
+int thread_pool::get_worker_index() const
+{
+    return current_pool == this ? current_worker : -1;
+}
+
+void thread_pool::set_trace_hook(trace_hook hook)
+{
+    this->hook = std::move(hook);
+}
+
+bool thread_pool::run_pending_task()
+{
+    task t;
+    if(!pop(t))
+        return false;
+    execute(t);
+    return true;
+}
+
+void thread_pool::notify_waiters()
+{
+    {
+        std::unique_lock lk(sleep_mutex);
+    }
+    sleep_cv.notify_all();
+}
+
+void thread_pool::push(task&& t)
+{
+    // The count goes up first, so that it never drops below zero in pop().
+    {
+        std::unique_lock lk(sleep_mutex);
+        queued++;
+    }
+    int index = get_worker_index();
+    task_queue& q = *queues[index < 0 ? workers.size() : index];
+    {
+        std::unique_lock lk(q.mutex);
+        q.tasks.emplace_back(std::move(t));
+    }
+    sleep_cv.notify_one();
+}
+
+bool thread_pool::pop(task& t)
+{
+    if(queued == 0)
+        return false;
+
+    // Own tasks are taken from the back, since they're the most likely to
+    // still be in cache. Others are stolen from the front.
+    int index = get_worker_index();
+    if(index >= 0)
+    {
+        task_queue& q = *queues[index];
+        std::unique_lock lk(q.mutex);
+        if(q.tasks.size() != 0)
+        {
+            t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    size_t start = index < 0 ? workers.size() : index+1;
+    for(size_t i = 0; i < queues.size(); ++i)
+    {
+        task_queue& q = *queues[(start + i) % queues.size()];
+        std::unique_lock lk(q.mutex);
+        if(q.tasks.size() != 0)
+        {
+            t = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::execute(task& t)
+{
+    if(hook && t.name)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        t.func();
+        hook(t.name, get_worker_index(), begin, std::chrono::steady_clock::now());
+    }
+    else t.func();
+}
+
+void thread_pool::worker(unsigned index)
+{
+    current_pool = this;
+    current_worker = index;
+    for(;;)
+    {
+        task t;
+        if(pop(t))
+        {
+            execute(t);
+            continue;
+        }
+
+        std::unique_lock lk(sleep_mutex);
+        sleep_cv.wait(lk, [&](){ return quit || queued > 0; });
+        // Remaining tasks are still finished before quitting, someone may
+        // be waiting for them.
+        if(quit && queued == 0) return;
+    }
+}
+
+task_group::task_group(thread_pool& pool, const char* name)
+: pool(pool), name(name), unfinished(0)
+{
+}
+
+task_group::~task_group()
+{
+    pool.wait_until([&](){ return unfinished == 0; });
+}
+
+void task_group::wait()
+{
+    pool.wait_until([&](){ return unfinished == 0; });
+    std::unique_lock lk(error_mutex);
+    if(error)
+    {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+}
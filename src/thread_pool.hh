@@ -0,0 +1,133 @@
+#ifndef TAURAY_THREAD_POOL_HH
+#define TAURAY_THREAD_POOL_HH
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+
+namespace tr
+{
+
+class task_group;
+
+// A fixed set of worker threads for CPU-side work, such as decoding images
+// during scene loading or filling per-frame buffers. Tasks must not create or
+// destroy vkm objects, as their deferred destruction is not thread-safe.
+//
+// Each worker has its own task queue. Tasks spawned by a worker go to its own
+// queue and are taken newest first, while idle workers steal the oldest tasks
+// from others. Threads waiting for tasks to finish run other queued tasks in
+// the meantime, so fork/join can be nested freely.
+class thread_pool
+{
+friend class task_group;
+public:
+    // Called after every named task, on the thread that ran it. worker_index
+    // is -1 for threads that aren't workers of this pool.
+    using trace_hook = std::function<void(
+        const char* name,
+        int worker_index,
+        std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end
+    )>;
+
+    // Zero workers means one per hardware thread.
+    thread_pool(unsigned worker_count = 0);
+    thread_pool(const thread_pool& other) = delete;
+    thread_pool(thread_pool&& other) = delete;
+    ~thread_pool();
+
+    unsigned get_worker_count() const;
+    // Returns -1 if the calling thread is not a worker of this pool.
+    int get_worker_index() const;
+
+    // Must be set before any named tasks are submitted.
+    void set_trace_hook(trace_hook hook);
+
+    // Runs the function on some worker thread. Exceptions are passed through
+    // the returned future.
+    template<typename F>
+    auto run(F&& f) -> std::future<decltype(f())>;
+
+    // Calls f(i) for every i in [0, count) and returns once all calls have
+    // finished. The calling thread participates in the work, so this can also
+    // be called from within tasks. The first exception thrown by f is
+    // rethrown here.
+    template<typename F>
+    void parallel_for(size_t count, F&& f, const char* name = nullptr);
+
+    // Runs one queued task on the calling thread. Returns false if there was
+    // nothing to run.
+    bool run_pending_task();
+
+    // Runs queued tasks until done() returns true. Whoever makes done() true
+    // must call notify_waiters() afterwards.
+    template<typename P>
+    void wait_until(P&& done);
+    void notify_waiters();
+
+private:
+    struct task
+    {
+        std::function<void()> func;
+        const char* name;
+    };
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    void push(task&& t);
+    bool pop(task& t);
+    void execute(task& t);
+    void worker(unsigned index);
+
+    // One queue per worker, plus a final one for tasks from other threads.
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+    // Idle workers and waiting threads sleep on this.
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<size_t> queued;
+    bool quit;
+    trace_hook hook;
+};
+
+// Fork/join helper: tasks are started with run() and joined with wait(). The
+// group must outlive its tasks, so the destructor also waits.
+class task_group
+{
+public:
+    // Tasks are traced under the given name, if any.
+    task_group(thread_pool& pool, const char* name = nullptr);
+    task_group(const task_group& other) = delete;
+    ~task_group();
+
+    template<typename F>
+    void run(F&& f);
+
+    // Returns once all tasks started so far have finished. The first
+    // exception thrown by a task is rethrown here.
+    void wait();
+
+private:
+    thread_pool& pool;
+    const char* name;
+    std::atomic<size_t> unfinished;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+}
+
+#include "thread_pool.tcc"
+
+#endif
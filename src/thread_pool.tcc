@@ -0,0 +1,119 @@
+#ifndef TAURAY_THREAD_POOL_TCC
+#define TAURAY_THREAD_POOL_TCC
+#include "thread_pool.hh"
+
+namespace tr
+{
+
+template<typename F>
+auto thread_pool::run(F&& f) -> std::future<decltype(f())>
+{
+    using result_type = decltype(f());
+    // std::function needs to be copyable, packaged_task is not.
+    auto task = std::make_shared<std::packaged_task<result_type()>>(
+        std::forward<F>(f)
+    );
+    std::future<result_type> res = task->get_future();
+    push({[task](){ (*task)(); }, nullptr});
+    return res;
+}
+
+template<typename F>
+void thread_pool::parallel_for(size_t count, F&& f, const char* name)
+{
+    if(count == 0) return;
+
+    using func_type = std::remove_reference_t<F>;
+    struct shared_state
+    {
+        func_type* func;
+        size_t count;
+        std::atomic<size_t> next;
+        std::atomic<size_t> finished;
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<shared_state>();
+    state->func = &f;
+    state->count = count;
+    state->next = 0;
+    state->finished = 0;
+
+    // Helpers that start late just find no indices left. 'func' is only
+    // touched after claiming an index, so it stays valid: the caller waits
+    // for every claimed index to finish.
+    auto work = [this](shared_state& s){
+        for(size_t i = s.next++; i < s.count; i = s.next++)
+        {
+            try
+            {
+                (*s.func)(i);
+            }
+            catch(...)
+            {
+                std::unique_lock lk(s.mutex);
+                if(!s.error) s.error = std::current_exception();
+            }
+            if(++s.finished == s.count)
+                notify_waiters();
+        }
+    };
+
+    size_t helper_count = std::min(workers.size(), count-1);
+    for(size_t i = 0; i < helper_count; ++i)
+        push({[state, work](){ work(*state); }, name});
+
+    if(hook && name)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        work(*state);
+        hook(name, get_worker_index(), begin, std::chrono::steady_clock::now());
+    }
+    else work(*state);
+
+    wait_until([&](){ return state->finished == count; });
+    if(state->error)
+        std::rethrow_exception(state->error);
+}
+
+template<typename P>
+void thread_pool::wait_until(P&& done)
+{
+    while(!done())
+    {
+        if(run_pending_task())
+            continue;
+
+        std::unique_lock lk(sleep_mutex);
+        sleep_cv.wait(lk, [&](){ return queued > 0 || done(); });
+    }
+}
+
+template<typename F>
+void task_group::run(F&& f)
+{
+    unfinished++;
+    // The group may be gone as soon as 'unfinished' reaches zero, so the pool
+    // is captured separately.
+    thread_pool* p = &pool;
+    pool.push({
+        [this, p, f = std::forward<F>(f)]() mutable {
+            try
+            {
+                f();
+            }
+            catch(...)
+            {
+                std::unique_lock lk(error_mutex);
+                if(!error) error = std::current_exception();
+            }
+            if(--unfinished == 0)
+                p->notify_waiters();
+        },
+        name
+    });
+}
+
+}
+
+#endif
@@ -71,7 +71,7 @@ tonemap_stage::tonemap_stage(
     );
     output_reorder_buf = create_buffer(dev, info, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT, this->opt.reorder.data());
 
-    for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(uint32_t i = 0; i < dev.ctx->get_frames_in_flight(); ++i)
     for(uint32_t j = 0; j < output_frames.size(); ++j)
     {
         // Bind descriptors
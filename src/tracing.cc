@@ -14,7 +14,7 @@ enum trace_format
 };
 
 tracing_record::tracing_record(context* ctx)
-: ctx(ctx), frame_counter(0), host_finished_frame_counter(0), device_finished_frame_counter(0)
+: ctx(ctx), max_timestamps(0), frame_counter(0), host_finished_frame_counter(0), device_finished_frame_counter(0)
 {
 }
 
@@ -58,6 +58,13 @@ void tracing_record::deinit()
 
 void tracing_record::begin_frame()
 {
+    if(frame_counter == host_finished_frame_counter)
+    {
+        // Tasks recorded while no frame was active, e.g. during scene
+        // loading, don't belong in this frame's trace.
+        std::unique_lock lk(host_task_mutex);
+        host_tasks.clear();
+    }
     finish_host_frame();
 
     if(times.size() != 0 && times.front().frame_number + 1 < device_finished_frame_counter)
@@ -91,7 +98,7 @@ void tracing_record::device_finish_frame()
     }
     if(!res) return;
 
-    uint32_t findex = res->frame_number%MAX_FRAMES_IN_FLIGHT;
+    uint32_t findex = res->frame_number%ctx->get_frames_in_flight();
 
     const auto& devices = ctx->get_devices();
     res->device_traces.resize(devices.size());
@@ -218,16 +225,44 @@ void tracing_record::finish_host_frame()
         timing_result& res = times.back();
         host_finished_frame_counter++;
 
+        const char* name = res.host_traces.size() == 0 ?
+            "CPU working" : "CPU waiting";
+        {
+            // Tasks go before the final event, which must stay last.
+            std::unique_lock lk(host_task_mutex);
+            res.host_traces.insert(
+                res.host_traces.end(), host_tasks.begin(), host_tasks.end()
+            );
+            host_tasks.clear();
+        }
         res.host_traces.push_back({
             std::chrono::duration_cast<std::chrono::duration<double>>(wait_start_time.time_since_epoch()).count() * 1e9 - host_reference_ns,
             std::chrono::duration_cast<std::chrono::duration<double>>(time_now - wait_start_time).count() * 1e9,
-            res.host_traces.size() == 0 ? "CPU working" : "CPU waiting"
+            name
         });
     }
     frame_start_time = time_now;
     wait_start_time = time_now;
 }
 
+void tracing_record::host_task(
+    const char* name,
+    int worker_index,
+    std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end
+){
+    if(max_timestamps == 0) return;
+
+    trace_event event = {
+        std::chrono::duration_cast<std::chrono::duration<double>>(begin.time_since_epoch()).count() * 1e9 - host_reference_ns,
+        std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count() * 1e9,
+        name,
+        worker_index < 0 ? "" : "CPU worker " + std::to_string(worker_index)
+    };
+    std::unique_lock lk(host_task_mutex);
+    host_tasks.push_back(std::move(event));
+}
+
 const tracing_record::timing_result* tracing_record::find_latest_finished_frame() const
 {
     for(auto it = times.rbegin(); it != times.rend(); ++it)
@@ -268,7 +303,10 @@ void tracing_record::print_simple_trace(const timing_result& res)
     }
     for(const trace_event& t: res.host_traces)
     {
-        TR_TIME("\t\t[", t.name, "] ", t.duration_ns/1e6, " ms");
+        if(t.thread.empty())
+            TR_TIME("\t\t[", t.name, "] ", t.duration_ns/1e6, " ms");
+        else
+            TR_TIME("\t\t[", t.name, " (", t.thread, ")] ", t.duration_ns/1e6, " ms");
     }
 }
 
@@ -284,7 +322,7 @@ void tracing_record::print_tef_trace(const timing_result& res)
     {
         nlohmann::json output = {
             {"pid", "CPU"},
-            {"tid", "CPU"},
+            {"tid", t.thread.empty() ? "CPU" : t.thread},
             {"ts",int64_t(t.start_ns*1e-3)},
             {"dur",int64_t(t.duration_ns*1e-3)},
             {"ph", "X"},
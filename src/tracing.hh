@@ -6,6 +6,7 @@
 #include <map>
 #include <deque>
 #include <chrono>
+#include <mutex>
 
 namespace tr
 {
@@ -15,6 +16,8 @@ struct trace_event
     double start_ns;
     double duration_ns;
     std::string name;
+    // Empty for the main thread.
+    std::string thread = "";
 };
 
 class context;
@@ -41,6 +44,15 @@ public:
     void unregister_timer(size_t device_index, int timer_id);
     vk::QueryPool get_timestamp_pool(size_t device_index, uint32_t frame_index);
 
+    // Records a CPU task that ran during this frame, called from any thread.
+    // Tasks recorded outside of frames are dropped.
+    void host_task(
+        const char* name,
+        int worker_index,
+        std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end
+    );
+
     float get_duration(size_t device_index, const std::string& name) const;
     void print_last_trace(trace_format format = SIMPLE);
 
@@ -83,6 +95,9 @@ private:
     std::chrono::steady_clock::time_point wait_start_time;
 
     double host_reference_ns;
+
+    std::mutex host_task_mutex;
+    std::vector<trace_event> host_tasks;
 };
 
 }
@@ -0,0 +1,266 @@
+#include "transform_hierarchy.hh"
+#include "thread_pool.hh"
+#include <numeric>
+
+namespace
+{
+
+// Nodes per task when updating a depth level.
+constexpr uint32_t TRANSFORM_CHUNK_SIZE = 256;
+
+}
+
+namespace tr
+{
+
+transform_hierarchy::transform_hierarchy()
+:   cur_scene(nullptr), order_outdated(true), parent_change_counter(0),
+    static_change_counter(0), external_parents(false)
+{
+}
+
+bool transform_hierarchy::update(scene& s, thread_pool* pool)
+{
+    if(cur_scene != &s)
+    {
+        cur_scene = &s;
+        events[0].emplace(s.subscribe([this](scene&, const add_component<transformable>&){ order_outdated = true; }));
+        events[1].emplace(s.subscribe([this](scene&, const remove_component<transformable>&){ order_outdated = true; }));
+        order_outdated = true;
+    }
+
+    uint64_t parent_changes = transformable::get_parent_change_counter();
+    bool order_changed = false;
+    if(order_outdated || parent_changes != parent_change_counter)
+    {
+        order_changed = refresh_order(s);
+        order_outdated = false;
+        parent_change_counter = parent_changes;
+    }
+
+    // The counter is shared by all scenes, so the flags of this one are
+    // compared before doing anything.
+    uint64_t static_changes = transformable::get_static_change_counter();
+    bool static_changed = false;
+    if(static_changes != static_change_counter)
+    {
+        static_changed = order_changed || static_flags_changed();
+        static_change_counter = static_changes;
+    }
+    if(order_changed || static_changed)
+    {
+        // Everything is visited once, so that nodes that just became static
+        // are up to date.
+        update_levels(all_nodes, level_offsets, order_changed, pool);
+        refresh_dynamic_nodes();
+    }
+    else update_levels(dynamic_nodes, dynamic_level_offsets, false, pool);
+    return order_changed;
+}
+
+int transform_hierarchy::get_index(const transformable* t) const
+{
+    auto it = node_indices.find(t);
+    if(it == node_indices.end())
+        return -1;
+    return it->second;
+}
+
+const mat4& transform_hierarchy::get_global_transform(int index) const
+{
+    return global_transforms[index];
+}
+
+const mat4& transform_hierarchy::get_global_inverse_transpose_transform(
+    int index
+) const {
+    return global_inverse_transpose_transforms[index];
+}
+
+bool transform_hierarchy::refresh_order(scene& s)
+{
+    bool changed = false;
+    size_t count = 0;
+    s.foreach([&](transformable& t){
+        if(count == scene_nodes.size())
+        {
+            scene_nodes.push_back(&t);
+            scene_parents.push_back(t.get_parent());
+            changed = true;
+        }
+        else if(
+            scene_nodes[count] != &t ||
+            scene_parents[count] != t.get_parent()
+        ){
+            scene_nodes[count] = &t;
+            scene_parents[count] = t.get_parent();
+            changed = true;
+        }
+        ++count;
+    });
+    if(count != scene_nodes.size())
+    {
+        scene_nodes.resize(count);
+        scene_parents.resize(count);
+        changed = true;
+    }
+    if(!changed)
+        return false;
+
+    std::unordered_map<const transformable*, uint32_t> scene_indices;
+    for(uint32_t i = 0; i < count; ++i)
+        scene_indices[scene_nodes[i]] = i;
+
+    // Depths are found by walking up until a node of known depth or a root is
+    // found, so every node is only visited once.
+    std::vector<int> depths(count, -1);
+    std::vector<uint32_t> chain;
+    int max_depth = -1;
+    external_parents = false;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        chain.clear();
+        int depth = -1;
+        for(uint32_t j = i;;)
+        {
+            if(depths[j] >= 0)
+            {
+                depth = depths[j];
+                break;
+            }
+            chain.push_back(j);
+            const transformable* parent = scene_parents[j];
+            auto it = parent ? scene_indices.find(parent) : scene_indices.end();
+            if(it == scene_indices.end())
+            {
+                if(parent) external_parents = true;
+                break;
+            }
+            j = it->second;
+        }
+        for(auto it = chain.rbegin(); it != chain.rend(); ++it)
+            depths[*it] = ++depth;
+        max_depth = std::max(max_depth, depth);
+    }
+
+    // Counting sort by depth, scene order is kept within each level.
+    level_offsets.assign(max_depth+2, 0);
+    for(uint32_t i = 0; i < count; ++i)
+        level_offsets[depths[i]+1]++;
+    for(size_t level = 1; level < level_offsets.size(); ++level)
+        level_offsets[level] += level_offsets[level-1];
+
+    std::vector<uint32_t> level_fill(
+        level_offsets.begin(), level_offsets.end()-1
+    );
+    nodes.resize(count);
+    node_indices.clear();
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t index = level_fill[depths[i]]++;
+        nodes[index] = scene_nodes[i];
+        node_indices[scene_nodes[i]] = index;
+    }
+
+    parent_indices.resize(count);
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        auto it = node_indices.find(nodes[i]->get_parent());
+        parent_indices[i] = it == node_indices.end() ? -1 : it->second;
+    }
+
+    all_nodes.resize(count);
+    std::iota(all_nodes.begin(), all_nodes.end(), 0);
+
+    global_transforms.resize(count);
+    global_inverse_transpose_transforms.resize(count);
+#ifdef TR_TRANSFORM_CACHING
+    revisions.resize(count);
+#endif
+    return true;
+}
+
+void transform_hierarchy::refresh_dynamic_nodes()
+{
+    dynamic_nodes.clear();
+    dynamic_level_offsets.assign(level_offsets.size(), 0);
+    for(size_t level = 0; level+1 < level_offsets.size(); ++level)
+    {
+        for(uint32_t i = level_offsets[level]; i < level_offsets[level+1]; ++i)
+            if(!nodes[i]->is_static())
+                dynamic_nodes.push_back(i);
+        dynamic_level_offsets[level+1] = dynamic_nodes.size();
+    }
+}
+
+bool transform_hierarchy::static_flags_changed() const
+{
+    // dynamic_nodes is in increasing order.
+    size_t d = 0;
+    for(uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        bool dynamic = d < dynamic_nodes.size() && dynamic_nodes[d] == i;
+        if(dynamic) ++d;
+        if(dynamic == nodes[i]->is_static())
+            return true;
+    }
+    return false;
+}
+
+void transform_hierarchy::update_levels(
+    const std::vector<uint32_t>& indices,
+    const std::vector<uint32_t>& offsets,
+    bool force,
+    thread_pool* pool
+){
+    for(size_t level = 0; level+1 < offsets.size(); ++level)
+    {
+        uint32_t begin = offsets[level];
+        uint32_t end = offsets[level+1];
+        uint32_t chunk_count =
+            (end - begin + TRANSFORM_CHUNK_SIZE - 1) / TRANSFORM_CHUNK_SIZE;
+        if(!pool || chunk_count <= 1 || (level == 0 && external_parents))
+        {
+            for(uint32_t i = begin; i < end; ++i)
+                update_node(indices[i], force);
+        }
+        else
+        {
+            pool->parallel_for(chunk_count, [&](size_t chunk){
+                uint32_t chunk_begin = begin + chunk * TRANSFORM_CHUNK_SIZE;
+                uint32_t chunk_end =
+                    std::min(chunk_begin + TRANSFORM_CHUNK_SIZE, end);
+                for(uint32_t i = chunk_begin; i < chunk_end; ++i)
+                    update_node(indices[i], force);
+            }, "transforms");
+        }
+    }
+}
+
+void transform_hierarchy::update_node(uint32_t index, bool force)
+{
+    const transformable* t = nodes[index];
+#ifdef TR_TRANSFORM_CACHING
+    // Only nodes with parents outside of the scene can have a parent that
+    // isn't up to date yet.
+    uint16_t revision = parent_indices[index] < 0 && t->get_parent() ?
+        t->update_cached_transform() : t->update_cached_transform_shallow();
+    if(force || revisions[index] != revision)
+    {
+        revisions[index] = revision;
+        global_transforms[index] = t->cached_transform;
+        global_inverse_transpose_transforms[index] =
+            t->cached_inverse_transpose_transform;
+    }
+#else
+    (void)force;
+    int parent_index = parent_indices[index];
+    global_transforms[index] = parent_index >= 0 ?
+        global_transforms[parent_index] * t->get_transform() :
+        t->get_global_transform();
+    global_inverse_transpose_transforms[index] =
+        transpose(affineInverse(global_transforms[index]));
+#endif
+}
+
+}
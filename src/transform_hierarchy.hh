@@ -0,0 +1,88 @@
+#ifndef TAURAY_TRANSFORM_HIERARCHY_HH
+#define TAURAY_TRANSFORM_HIERARCHY_HH
+#include "transformable.hh"
+#include "scene.hh"
+#include <unordered_map>
+
+namespace tr
+{
+
+class thread_pool;
+
+// Updates the global transforms of all transformables in a scene in one pass,
+// instead of lazily walking up the parents on every query. Nodes are sorted
+// by depth so that parents are always finished before their children, and
+// each depth level is processed in parallel. The results are also stored
+// contiguously for users that read lots of them.
+//
+// Static nodes can't move, so they're skipped unless the hierarchy or the
+// static flags have changed. The order is only refreshed when transformables
+// are added to or removed from the scene, or their parents change through
+// transformable::set_parent().
+class transform_hierarchy
+{
+public:
+    transform_hierarchy();
+    transform_hierarchy(const transform_hierarchy& other) = delete;
+
+    // Returns true if the node order changed, which invalidates any indices
+    // from get_index().
+    bool update(scene& s, thread_pool* pool = nullptr);
+
+    // Returns -1 if the transformable wasn't in the scene during the last
+    // update().
+    int get_index(const transformable* t) const;
+
+    // These are valid until the next update().
+    const mat4& get_global_transform(int index) const;
+    const mat4& get_global_inverse_transpose_transform(int index) const;
+
+private:
+    bool refresh_order(scene& s);
+    void refresh_dynamic_nodes();
+    bool static_flags_changed() const;
+    void update_levels(
+        const std::vector<uint32_t>& indices,
+        const std::vector<uint32_t>& offsets,
+        bool force,
+        thread_pool* pool
+    );
+    void update_node(uint32_t index, bool force);
+
+    scene* cur_scene;
+    std::optional<event_subscription> events[2];
+    // Set by the scene's events when transformables are added or removed.
+    bool order_outdated;
+    uint64_t parent_change_counter;
+    uint64_t static_change_counter;
+
+    // In scene iteration order, used for detecting changes.
+    std::vector<const transformable*> scene_nodes;
+    std::vector<const transformable*> scene_parents;
+
+    // In depth order.
+    std::vector<const transformable*> nodes;
+    // Nodes of depth i are in [level_offsets[i], level_offsets[i+1]).
+    std::vector<uint32_t> level_offsets;
+    // Indices of all nodes, and of non-static nodes only. These are also in
+    // depth order, split into levels like above.
+    std::vector<uint32_t> all_nodes;
+    std::vector<uint32_t> dynamic_nodes;
+    std::vector<uint32_t> dynamic_level_offsets;
+    // -1 for roots and nodes whose parent isn't in the scene.
+    std::vector<int> parent_indices;
+    // Set if some parents aren't in the scene. Those must be updated through
+    // the parent chain, which isn't safe to do in parallel.
+    bool external_parents;
+    std::unordered_map<const transformable*, uint32_t> node_indices;
+
+    std::vector<mat4> global_transforms;
+    std::vector<mat4> global_inverse_transpose_transforms;
+#ifdef TR_TRANSFORM_CACHING
+    std::vector<uint16_t> revisions;
+#endif
+};
+
+}
+
+#endif
@@ -9,6 +9,9 @@
 namespace tr
 {
 
+std::atomic<uint64_t> transformable::static_change_counter = 1;
+std::atomic<uint64_t> transformable::parent_change_counter = 1;
+
 transformable::transformable(transformable* parent):
 #ifdef TR_TRANSFORM_CACHING
     cached_revision(0),
@@ -322,6 +325,8 @@ void transformable::set_parent(
                 affineInverse(parent->get_global_transform()) * transform;
         decompose_matrix(transform, position, scaling, orientation);
     }
+    if(this->parent != parent)
+        parent_change_counter++;
     this->parent = parent;
     REVISION;
     // Setting cached_parent_revision is unnecessary, since the changed revision
@@ -333,12 +338,19 @@ transformable* transformable::get_parent() const
     return parent;
 }
 
+uint64_t transformable::get_parent_change_counter()
+{
+    return parent_change_counter;
+}
+
 void transformable::set_static(bool s)
 {
 #ifdef TR_TRANSFORM_CACHING
     if(!this->static_locked)
         update_cached_transform();
 #endif
+    if(this->static_locked != s)
+        static_change_counter++;
     this->static_locked = s;
 }
 
@@ -347,6 +359,11 @@ bool transformable::is_static() const
     return static_locked;
 }
 
+uint64_t transformable::get_static_change_counter()
+{
+    return static_change_counter;
+}
+
 void transformable::lookat(
     vec3 pos,
     vec3 up,
@@ -434,12 +451,19 @@ void transformable::align_to_view(
 
 #ifdef TR_TRANSFORM_CACHING
 uint16_t transformable::update_cached_transform() const
+{
+    if(!static_locked && parent)
+        parent->update_cached_transform();
+    return update_cached_transform_shallow();
+}
+
+uint16_t transformable::update_cached_transform_shallow() const
 {
     if(static_locked) return revision;
 
     if(parent)
     {
-        uint16_t parent_revision = parent->update_cached_transform();
+        uint16_t parent_revision = parent->revision;
         if(
             cached_revision != revision ||
             cached_parent_revision != parent_revision
@@ -1,6 +1,7 @@
 #ifndef TAURAY_TRANSFORMABLE_HH
 #define TAURAY_TRANSFORMABLE_HH
 #include "math.hh"
+#include <atomic>
 
 // Transform caching doubles the size of transformable, but can make
 // get_global_transform() significantly faster in some cases.
@@ -9,8 +10,10 @@
 namespace tr
 {
 
+class transform_hierarchy;
 class transformable
 {
+friend class transform_hierarchy;
 public:
     transformable(transformable* parent = nullptr);
     transformable(vec3 pos, vec3 scale = vec3(1), vec3 direction = vec3(0,0,-1), vec3 forward = vec3(0,0,-1));
@@ -76,12 +79,20 @@ public:
         bool keep_transform = false
     );
     transformable* get_parent() const;
+    // Incremented whenever the parent of any transformable changes. Users
+    // must still compare the parents they care about to see if anything
+    // relevant changed.
+    static uint64_t get_parent_change_counter();
 
     // Once marked static, a transformable should no longer move in any way.
     // This includes its parents! So make sure that children of dynamic objects
     // are not marked as static.
     void set_static(bool s);
     bool is_static() const;
+    // Incremented whenever the static flag of any transformable changes, so
+    // that users caching static objects only need to check their flags after
+    // this changes.
+    static uint64_t get_static_change_counter();
 
     void lookat(
         vec3 pos,
@@ -114,6 +125,10 @@ public:
 
 private:
 #ifdef TR_TRANSFORM_CACHING
+    // Same as update_cached_transform(), but assumes that the parent is
+    // already up to date.
+    uint16_t update_cached_transform_shallow() const;
+
     mutable uint16_t cached_revision;
     mutable uint16_t revision;
     mutable mat4 cached_transform;
@@ -121,6 +136,9 @@ private:
     mutable uint16_t cached_parent_revision;
 #endif
 
+    static std::atomic<uint64_t> static_change_counter;
+    static std::atomic<uint64_t> parent_change_counter;
+
     transformable* parent;
     quat orientation;
     vec3 position, scaling;
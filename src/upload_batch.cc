@@ -0,0 +1,436 @@
+#include "upload_batch.hh"
+#include "misc.hh"
+#include <cstring>
+
+namespace
+{
+
+// Beyond this, new uploads wait for the oldest chunk to become free again.
+constexpr size_t MAX_STAGING_CHUNKS = 4;
+
+// Image copy offsets must be multiples of both 4 and the texel size. 48 is
+// divisible by every uncompressed texel size, including the 3-byte and
+// 12-byte ones, and by the 8 and 16-byte compressed block sizes.
+constexpr size_t STAGING_ALIGNMENT = 48;
+
+}
+
+namespace tr
+{
+
+upload_batch::upload_batch(device_mask dev, size_t staging_chunk_size)
+: staging_chunk_size(staging_chunk_size), devices(dev)
+{
+    for(auto[dev, d]: devices)
+    {
+        d.transfer_timeline = create_timeline_semaphore(dev);
+        d.graphics_timeline = create_timeline_semaphore(dev);
+        d.prev_batch = dev.active_uploads;
+        dev.active_uploads = this;
+    }
+}
+
+upload_batch::~upload_batch()
+{
+    finish();
+    for(auto[dev, d]: devices)
+    {
+        // Everything is finished, so the staging memory can go right away.
+        for(staging_chunk& c: d.chunks)
+        {
+            vmaUnmapMemory(dev.allocator, c.buf.get_allocation());
+            c.buf.destroy();
+        }
+        dev.active_uploads = d.prev_batch;
+    }
+}
+
+void upload_batch::upload_buffer(
+    device& dev,
+    vk::Buffer dst,
+    size_t data_size,
+    const void* data
+){
+    device_data& d = devices[dev.id];
+
+    vk::Buffer staging;
+    size_t offset = 0;
+    uint8_t* mem = allocate_staging(dev, d, data_size, staging, offset);
+    memcpy(mem, data, data_size);
+
+    vk::CommandBuffer cb = get_transfer_cb(dev, d);
+    cb.copyBuffer(staging, dst, {{offset, 0, data_size}});
+    d.written_buffers.push_back(dst);
+}
+
+void upload_batch::upload_image(
+    device& dev,
+    vk::Image img,
+    const vk::ImageCreateInfo& info,
+    vk::ImageLayout final_layout,
+    size_t data_size,
+    const void* data,
+    bool data_has_mipmaps
+){
+    device_data& d = devices[dev.id];
+
+    if(data)
+    {
+        vk::Buffer staging;
+        size_t offset = 0;
+        uint8_t* mem = allocate_staging(dev, d, data_size, staging, offset);
+        memcpy(mem, data, data_size);
+
+        vk::CommandBuffer cb = get_transfer_cb(dev, d);
+        transition_image_layout(
+            cb, img, info.format,
+            vk::ImageLayout::eUndefined,
+            vk::ImageLayout::eTransferDstOptimal,
+            0, info.mipLevels
+        );
+        if(data_has_mipmaps)
+        {
+            cb.copyBufferToImage(
+                staging, img, vk::ImageLayout::eTransferDstOptimal,
+                get_mip_chain_copy_regions(
+                    info.format, info.extent, info.mipLevels, offset
+                )
+            );
+        }
+        else
+        {
+            vk::BufferImageCopy region(
+                offset, 0, 0,
+                {deduce_aspect_mask(info.format), 0, 0, 1},
+                {0,0,0},
+                info.extent
+            );
+            cb.copyBufferToImage(
+                staging, img, vk::ImageLayout::eTransferDstOptimal, 1, &region
+            );
+        }
+    }
+
+    d.images.push_back({
+        img, info.format, info.extent, info.mipLevels, final_layout,
+        data != nullptr, data != nullptr && data_has_mipmaps
+    });
+}
+
+void upload_batch::flush()
+{
+    for(auto[dev, d]: devices)
+        flush(dev, d);
+}
+
+void upload_batch::finish()
+{
+    for(;;)
+    {
+        for(auto[dev, d]: devices)
+        {
+            flush(dev, d);
+            release_finished(dev, d, true);
+        }
+        if(deferred.empty())
+            break;
+
+        // Deferred functions may record more uploads, so they get finished on
+        // the next round.
+        std::vector<std::function<void()>> funcs = std::move(deferred);
+        deferred.clear();
+        for(std::function<void()>& func: funcs)
+            func();
+    }
+}
+
+void upload_batch::defer(std::function<void()>&& func)
+{
+    deferred.push_back(std::move(func));
+}
+
+vk::CommandBuffer upload_batch::get_transfer_cb(device& dev, device_data& d)
+{
+    if(!d.transfer_cb)
+    {
+        d.transfer_cb = dev.logical.allocateCommandBuffers({
+            dev.transfer_pool, vk::CommandBufferLevel::ePrimary, 1
+        })[0];
+        d.transfer_cb.begin(vk::CommandBufferBeginInfo{
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+        });
+    }
+    return d.transfer_cb;
+}
+
+uint8_t* upload_batch::allocate_staging(
+    device& dev,
+    device_data& d,
+    size_t size,
+    vk::Buffer& buf,
+    size_t& offset
+){
+    if(size > staging_chunk_size)
+    {
+        staging_chunk& c = d.oversized.emplace_back();
+        c.buf = create_staging_buffer(dev, size);
+        vmaMapMemory(dev.allocator, c.buf.get_allocation(), (void**)&c.mem);
+        buf = c.buf;
+        offset = 0;
+        return c.mem;
+    }
+
+    offset = (d.chunk_offset + STAGING_ALIGNMENT - 1)
+        / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+    if(d.chunks.size() == 0 || offset + size > staging_chunk_size)
+    {
+        // The current chunk must be submitted before anything can reuse it.
+        if(d.chunks.size() != 0)
+            flush(dev, d);
+        next_chunk(dev, d);
+        offset = 0;
+    }
+
+    staging_chunk& c = d.chunks[d.chunk_index];
+    d.chunk_offset = offset + size;
+    buf = c.buf;
+    return c.mem + offset;
+}
+
+void upload_batch::next_chunk(device& dev, device_data& d)
+{
+    uint64_t done = dev.logical.getSemaphoreCounterValue(d.transfer_timeline);
+    for(size_t i = 0; i < d.chunks.size(); ++i)
+    {
+        if(d.chunks[i].last_use <= done)
+        {
+            d.chunk_index = i;
+            d.chunk_offset = 0;
+            d.chunks[i].last_use = 0;
+            return;
+        }
+    }
+
+    if(d.chunks.size() < MAX_STAGING_CHUNKS)
+    {
+        staging_chunk& c = d.chunks.emplace_back();
+        c.buf = create_staging_buffer(dev, staging_chunk_size);
+        vmaMapMemory(dev.allocator, c.buf.get_allocation(), (void**)&c.mem);
+        d.chunk_index = d.chunks.size()-1;
+        d.chunk_offset = 0;
+        return;
+    }
+
+    // All chunks are in flight, so wait for the oldest one.
+    size_t oldest = 0;
+    for(size_t i = 1; i < d.chunks.size(); ++i)
+        if(d.chunks[i].last_use < d.chunks[oldest].last_use)
+            oldest = i;
+
+    (void)dev.logical.waitSemaphores(
+        {{}, 1, d.transfer_timeline.get(), &d.chunks[oldest].last_use},
+        UINT64_MAX
+    );
+    release_finished(dev, d, false);
+    d.chunk_index = oldest;
+    d.chunk_offset = 0;
+    d.chunks[oldest].last_use = 0;
+}
+
+void upload_batch::flush(device& dev, device_data& d)
+{
+    if(!d.transfer_cb && d.images.size() == 0)
+        return;
+
+    // With exclusive sharing, resources written on a separate transfer queue
+    // family must be explicitly handed over to the graphics queue family.
+    bool handoff = dev.transfer_family_index != dev.graphics_family_index;
+    std::vector<vk::BufferMemoryBarrier> buffer_barriers;
+    std::vector<vk::ImageMemoryBarrier> image_barriers;
+    if(handoff)
+    {
+        for(vk::Buffer buf: d.written_buffers)
+        {
+            buffer_barriers.push_back({
+                vk::AccessFlagBits::eTransferWrite, {},
+                dev.transfer_family_index, dev.graphics_family_index,
+                buf, 0, VK_WHOLE_SIZE
+            });
+        }
+        for(const pending_image& img: d.images)
+        {
+            if(!img.has_data) continue;
+            image_barriers.push_back({
+                vk::AccessFlagBits::eTransferWrite, {},
+                vk::ImageLayout::eTransferDstOptimal,
+                vk::ImageLayout::eTransferDstOptimal,
+                dev.transfer_family_index, dev.graphics_family_index,
+                img.img,
+                {
+                    deduce_aspect_mask(img.format),
+                    0, img.mip_levels, 0, VK_REMAINING_ARRAY_LAYERS
+                }
+            });
+        }
+    }
+
+    bool waits_for_transfer = false;
+    if(d.transfer_cb)
+    {
+        if(handoff)
+        {
+            d.transfer_cb.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eBottomOfPipe,
+                {}, {}, buffer_barriers, image_barriers
+            );
+        }
+        d.transfer_cb.end();
+
+        // The transfer queue only signals its own timeline, so it can run
+        // ahead of the graphics queue.
+        d.transfer_value++;
+        vk::TimelineSemaphoreSubmitInfo timeline_info(
+            0, nullptr, 1, &d.transfer_value
+        );
+        vk::SubmitInfo submit_info(
+            0, nullptr, nullptr, 1, &d.transfer_cb,
+            1, d.transfer_timeline.get()
+        );
+        submit_info.pNext = &timeline_info;
+        dev.transfer_queue.submit(submit_info, {});
+
+        d.transfer_cbs.push_back({d.transfer_value, d.transfer_cb});
+        d.transfer_cb = vk::CommandBuffer();
+        waits_for_transfer = true;
+    }
+
+    vk::CommandBuffer cb = dev.logical.allocateCommandBuffers({
+        dev.graphics_pool, vk::CommandBufferLevel::ePrimary, 1
+    })[0];
+    cb.begin(vk::CommandBufferBeginInfo{
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+    });
+
+    if(handoff)
+    {
+        for(vk::BufferMemoryBarrier& b: buffer_barriers)
+        {
+            b.srcAccessMask = {};
+            b.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+        }
+        for(vk::ImageMemoryBarrier& b: image_barriers)
+        {
+            b.srcAccessMask = {};
+            b.dstAccessMask = vk::AccessFlagBits::eTransferRead |
+                vk::AccessFlagBits::eTransferWrite;
+        }
+        cb.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eAllCommands,
+            {}, {}, buffer_barriers, image_barriers
+        );
+    }
+    else bulk_upload_barrier(cb);
+
+    for(const pending_image& img: d.images)
+    {
+        if(img.has_mipmaps)
+        {
+            transition_image_layout(
+                cb, img.img, img.format,
+                vk::ImageLayout::eTransferDstOptimal, img.final_layout,
+                0, img.mip_levels
+            );
+        }
+        else if(img.has_data)
+        {
+            generate_mipmaps(
+                cb, img.img, img.format, img.extent,
+                img.mip_levels, img.final_layout
+            );
+        }
+        else
+        {
+            transition_image_layout(
+                cb, img.img, img.format,
+                vk::ImageLayout::eUndefined, img.final_layout
+            );
+        }
+    }
+    cb.end();
+
+    vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+    d.graphics_value++;
+    vk::TimelineSemaphoreSubmitInfo timeline_info(
+        waits_for_transfer ? 1 : 0, &d.transfer_value, 1, &d.graphics_value
+    );
+    vk::SubmitInfo submit_info(
+        waits_for_transfer ? 1 : 0, d.transfer_timeline.get(), &wait_stage,
+        1, &cb, 1, d.graphics_timeline.get()
+    );
+    submit_info.pNext = &timeline_info;
+    dev.graphics_queue.submit(submit_info, {});
+    d.graphics_cbs.push_back({d.graphics_value, cb});
+
+    // Staging memory is only read by the transfer queue, so it is free once
+    // the transfer submission is done.
+    if(d.chunks.size() != 0 && d.chunks[d.chunk_index].last_use == 0)
+        d.chunks[d.chunk_index].last_use = d.transfer_value;
+    for(staging_chunk& c: d.oversized)
+        if(c.last_use == 0)
+            c.last_use = d.transfer_value;
+    // Nothing fits in the rest of the current chunk anymore, as it is now
+    // in flight.
+    d.chunk_offset = staging_chunk_size;
+
+    d.written_buffers.clear();
+    d.images.clear();
+
+    release_finished(dev, d, false);
+}
+
+void upload_batch::release_finished(device& dev, device_data& d, bool wait_all)
+{
+    if(wait_all)
+    {
+        vk::Semaphore sems[] = {d.transfer_timeline, d.graphics_timeline};
+        uint64_t values[] = {d.transfer_value, d.graphics_value};
+        (void)dev.logical.waitSemaphores({{}, 2, sems, values}, UINT64_MAX);
+    }
+    uint64_t transfer_done =
+        dev.logical.getSemaphoreCounterValue(d.transfer_timeline);
+    uint64_t graphics_done =
+        dev.logical.getSemaphoreCounterValue(d.graphics_timeline);
+
+    auto free_cbs = [&](
+        std::vector<std::pair<uint64_t, vk::CommandBuffer>>& cbs,
+        vk::CommandPool pool,
+        uint64_t done
+    ){
+        for(auto it = cbs.begin(); it != cbs.end();)
+        {
+            if(it->first <= done)
+            {
+                dev.logical.freeCommandBuffers(pool, it->second);
+                it = cbs.erase(it);
+            }
+            else ++it;
+        }
+    };
+    free_cbs(d.transfer_cbs, dev.transfer_pool, transfer_done);
+    free_cbs(d.graphics_cbs, dev.graphics_pool, graphics_done);
+
+    for(auto it = d.oversized.begin(); it != d.oversized.end();)
+    {
+        if(it->last_use != 0 && it->last_use <= transfer_done)
+        {
+            vmaUnmapMemory(dev.allocator, it->buf.get_allocation());
+            it->buf.destroy();
+            it = d.oversized.erase(it);
+        }
+        else ++it;
+    }
+}
+
+}
@@ -0,0 +1,121 @@
+#ifndef TAURAY_UPLOAD_BATCH_HH
+#define TAURAY_UPLOAD_BATCH_HH
+#include "context.hh"
+
+namespace tr
+{
+
+// Coalesces resource uploads into a few large submissions instead of stalling
+// the queue for every resource. Copies are recorded on the transfer queue from
+// a small ring of recycled staging buffers, and mipmap generation & layout
+// transitions follow on the graphics queue. Each queue signals its own
+// timeline semaphore, so transfers can run ahead of the graphics work.
+//
+// While a batch is alive, create_buffer() and sync_create_gpu_image() record
+// into it instead of uploading immediately. The uploaded resources must not be
+// used before finish() is called or the batch is destroyed. Work that needs
+// the uploaded data on the host side can be postponed with defer().
+class upload_batch
+{
+public:
+    upload_batch(device_mask dev, size_t staging_chunk_size = 64*1024*1024);
+    upload_batch(const upload_batch& other) = delete;
+    upload_batch(upload_batch&& other) = delete;
+    ~upload_batch();
+
+    void upload_buffer(
+        device& dev,
+        vk::Buffer dst,
+        size_t data_size,
+        const void* data
+    );
+
+    // Fills the first mip level with 'data' and generates the rest, or
+    // copies all levels if data_has_mipmaps is set (see
+    // get_mip_level_offsets()). Without data, the image is only transitioned
+    // to the final layout.
+    void upload_image(
+        device& dev,
+        vk::Image img,
+        const vk::ImageCreateInfo& info,
+        vk::ImageLayout final_layout,
+        size_t data_size = 0,
+        const void* data = nullptr,
+        bool data_has_mipmaps = false
+    );
+
+    // Submits everything recorded so far without waiting.
+    void flush();
+    // Submits everything and waits for all uploads to finish, then runs the
+    // deferred functions.
+    void finish();
+
+    // Runs 'func' once the uploads recorded so far have finished, at the
+    // latest when the batch is destroyed. 'func' may record further uploads.
+    void defer(std::function<void()>&& func);
+
+private:
+    struct staging_chunk
+    {
+        vkm<vk::Buffer> buf;
+        uint8_t* mem = nullptr;
+        // Transfer timeline value after which the chunk is free again. Zero
+        // while the chunk is still being filled.
+        uint64_t last_use = 0;
+    };
+
+    struct pending_image
+    {
+        vk::Image img;
+        vk::Format format;
+        vk::Extent3D extent;
+        uint32_t mip_levels;
+        vk::ImageLayout final_layout;
+        bool has_data;
+        bool has_mipmaps;
+    };
+
+    struct device_data
+    {
+        upload_batch* prev_batch = nullptr;
+        vkm<vk::Semaphore> transfer_timeline;
+        uint64_t transfer_value = 0;
+        vkm<vk::Semaphore> graphics_timeline;
+        uint64_t graphics_value = 0;
+
+        std::vector<staging_chunk> chunks;
+        size_t chunk_index = 0;
+        size_t chunk_offset = 0;
+        // Uploads larger than a chunk get their own staging buffers.
+        std::vector<staging_chunk> oversized;
+
+        vk::CommandBuffer transfer_cb;
+        std::vector<vk::Buffer> written_buffers;
+        std::vector<pending_image> images;
+
+        // Submitted command buffers, with the value of their queue's timeline
+        // at which they can be freed.
+        std::vector<std::pair<uint64_t, vk::CommandBuffer>> transfer_cbs;
+        std::vector<std::pair<uint64_t, vk::CommandBuffer>> graphics_cbs;
+    };
+
+    vk::CommandBuffer get_transfer_cb(device& dev, device_data& d);
+    uint8_t* allocate_staging(
+        device& dev,
+        device_data& d,
+        size_t size,
+        vk::Buffer& buf,
+        size_t& offset
+    );
+    void next_chunk(device& dev, device_data& d);
+    void flush(device& dev, device_data& d);
+    void release_finished(device& dev, device_data& d, bool wait_all);
+
+    size_t staging_chunk_size;
+    per_device<device_data> devices;
+    std::vector<std::function<void()>> deferred;
+};
+
+}
+
+#endif
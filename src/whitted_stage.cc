@@ -9,29 +9,31 @@ using namespace tr;
 
 namespace whitted
 {
-    rt_shader_sources load_sources(whitted_stage::options opt)
+    rt_shader_sources load_sources(device& dev, whitted_stage::options opt)
     {
         std::map<std::string, std::string> defines;
         rt_camera_stage::get_common_defines(defines, opt);
-        return {
-            {"shader/whitted.rgen", defines},
+        rt_shader_sources src = {
+            shader_source::deferred("shader/whitted.rgen", defines),
             {
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                    {"shader/whitted.rchit"},
-                    {"shader/whitted.rahit"}
+                    shader_source::deferred("shader/whitted.rchit"),
+                    shader_source::deferred("shader/whitted.rahit")
                 },
                 {
                     vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
-                    {"shader/transmission_shadow.rchit"},
-                    {"shader/transmission_shadow.rahit"}
+                    shader_source::deferred("shader/transmission_shadow.rchit"),
+                    shader_source::deferred("shader/transmission_shadow.rahit")
                 }
             },
             {
-                {"shader/whitted.rmiss"},
-                {"shader/transmission_shadow.rmiss"}
+                shader_source::deferred("shader/whitted.rmiss"),
+                shader_source::deferred("shader/transmission_shadow.rmiss")
             }
         };
+        compile_shaders(src, dev.ctx->get_thread_pool());
+        return src;
     }
 
     struct push_constant_buffer
@@ -70,7 +72,7 @@ whitted_stage::whitted_stage(
     const options& opt
 ):  rt_camera_stage(dev, ss, output_target, opt),
     gfx(dev, build_state(rt_stage::get_common_options(
-        whitted::load_sources(opt), opt
+        whitted::load_sources(dev, opt), opt
     ), opt)),
     opt(opt)
 {
@@ -67,7 +67,7 @@ void z_pass_stage::update(uint32_t)
         return;
 
     clear_commands();
-    for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for(size_t i = 0; i < dev->ctx->get_frames_in_flight(); ++i)
     {
         // Record command buffer
         vk::CommandBuffer cb = begin_graphics();
@@ -104,7 +104,7 @@ void z_pass_stage::update(uint32_t)
 
                 gfx->push_constants(cb, control);
 
-                cb.drawIndexed(m->get_indices().size(), 1, 0, 0, 0);
+                cb.drawIndexed(m->get_index_count(), 1, 0, 0, 0);
             }
             gfx->end_render_pass(cb);
         }